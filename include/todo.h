@@ -11,20 +11,42 @@
 #include <time.h>
 #include <ncurses.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 
 // Define necessary constants
-#define MAX_TITLE_LEN 256
+#define MAX_TITLE_LEN 256  // Longest title that can be typed in; stored titles have no limit
 #define MAX_CATEGORY_LEN 50
 #define MAX_DATE_LEN 12  // Adjusted to fit YYYY-MM-DD format with null terminator
 #define MAX_RECURRENCE_LEN 10
 #define LOCAL_FILE_PATH ".local/share/todo/tasks.txt"
+#define BINARY_FILE_PATH ".local/share/todo/tasks.bin"
+#define JOURNAL_FILE_PATH ".local/share/todo/tasks.journal"
 #define LOG_FILE_PATH ".local/share/todo/todo_app.log"
+#define VIEWS_FILE_PATH ".local/share/todo/views.txt"
 #define NO_DUE_DATE "N/A"  // Custom marker for no due date
+#define NO_DUE_DAY INT_MAX  // Day number stored for tasks without a due date
 
-// Define maximum number of actions for undo functionality
-#define MAX_ACTIONS 100
+// Fields of tasks added from the command line or imported without them
+#define DEFAULT_CATEGORY "general"
+#define DEFAULT_PRIORITY 3
 
-// Define action types for undo functionality
+// Fold the journal into the base file once it grows past this many bytes
+#define JOURNAL_COMPACT_SIZE (1024 * 1024)
+
+// Autosave once this many changes are pending, or once no change has come
+// for SAVE_DEBOUNCE_MS
+#define ACTIONS_BEFORE_AUTOSAVE 5
+#define SAVE_DEBOUNCE_MS 2000
+
+// Longest the main loop sleeps before re-checking due statuses
+#define DUE_STATUS_MAX_WAIT_MS (10 * 60 * 1000)
+
+// Default for the most memory the undo history takes before its oldest steps
+// are dropped; TODO_UNDO_HISTORY_MB overrides it
+#define UNDO_HISTORY_SIZE (16 * 1024 * 1024)
+
+// Kinds of change, for the undo history and the journal
 typedef enum {
     ACTION_ADD,
     ACTION_DELETE,
@@ -44,52 +66,375 @@ typedef enum {
 
 extern const char *recurrence_strings[];
 
-// Task structure definition
+// Cached due status of a task, see refresh_due_status
+enum {
+    DUE_STATUS_NONE,
+    DUE_STATUS_SOON,
+    DUE_STATUS_OVERDUE
+};
+
+// Task structure definition. The task table holds whole rows of 32 bytes
+// rather than one array per field: the hot fields used by sorting, filtering
+// and status checks are packed at the front, so a scan still reads a few
+// bytes per task, and code that copies or passes a task keeps handling one
+// value. The title is the only text, kept in the text store (text.c) and
+// never modified in place; the category is an interned uint32_t ID, not a
+// string (see category_name).
 typedef struct {
-    int id;
-    char title[MAX_TITLE_LEN];
-    char category[MAX_CATEGORY_LEN];
-    char due_date[MAX_DATE_LEN];
-    RecurrenceType recurrence;
-    int priority;
-    int completed;
+    int id;               // Stable ID, see slots.c
+    int due_day;          // Days since 1970-01-01, or NO_DUE_DAY
+    uint8_t priority;
+    uint8_t completed;
+    uint8_t recurrence;   // RecurrenceType
+    uint8_t due_status;   // Cached DUE_STATUS_* for the current day
+    uint32_t category;
+    const char *title;
 } Task;
 
-// Action structure for undo functionality
+// remove_task leaves a tombstone in the task table until compact_tasks: the
+// task keeps its ID and loses its title
+#define TASK_IS_DELETED(task) ((task)->title == NULL)
+
+// Compact the task table once this many tombstones have built up, and they
+// make up a quarter of it
+#define COMPACT_MIN_DELETED 1024
+
+// The task table: rows in refcounted chunks shared copy-on-write with
+// snapshots, see table.c
+#define TASK_CHUNK_SHIFT 12
+#define TASK_CHUNK_SIZE (1 << TASK_CHUNK_SHIFT)
+
+typedef struct {
+    int refs;       // Chunk lists holding this chunk
+    Task tasks[TASK_CHUNK_SIZE];
+} TaskChunk;
+
+typedef struct {
+    int refs;       // Tables holding this list
+    int length;     // Chunks in use
+    int capacity;
+    TaskChunk *chunks[];
+} TaskChunkList;
+
+typedef struct {
+    TaskChunkList *list;  // NULL until the first task is added
+    int count;            // Rows, including tombstones
+} TaskTable;
+
+// Read-only access to the row at `position`; use task_for_write to change it
+#define TASK_AT(table, position) \
+    ((const Task *)&(table)->list->chunks[(position) >> TASK_CHUNK_SHIFT]->tasks[(position) & (TASK_CHUNK_SIZE - 1)])
+
+// Orders the task list can be shown in, see sort.c
+typedef enum {
+    SORT_NONE,
+    SORT_PRIORITY_ASC,   // Priority 1 first
+    SORT_PRIORITY_DESC,  // Priority 5 first
+    SORT_DUE_CLOSEST,    // Closest due date first, tasks without one last
+    SORT_DUE_LATEST,     // Latest due date first, tasks without one last
+    SORT_CUSTOM          // By a SortSpec, see set_sort_spec
+} SortMode;
+
+// Fields a compound sort can use, see keysort.c
+typedef enum {
+    SORT_FIELD_PRIORITY,
+    SORT_FIELD_DUE,
+    SORT_FIELD_TITLE,
+    SORT_FIELD_CATEGORY,
+    SORT_FIELD_COMPLETED
+} SortField;
+
+#define MAX_SORT_KEYS 8
+
 typedef struct {
-    ActionType type;
-    Task task;
-    int index;  // Position of the task in the list
-} Action;
+    int count;
+    struct {
+        SortField field;
+        bool descending;
+    } keys[MAX_SORT_KEYS];
+} SortSpec;
 
 // Function prototypes
-void add_task(Task **tasks, int *count, int *capacity, const char *title, const char *category, const char *due_date, RecurrenceType recurrence, int priority);
-void remove_task(Task **tasks, int *count, int index);
+int add_task(TaskTable *tasks, const char *title, const char *category, int due_day, RecurrenceType recurrence, int priority);
+void remove_task(TaskTable *tasks, int position);
+int restore_task(TaskTable *tasks, const Task *task);
+void task_added(int position, const Task *task);
+void task_changed(int position, const Task *task);
+void compact_tasks(TaskTable *tasks, bool force);
 void edit_task(Task *task);
-void load_tasks(Task **tasks, int *count, int *capacity);
-void save_tasks(Task *tasks, int count);
-void display_tasks(Task *tasks, int count, int selected);
-void search_task(Task *tasks, int count, int *selected_task);
-void sort_tasks(Task *tasks, int count, char sort_type, bool ascending);
+void load_tasks(TaskTable *tasks);
+int save_tasks(const TaskTable *tasks);
+int write_task_line(FILE *file, const Task *task);
+void display_tasks(TaskTable *tasks, int selected);
+int task_list_height();
+void search_task(const TaskTable *tasks, int *selected_task);
+void step_search_match(const TaskTable *tasks, int *selected_task, int direction);
+void filter_tasks(TaskTable *tasks, int *selected_task);
+void view_tasks_where(TaskTable *tasks, int *selected_task);
+void view_agenda(TaskTable *tasks, int *selected_task);
+void sort_tasks(const TaskTable *tasks, char sort_type, bool ascending);
+void sort_tasks_by_spec(const TaskTable *tasks);
 void get_input(char *buffer, int size, const char *prompt);
 void get_input_and_clear(char *buffer, int size, const char *prompt);
 void init_ncurses();
 void cleanup_ncurses();
 void toggle_task_completion(Task *task);
+void flip_task_completion(Task *task);
 void update_task_recurrence(Task *task);
-int is_task_overdue(Task task);
-int is_task_due_soon(Task task);
-int parse_date(const char *date_str, struct tm *date);
-void format_date(char *buffer, size_t size, struct tm *date);
+int is_task_overdue(const Task *task);
+int is_task_due_soon(const Task *task);
+void update_due_status(Task *task);
+void invalidate_due_status();
+bool refresh_due_status(TaskTable *tasks);
+int due_status_timeout();
+int parse_date(const char *date_str, int *day_number);
+int parse_date_n(const char *text, size_t length, int *day_number);
+void format_date(char *buffer, size_t size, int day_number);
+int days_from_civil(int year, int month, int day);
+void civil_from_days(int days, int *year, int *month, int *day);
+int today_day();
 RecurrenceType parse_recurrence(const char *str);
+RecurrenceType parse_recurrence_n(const char *text, size_t length);
+int parse_recurrence_name(const char *text, size_t length, RecurrenceType *recurrence);
 void show_help();
-void ensure_capacity(Task **tasks, int *capacity, int needed);
-void undo_last_action(Task **tasks, int *count, int *capacity);
-void log_message(const char *message);
-void trigger_save_tasks(Task *tasks, int count, bool synchronous);
-void *save_tasks_async(void *arg);
+void undo_last_action(TaskTable *tasks);
+void redo_last_action(TaskTable *tasks);
 void handle_error(const char *message);
-void update_task_ids(Task *tasks, int count);
 char *get_database_path();
 
+// Binary task store (store.c)
+char *get_binary_path();
+bool is_binary_store_active();
+int load_tasks_binary(const char *path, TaskTable *tasks);
+int save_tasks_binary(const char *path, const TaskTable *tasks);
+int convert_task_store(const char *format);
+uint64_t checksum64(const void *data, size_t size);
+
+// Task file parser (tsv.c)
+int load_tasks_text(const char *path, TaskTable *tasks);
+
+// Task table (table.c)
+Task *task_for_write(TaskTable *table, int position);
+Task *append_task(TaskTable *table);
+void reserve_tasks(TaskTable *table, int count);
+void append_tasks(TaskTable *table, const Task *rows, int count);
+void truncate_tasks(TaskTable *table, int count);
+TaskTable snapshot_tasks(const TaskTable *table);
+void release_tasks(TaskTable *table);
+
+// Command-line mode (cli.c)
+int run_command(int argc, char **argv, const char *program);
+void print_usage(FILE *file, const char *program);
+
+// Bulk import and export (exchange.c)
+typedef enum {
+    EXCHANGE_CSV,
+    EXCHANGE_JSONL,
+    EXCHANGE_ICAL
+} ExchangeFormat;
+
+int parse_exchange_format(const char *name, ExchangeFormat *format);
+int export_tasks(const TaskTable *tasks, ExchangeFormat format, FILE *out);
+int import_tasks(TaskTable *tasks, ExchangeFormat format, FILE *in, char *error, size_t error_size);
+
+// Asynchronous log (log.c)
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR
+} LogLevel;
+
+void log_at(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_message(const char *message);
+
+// Background saves (saver.c)
+typedef struct {
+    long long requested;   // Changes reported with request_save
+    long long performed;   // Journal appends and full saves written
+    long long full_saves;  // Of those, full saves
+    long long failed;      // Writes that did not succeed
+    double write_ms;       // Time spent writing, in milliseconds
+} SaveStats;
+
+void request_save();
+int save_now();
+void get_save_stats(SaveStats *stats);
+
+// Row-diffing renderer (render.c)
+void render_cleanup();
+void render_invalidate();
+void render_begin();
+void render_row(int row, attr_t attr, const char *format, ...);
+void render_end();
+const char *render_stats();
+
+// Task text store (text.c)
+const char *store_text(const char *text);
+const char *store_text_n(const char *text, size_t length);
+void store_text_mapping(void *addr, size_t size);
+uint32_t intern_category(const char *name);
+uint32_t intern_category_n(const char *name, size_t length);
+const char *category_name(uint32_t id);
+uint32_t category_count();
+void free_text_store();
+
+// Write-ahead journal (journal.c)
+void journal_record(ActionType type, int id, const Task *task);
+void journal_request_compaction();
+bool journal_needs_compaction();
+int journal_flush(bool *appended);
+void journal_reset();
+void journal_begin_compaction();
+void journal_finish_compaction(bool saved);
+void journal_wait_for_compaction();
+void journal_replay(TaskTable *tasks);
+
+// Trigram search index (search.c)
+void search_index_build(const TaskTable *tasks);
+bool search_index_ready();
+void search_index_insert(const Task *task);
+void search_index_remove(const Task *task);
+void search_index_update(const Task *task);
+int search_index_query(const char *query);
+int search_match(int step);
+void search_clear();
+const char *search_status();
+void search_filter_begin(int count, uint32_t *order);
+int search_filter_push(const TaskTable *tasks, char c);
+int search_filter_pop();
+const char *search_filter_text();
+const uint32_t *search_filter_view(int *count);
+void search_filter_end();
+void search_index_free();
+
+// Sort indexes (sort.c)
+void sort_index_build(const TaskTable *tasks);
+void sort_index_insert(int position, const Task *task);
+void sort_index_remove(int position, const Task *task);
+void sort_index_update(int position, const Task *task);
+void sort_index_compacted();
+void set_sort_mode(const TaskTable *tasks, SortMode mode);
+SortMode get_sort_mode();
+int sort_view_position(const TaskTable *tasks, int row);
+int sort_view_row(const TaskTable *tasks, int position);
+int sort_view_count(const TaskTable *tasks);
+uint32_t *sort_view_order(const TaskTable *tasks);
+void set_sort_spec(const SortSpec *spec);
+void sort_index_free();
+
+// Bitmap indexes (bitmap.c)
+typedef struct {
+    uint16_t key;        // High 16 bits of the values held
+    bool dense;          // A bitmap of words rather than an array of values
+    uint32_t count;      // Values held
+    uint32_t capacity;   // Room in the array
+    union {
+        uint16_t *values;  // Sorted low 16 bits
+        uint64_t *words;
+    };
+} BitmapContainer;
+
+typedef struct {
+    BitmapContainer *containers;  // Sorted by key
+    uint32_t length;
+    uint32_t capacity;
+} Bitmap;
+
+typedef enum {
+    BITMAP_ALL,
+    BITMAP_CATEGORY,
+    BITMAP_PRIORITY,
+    BITMAP_COMPLETED,
+    BITMAP_RECURRENCE
+} BitmapField;
+
+void bitmap_add(Bitmap *bitmap, uint32_t value);
+void bitmap_remove(Bitmap *bitmap, uint32_t value);
+bool bitmap_contains(const Bitmap *bitmap, uint32_t value);
+uint32_t bitmap_count(const Bitmap *bitmap);
+uint32_t bitmap_values(const Bitmap *bitmap, uint32_t *values);
+void bitmap_and(Bitmap *result, const Bitmap *a, const Bitmap *b);
+void bitmap_or(Bitmap *result, const Bitmap *a, const Bitmap *b);
+void bitmap_andnot(Bitmap *result, const Bitmap *a, const Bitmap *b);
+void bitmap_copy(Bitmap *result, const Bitmap *a);
+void bitmap_free(Bitmap *bitmap);
+void bitmap_index_build(const TaskTable *tasks);
+bool bitmap_index_ready();
+void bitmap_index_insert(const Task *task);
+void bitmap_index_remove(const Task *task);
+void bitmap_index_update(const Task *task);
+const Bitmap *bitmap_index_lookup(BitmapField field, uint32_t value);
+void bitmap_index_free();
+
+// Multi-select (select.c)
+bool is_task_selected(const Task *task);
+void select_task(const Task *task, bool on);
+void select_toggle(const Task *task);
+int select_count();
+void select_clear();
+void select_visual_start(int row);
+bool select_visual_active();
+bool select_visual_covers(int row, int cursor);
+void select_visual_end(const TaskTable *tasks, int cursor);
+int select_where(const TaskTable *tasks, const char *text, char *error, size_t error_size);
+int batch_complete(TaskTable *tasks);
+int batch_delete(TaskTable *tasks);
+int batch_edit(TaskTable *tasks, int priority, const char *category);
+const char *select_status(int cursor);
+void select_free();
+
+// Due-date index (agenda.c)
+typedef struct {
+    int day;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;   // Slots of the tasks due that day, in no order
+} DueBucket;
+
+void due_index_build(const TaskTable *tasks);
+bool due_index_ready();
+void due_index_insert(const Task *task);
+void due_index_remove(const Task *task);
+void due_index_update(const Task *task);
+const DueBucket *due_index_range(int first_day, int last_day, int *count);
+void due_index_free();
+int agenda_tasks(const TaskTable *tasks, int first_day, int last_day, uint32_t **positions);
+int agenda_span(const char *span, int day, int *first_day, int *last_day);
+
+// Query language (query.c)
+typedef struct Query Query;
+Query *compile_query(const char *text, char *error, size_t error_size);
+int run_query(const TaskTable *tasks, const Query *query, uint32_t **positions);
+void free_query(Query *query);
+int tasks_where(const TaskTable *tasks, const char *text, uint32_t **positions, char *error, size_t error_size);
+int save_view(const char *name, const char *query, char *error, size_t error_size);
+int delete_view(const char *name);
+int list_views(FILE *out);
+
+// Undo history (undo.c)
+void undo_record(ActionType type, const Task *before, const Task *after);
+void undo_begin_group();
+void undo_end_group();
+int undo_step(TaskTable *tasks);
+int redo_step(TaskTable *tasks);
+int *undo_restorable_ids(int *count);
+void undo_history_free();
+
+// Stable task IDs (slots.c)
+int new_task_id(int position);
+int claim_task_id(int id, int position);
+int task_position(int id);
+int task_slot_position(uint32_t slot);
+uint32_t task_id_slot(int id);
+uint32_t task_slot_count();
+void move_task_id(int id, int position);
+void release_task_id(int id);
+void assign_task_ids(TaskTable *tasks);
+void free_task_ids();
+
+// Compound sorts (keysort.c)
+int parse_sort_spec(const char *text, SortSpec *spec);
+int sort_positions(const TaskTable *tasks, const SortSpec *spec, uint32_t *order);
+
 #endif
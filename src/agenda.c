@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Due-date index.
+//
+// Tasks with a due date are bucketed by day: `days` is an array of buckets
+// sorted by day number, one for each day some task is due on, each holding
+// the slots (see slots.c) of the tasks due that day. A range of days is two
+// binary searches away, so "what is due this week" costs O(log n + k) for k
+// tasks due in it, without looking at any other task or date.
+//
+// Each slot remembers the day it was filed under and where in that bucket it
+// sits, so moving a task to another day is a swap-remove from one bucket and
+// an append to another. A bucket left empty, as when a daily task moves on,
+// is dropped. Like the other indexes it is built on first use and then kept
+// up to date by every change to a task: adds, edits, completions that move a
+// recurring task to its next date, deletes, undo and redo.
+
+typedef struct {
+    int day;           // Day filed under, or NO_DUE_DAY when not filed
+    uint32_t index;    // Place in that day's bucket
+} IndexedDue;
+
+static DueBucket *days = NULL;
+static int day_count = 0;
+static int day_capacity = 0;
+
+static IndexedDue *filed = NULL;  // Where each slot is filed
+static uint32_t filed_capacity = 0;
+
+static bool index_built = false;
+
+static void *due_alloc(void *memory, size_t size) {
+    void *temp = realloc(memory, size);
+    if (temp == NULL) {
+        handle_error("Error allocating memory for the due-date index.");
+        exit(1);
+    }
+    return temp;
+}
+
+// First bucket on or after `day`
+static int lower_bound(int day) {
+    int low = 0, high = day_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (days[middle].day < day) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static IndexedDue *slot_due(uint32_t slot) {
+    if (slot >= filed_capacity) {
+        uint32_t capacity = filed_capacity ? filed_capacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        filed = due_alloc(filed, capacity * sizeof(IndexedDue));
+        for (uint32_t i = filed_capacity; i < capacity; i++) {
+            filed[i].day = NO_DUE_DAY;
+        }
+        filed_capacity = capacity;
+    }
+    return &filed[slot];
+}
+
+static void file_slot(uint32_t slot, int day) {
+    int bucket = lower_bound(day);
+    if (bucket == day_count || days[bucket].day != day) {
+        if (day_count == day_capacity) {
+            day_capacity = day_capacity ? day_capacity * 2 : 64;
+            days = due_alloc(days, day_capacity * sizeof(DueBucket));
+        }
+        memmove(&days[bucket + 1], &days[bucket], (day_count - bucket) * sizeof(DueBucket));
+        memset(&days[bucket], 0, sizeof(DueBucket));
+        days[bucket].day = day;
+        day_count++;
+    }
+
+    DueBucket *due = &days[bucket];
+    if (due->count == due->capacity) {
+        due->capacity = due->capacity ? due->capacity * 2 : 4;
+        due->slots = due_alloc(due->slots, due->capacity * sizeof(uint32_t));
+    }
+    IndexedDue *indexed = slot_due(slot);
+    indexed->day = day;
+    indexed->index = due->count;
+    due->slots[due->count++] = slot;
+}
+
+static void unfile_slot(uint32_t slot) {
+    IndexedDue *indexed = &filed[slot];
+    int bucket = lower_bound(indexed->day);
+    DueBucket *due = &days[bucket];
+
+    // The last slot of the bucket takes its place
+    uint32_t moved = due->slots[--due->count];
+    due->slots[indexed->index] = moved;
+    filed[moved].index = indexed->index;
+    indexed->day = NO_DUE_DAY;
+
+    if (due->count == 0) {
+        free(due->slots);
+        memmove(&days[bucket], &days[bucket + 1], (day_count - bucket - 1) * sizeof(DueBucket));
+        day_count--;
+    }
+}
+
+static bool is_filed(uint32_t slot) {
+    return slot < filed_capacity && filed[slot].day != NO_DUE_DAY;
+}
+
+// Index every task from scratch. Until this is first called the other
+// updates are ignored, so the index costs nothing unless it is queried.
+void due_index_build(const TaskTable *tasks) {
+    due_index_free();
+    for (int i = 0; i < tasks->count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (!TASK_IS_DELETED(task) && task->due_day != NO_DUE_DAY) {
+            file_slot(task_id_slot(task->id), task->due_day);
+        }
+    }
+    index_built = true;
+}
+
+bool due_index_ready() {
+    return index_built;
+}
+
+void due_index_insert(const Task *task) {
+    if (!index_built) {
+        return;
+    }
+    uint32_t slot = task_id_slot(task->id);
+    if (is_filed(slot)) {
+        unfile_slot(slot);
+    }
+    if (task->due_day != NO_DUE_DAY) {
+        file_slot(slot, task->due_day);
+    }
+}
+
+void due_index_remove(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    if (index_built && is_filed(slot)) {
+        unfile_slot(slot);
+    }
+}
+
+// A task's due date may have changed; nothing moves if it has not
+void due_index_update(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    if (!index_built || (is_filed(slot) ? filed[slot].day : NO_DUE_DAY) == task->due_day) {
+        return;
+    }
+    due_index_insert(task);
+}
+
+// Buckets of the days from `first_day` to `last_day`, both included, in day
+// order; only days some task is due on have one. Returns the first of
+// `*count` buckets, valid until the tasks next change.
+const DueBucket *due_index_range(int first_day, int last_day, int *count) {
+    int first = lower_bound(first_day);
+    int end = last_day == INT_MAX ? day_count : lower_bound(last_day + 1);
+    *count = end > first ? end - first : 0;
+    return days + first;
+}
+
+void due_index_free() {
+    for (int i = 0; i < day_count; i++) {
+        free(days[i].slots);
+    }
+    free(days);
+    free(filed);
+    days = NULL;
+    filed = NULL;
+    day_count = day_capacity = 0;
+    filed_capacity = 0;
+    index_built = false;
+}
+
+// Agenda
+
+static const TaskTable *agenda_table;
+
+// Within a day, the most important tasks first: priority 5 down to 1, as
+// SORT_PRIORITY_DESC shows them
+static int compare_agenda(const void *a, const void *b) {
+    const Task *x = TASK_AT(agenda_table, *(const uint32_t *)a);
+    const Task *y = TASK_AT(agenda_table, *(const uint32_t *)b);
+    if (x->priority != y->priority) {
+        return (y->priority > x->priority) - (y->priority < x->priority);
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// Positions of the tasks due from `first_day` to `last_day`, by day and then
+// priority. Returns their number; the array is the caller's to free.
+int agenda_tasks(const TaskTable *tasks, int first_day, int last_day, uint32_t **positions) {
+    if (!index_built) {
+        due_index_build(tasks);
+    }
+    int buckets;
+    const DueBucket *due = due_index_range(first_day, last_day, &buckets);
+    uint32_t total = 0;
+    for (int i = 0; i < buckets; i++) {
+        total += due[i].count;
+    }
+    *positions = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+    if (*positions == NULL) {
+        handle_error("Error allocating memory for the agenda.");
+        exit(1);
+    }
+
+    agenda_table = tasks;
+    int count = 0;
+    for (int i = 0; i < buckets; i++) {
+        int start = count;
+        for (uint32_t j = 0; j < due[i].count; j++) {
+            int position = task_slot_position(due[i].slots[j]);
+            if (position >= 0) {
+                (*positions)[count++] = position;
+            }
+        }
+        qsort(*positions + start, count - start, sizeof(uint32_t), compare_agenda);
+    }
+    return count;
+}
+
+// The days of `span` ("today", "week" or "month") that include `day`, the
+// week starting on Monday. Returns 0 for an unknown span.
+int agenda_span(const char *span, int day, int *first_day, int *last_day) {
+    int year, month, day_of_month;
+    if (strcmp(span, "today") == 0 || strcmp(span, "day") == 0) {
+        *first_day = *last_day = day;
+    } else if (strcmp(span, "week") == 0) {
+        // Day 0, 1970-01-01, was a Thursday
+        int weekday = ((day + 3) % 7 + 7) % 7;
+        *first_day = day - weekday;
+        *last_day = *first_day + 6;
+    } else if (strcmp(span, "month") == 0) {
+        civil_from_days(day, &year, &month, &day_of_month);
+        *first_day = days_from_civil(year, month, 1);
+        *last_day = days_from_civil(year + month / 12, month % 12 + 1, 1) - 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Bitmap indexes.
+//
+// A Bitmap is a compressed set of 32-bit values in the style of Roaring
+// bitmaps. Values are grouped by their high 16 bits into containers, kept
+// sorted by that key. A container with few values holds their low 16 bits as
+// a sorted array; once it holds more than ARRAY_MAX it becomes a plain
+// 65536-bit bitmap, which is then the smaller of the two. Sparse sets cost
+// two bytes a value and dense ones an eighth of a byte, and AND, OR and
+// AND NOT run container by container: merging arrays, probing bits for an
+// array against a bitmap, and combining two bitmaps a vector of words at a
+// time.
+//
+// The field indexes keep one Bitmap of task slots (see slots.c) for each
+// category, priority, completion state and recurrence, plus one of every
+// live task. Slots stay the same while a task lives, so compacting the task
+// table changes nothing here. Like the sort and search indexes they are built
+// on first use and then kept up to date by every change to a task; the last
+// indexed fields of each slot are kept, so an update only moves the bits of
+// the fields that changed.
+
+#define CONTAINER_BITS 65536
+#define CONTAINER_WORDS (CONTAINER_BITS / 64)
+#define ARRAY_MAX 4096
+
+// Four words handled as one value; GCC and Clang lower the operations on it
+// to SSE2, AVX2 or NEON instructions, or to plain integer code elsewhere
+typedef uint64_t WordVector __attribute__((vector_size(32)));
+#define VECTOR_WORDS (sizeof(WordVector) / sizeof(uint64_t))
+
+static void *bitmap_alloc(void *memory, size_t size) {
+    void *temp = realloc(memory, size);
+    if (temp == NULL) {
+        handle_error("Error allocating memory for a bitmap.");
+        exit(1);
+    }
+    return temp;
+}
+
+static uint64_t *alloc_words() {
+    uint64_t *words = aligned_alloc(sizeof(WordVector), CONTAINER_WORDS * sizeof(uint64_t));
+    if (words == NULL) {
+        handle_error("Error allocating memory for a bitmap.");
+        exit(1);
+    }
+    return words;
+}
+
+static void free_container(BitmapContainer *container) {
+    if (container->dense) {
+        free(container->words);
+    } else {
+        free(container->values);
+    }
+}
+
+// Index of the container for `key`, or where it would go, negated, minus one
+static int find_container(const Bitmap *bitmap, uint16_t key) {
+    int low = 0, high = (int)bitmap->length - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        uint16_t found = bitmap->containers[middle].key;
+        if (found == key) {
+            return middle;
+        }
+        if (found < key) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -low - 1;
+}
+
+// A new, empty container for `key` at `index`
+static BitmapContainer *insert_container(Bitmap *bitmap, int index, uint16_t key) {
+    if (bitmap->length == bitmap->capacity) {
+        bitmap->capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+        bitmap->containers = bitmap_alloc(bitmap->containers, bitmap->capacity * sizeof(BitmapContainer));
+    }
+    memmove(&bitmap->containers[index + 1], &bitmap->containers[index],
+            (bitmap->length - index) * sizeof(BitmapContainer));
+    bitmap->length++;
+    BitmapContainer *container = &bitmap->containers[index];
+    memset(container, 0, sizeof(*container));
+    container->key = key;
+    return container;
+}
+
+static void erase_container(Bitmap *bitmap, int index) {
+    free_container(&bitmap->containers[index]);
+    bitmap->length--;
+    memmove(&bitmap->containers[index], &bitmap->containers[index + 1],
+            (bitmap->length - index) * sizeof(BitmapContainer));
+}
+
+// Position of `value` in a sorted array, or where it would go, as
+// find_container
+static int find_value(const uint16_t *values, uint32_t count, uint16_t value) {
+    int low = 0, high = (int)count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        if (values[middle] == value) {
+            return middle;
+        }
+        if (values[middle] < value) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -low - 1;
+}
+
+static void make_dense(BitmapContainer *container) {
+    uint64_t *words = alloc_words();
+    memset(words, 0, CONTAINER_WORDS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < container->count; i++) {
+        words[container->values[i] / 64] |= 1ull << (container->values[i] % 64);
+    }
+    free(container->values);
+    container->words = words;
+    container->dense = true;
+    container->capacity = 0;
+}
+
+static void make_sparse(BitmapContainer *container) {
+    uint16_t *values = bitmap_alloc(NULL, (container->count > 0 ? container->count : 1) * sizeof(uint16_t));
+    uint32_t count = 0;
+    for (uint32_t word = 0; word < CONTAINER_WORDS; word++) {
+        for (uint64_t w = container->words[word]; w != 0; w &= w - 1) {
+            values[count++] = word * 64 + __builtin_ctzll(w);
+        }
+    }
+    free(container->words);
+    container->values = values;
+    container->dense = false;
+    container->capacity = container->count;
+}
+
+void bitmap_add(Bitmap *bitmap, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    int index = find_container(bitmap, key);
+    BitmapContainer *container = index >= 0 ? &bitmap->containers[index] : insert_container(bitmap, -index - 1, key);
+
+    if (container->dense) {
+        uint64_t bit = 1ull << (low % 64);
+        if (!(container->words[low / 64] & bit)) {
+            container->words[low / 64] |= bit;
+            container->count++;
+        }
+        return;
+    }
+    int at = find_value(container->values, container->count, low);
+    if (at >= 0) {
+        return;
+    }
+    if (container->count == ARRAY_MAX) {
+        make_dense(container);
+        bitmap_add(bitmap, value);
+        return;
+    }
+    at = -at - 1;
+    if (container->count == container->capacity) {
+        container->capacity = container->capacity ? container->capacity * 2 : 4;
+        container->values = bitmap_alloc(container->values, container->capacity * sizeof(uint16_t));
+    }
+    memmove(&container->values[at + 1], &container->values[at], (container->count - at) * sizeof(uint16_t));
+    container->values[at] = low;
+    container->count++;
+}
+
+void bitmap_remove(Bitmap *bitmap, uint32_t value) {
+    uint16_t key = value >> 16, low = value & 0xffff;
+    int index = find_container(bitmap, key);
+    if (index < 0) {
+        return;
+    }
+    BitmapContainer *container = &bitmap->containers[index];
+    if (container->dense) {
+        uint64_t bit = 1ull << (low % 64);
+        if (!(container->words[low / 64] & bit)) {
+            return;
+        }
+        container->words[low / 64] &= ~bit;
+        container->count--;
+        // Well below the limit, so a set hovering around it does not flip back and forth
+        if (container->count <= ARRAY_MAX / 2) {
+            make_sparse(container);
+        }
+    } else {
+        int at = find_value(container->values, container->count, low);
+        if (at < 0) {
+            return;
+        }
+        container->count--;
+        memmove(&container->values[at], &container->values[at + 1], (container->count - at) * sizeof(uint16_t));
+    }
+    if (container->count == 0) {
+        erase_container(bitmap, index);
+    }
+}
+
+bool bitmap_contains(const Bitmap *bitmap, uint32_t value) {
+    int index = find_container(bitmap, value >> 16);
+    if (index < 0) {
+        return false;
+    }
+    const BitmapContainer *container = &bitmap->containers[index];
+    uint16_t low = value & 0xffff;
+    if (container->dense) {
+        return container->words[low / 64] >> (low % 64) & 1;
+    }
+    return find_value(container->values, container->count, low) >= 0;
+}
+
+uint32_t bitmap_count(const Bitmap *bitmap) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < bitmap->length; i++) {
+        count += bitmap->containers[i].count;
+    }
+    return count;
+}
+
+// Write the values in increasing order to `values`, which has room for
+// bitmap_count of them; returns how many there are
+uint32_t bitmap_values(const Bitmap *bitmap, uint32_t *values) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < bitmap->length; i++) {
+        const BitmapContainer *container = &bitmap->containers[i];
+        uint32_t high = (uint32_t)container->key << 16;
+        if (container->dense) {
+            for (uint32_t word = 0; word < CONTAINER_WORDS; word++) {
+                for (uint64_t w = container->words[word]; w != 0; w &= w - 1) {
+                    values[count++] = high | (word * 64 + __builtin_ctzll(w));
+                }
+            }
+        } else {
+            for (uint32_t j = 0; j < container->count; j++) {
+                values[count++] = high | container->values[j];
+            }
+        }
+    }
+    return count;
+}
+
+void bitmap_free(Bitmap *bitmap) {
+    for (uint32_t i = 0; i < bitmap->length; i++) {
+        free_container(&bitmap->containers[i]);
+    }
+    free(bitmap->containers);
+    memset(bitmap, 0, sizeof(*bitmap));
+}
+
+// Set operations. Each works out one result container from a container of
+// each side (either may be missing), and the result takes it if not empty.
+
+typedef enum {
+    OP_AND,
+    OP_OR,
+    OP_ANDNOT
+} SetOp;
+
+static void copy_container(BitmapContainer *to, const BitmapContainer *from) {
+    *to = *from;
+    if (from->dense) {
+        to->words = alloc_words();
+        memcpy(to->words, from->words, CONTAINER_WORDS * sizeof(uint64_t));
+    } else {
+        to->values = bitmap_alloc(NULL, (from->count > 0 ? from->count : 1) * sizeof(uint16_t));
+        memcpy(to->values, from->values, from->count * sizeof(uint16_t));
+        to->capacity = from->count;
+    }
+}
+
+static uint32_t count_words(const uint64_t *words) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < CONTAINER_WORDS; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+// Two bitmap containers, a vector of words at a time
+static void combine_dense(BitmapContainer *out, const BitmapContainer *a, const BitmapContainer *b, SetOp op) {
+    out->words = alloc_words();
+    out->dense = true;
+    const WordVector *x = (const WordVector *)a->words;
+    const WordVector *y = (const WordVector *)b->words;
+    WordVector *z = (WordVector *)out->words;
+    for (uint32_t i = 0; i < CONTAINER_WORDS / VECTOR_WORDS; i++) {
+        z[i] = op == OP_AND ? x[i] & y[i] : op == OP_OR ? x[i] | y[i] : x[i] & ~y[i];
+    }
+    out->count = count_words(out->words);
+    if (out->count <= ARRAY_MAX / 2) {
+        make_sparse(out);
+    }
+}
+
+// Two array containers, merged
+static void combine_sparse(BitmapContainer *out, const BitmapContainer *a, const BitmapContainer *b, SetOp op) {
+    uint32_t room = op == OP_OR ? a->count + b->count : a->count;
+    out->values = bitmap_alloc(NULL, (room > 0 ? room : 1) * sizeof(uint16_t));
+    out->capacity = room;
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < a->count && j < b->count) {
+        uint16_t x = a->values[i], y = b->values[j];
+        if (x == y) {
+            if (op != OP_ANDNOT) {
+                out->values[n++] = x;
+            }
+            i++;
+            j++;
+        } else if (x < y) {
+            if (op != OP_AND) {
+                out->values[n++] = x;
+            }
+            i++;
+        } else {
+            if (op == OP_OR) {
+                out->values[n++] = y;
+            }
+            j++;
+        }
+    }
+    if (op != OP_AND) {
+        while (i < a->count) {
+            out->values[n++] = a->values[i++];
+        }
+    }
+    if (op == OP_OR) {
+        while (j < b->count) {
+            out->values[n++] = b->values[j++];
+        }
+    }
+    out->count = n;
+    if (n > ARRAY_MAX) {
+        make_dense(out);
+    }
+}
+
+// One container of each kind; `array_first` when the array is the left side
+static void combine_mixed(BitmapContainer *out, const BitmapContainer *array, const BitmapContainer *dense,
+                          bool array_first, SetOp op) {
+    if (op == OP_AND || (op == OP_ANDNOT && array_first)) {
+        // Keep the array values whose bit is set (AND) or clear (array AND NOT bitmap)
+        bool keep = op == OP_AND;
+        out->values = bitmap_alloc(NULL, (array->count > 0 ? array->count : 1) * sizeof(uint16_t));
+        out->capacity = array->count;
+        for (uint32_t i = 0; i < array->count; i++) {
+            uint16_t value = array->values[i];
+            if ((dense->words[value / 64] >> (value % 64) & 1) == keep) {
+                out->values[out->count++] = value;
+            }
+        }
+        return;
+    }
+    // OR, or bitmap AND NOT array: copy the bitmap and set or clear the bits
+    copy_container(out, dense);
+    for (uint32_t i = 0; i < array->count; i++) {
+        uint16_t value = array->values[i];
+        uint64_t bit = 1ull << (value % 64);
+        bool set = (out->words[value / 64] & bit) != 0;
+        if (op == OP_OR && !set) {
+            out->words[value / 64] |= bit;
+            out->count++;
+        } else if (op == OP_ANDNOT && set) {
+            out->words[value / 64] &= ~bit;
+            out->count--;
+        }
+    }
+    if (out->count <= ARRAY_MAX / 2) {
+        make_sparse(out);
+    }
+}
+
+static void combine(Bitmap *result, const Bitmap *a, const Bitmap *b, SetOp op) {
+    bitmap_free(result);
+    uint32_t i = 0, j = 0;
+    while (i < a->length || j < b->length) {
+        const BitmapContainer *x = i < a->length ? &a->containers[i] : NULL;
+        const BitmapContainer *y = j < b->length ? &b->containers[j] : NULL;
+        if (y == NULL || (x != NULL && x->key < y->key)) {
+            // Only on the left
+            if (op != OP_AND) {
+                copy_container(insert_container(result, result->length, x->key), x);
+            }
+            i++;
+            continue;
+        }
+        if (x == NULL || y->key < x->key) {
+            // Only on the right
+            if (op == OP_OR) {
+                copy_container(insert_container(result, result->length, y->key), y);
+            }
+            j++;
+            continue;
+        }
+
+        BitmapContainer *out = insert_container(result, result->length, x->key);
+        if (x->dense && y->dense) {
+            combine_dense(out, x, y, op);
+        } else if (!x->dense && !y->dense) {
+            combine_sparse(out, x, y, op);
+        } else if (!x->dense) {
+            combine_mixed(out, x, y, true, op);
+        } else {
+            combine_mixed(out, y, x, false, op);
+        }
+        if (out->count == 0) {
+            erase_container(result, result->length - 1);
+        }
+        i++;
+        j++;
+    }
+}
+
+// `result` becomes a AND b, a OR b or a AND NOT b. It must not be one of the
+// operands.
+void bitmap_and(Bitmap *result, const Bitmap *a, const Bitmap *b) {
+    combine(result, a, b, OP_AND);
+}
+
+void bitmap_or(Bitmap *result, const Bitmap *a, const Bitmap *b) {
+    combine(result, a, b, OP_OR);
+}
+
+void bitmap_andnot(Bitmap *result, const Bitmap *a, const Bitmap *b) {
+    combine(result, a, b, OP_ANDNOT);
+}
+
+void bitmap_copy(Bitmap *result, const Bitmap *a) {
+    bitmap_free(result);
+    for (uint32_t i = 0; i < a->length; i++) {
+        copy_container(insert_container(result, i, a->containers[i].key), &a->containers[i]);
+    }
+}
+
+// Field indexes
+
+#define INDEXED_PRIORITIES 256
+#define INDEXED_RECURRENCES (RECURRENCE_YEARLY + 1)
+
+typedef struct {
+    uint32_t category;
+    uint8_t priority;
+    uint8_t completed;
+    uint8_t recurrence;
+    bool indexed;
+} IndexedFields;
+
+static Bitmap all_tasks;
+static Bitmap *by_category = NULL;
+static uint32_t category_bitmaps = 0;
+static Bitmap by_priority[INDEXED_PRIORITIES];
+static Bitmap by_completed[2];
+static Bitmap by_recurrence[INDEXED_RECURRENCES];
+static const Bitmap empty_bitmap;
+
+static IndexedFields *fields = NULL;  // Indexed fields of each slot
+static uint32_t field_capacity = 0;
+
+static bool index_built = false;
+
+static IndexedFields fields_of(const Task *task) {
+    IndexedFields indexed = {task->category, task->priority, task->completed != 0,
+                             task->recurrence < INDEXED_RECURRENCES ? task->recurrence : RECURRENCE_NONE, true};
+    return indexed;
+}
+
+static Bitmap *category_bitmap(uint32_t category) {
+    if (category >= category_bitmaps) {
+        uint32_t count = category_bitmaps ? category_bitmaps : 16;
+        while (count <= category) {
+            count *= 2;
+        }
+        by_category = bitmap_alloc(by_category, count * sizeof(Bitmap));
+        memset(by_category + category_bitmaps, 0, (count - category_bitmaps) * sizeof(Bitmap));
+        category_bitmaps = count;
+    }
+    return &by_category[category];
+}
+
+static void index_fields(uint32_t slot, const IndexedFields *indexed, bool add) {
+    void (*change)(Bitmap *, uint32_t) = add ? bitmap_add : bitmap_remove;
+    change(&all_tasks, slot);
+    change(category_bitmap(indexed->category), slot);
+    change(&by_priority[indexed->priority], slot);
+    change(&by_completed[indexed->completed], slot);
+    change(&by_recurrence[indexed->recurrence], slot);
+}
+
+static IndexedFields *slot_fields(uint32_t slot) {
+    if (slot >= field_capacity) {
+        uint32_t capacity = field_capacity ? field_capacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        fields = bitmap_alloc(fields, capacity * sizeof(IndexedFields));
+        memset(fields + field_capacity, 0, (capacity - field_capacity) * sizeof(IndexedFields));
+        field_capacity = capacity;
+    }
+    return &fields[slot];
+}
+
+// Index every task from scratch. Until this is first called the other
+// updates are ignored, so the indexes cost nothing unless they are queried.
+void bitmap_index_build(const TaskTable *tasks) {
+    bitmap_index_free();
+    for (int i = 0; i < tasks->count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (!TASK_IS_DELETED(task)) {
+            uint32_t slot = task_id_slot(task->id);
+            *slot_fields(slot) = fields_of(task);
+            index_fields(slot, &fields[slot], true);
+        }
+    }
+    index_built = true;
+}
+
+bool bitmap_index_ready() {
+    return index_built;
+}
+
+void bitmap_index_insert(const Task *task) {
+    if (!index_built) {
+        return;
+    }
+    uint32_t slot = task_id_slot(task->id);
+    IndexedFields *indexed = slot_fields(slot);
+    if (indexed->indexed) {
+        index_fields(slot, indexed, false);
+    }
+    *indexed = fields_of(task);
+    index_fields(slot, indexed, true);
+}
+
+void bitmap_index_remove(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    if (!index_built || slot >= field_capacity || !fields[slot].indexed) {
+        return;
+    }
+    index_fields(slot, &fields[slot], false);
+    fields[slot].indexed = false;
+}
+
+// A task may have new indexed fields; only the bitmaps of those that changed
+// are touched
+void bitmap_index_update(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    if (!index_built || slot >= field_capacity || !fields[slot].indexed) {
+        return;
+    }
+    IndexedFields *old = &fields[slot];
+    IndexedFields new = fields_of(task);
+    if (old->category != new.category) {
+        bitmap_remove(category_bitmap(old->category), slot);
+        bitmap_add(category_bitmap(new.category), slot);
+    }
+    if (old->priority != new.priority) {
+        bitmap_remove(&by_priority[old->priority], slot);
+        bitmap_add(&by_priority[new.priority], slot);
+    }
+    if (old->completed != new.completed) {
+        bitmap_remove(&by_completed[old->completed], slot);
+        bitmap_add(&by_completed[new.completed], slot);
+    }
+    if (old->recurrence != new.recurrence) {
+        bitmap_remove(&by_recurrence[old->recurrence], slot);
+        bitmap_add(&by_recurrence[new.recurrence], slot);
+    }
+    *old = new;
+}
+
+// Slots of the tasks with `value` in `field`; every live task for
+// BITMAP_ALL. Valid until the tasks next change.
+const Bitmap *bitmap_index_lookup(BitmapField field, uint32_t value) {
+    switch (field) {
+        case BITMAP_ALL:
+            return &all_tasks;
+        case BITMAP_CATEGORY:
+            return value < category_bitmaps ? &by_category[value] : &empty_bitmap;
+        case BITMAP_PRIORITY:
+            return value < INDEXED_PRIORITIES ? &by_priority[value] : &empty_bitmap;
+        case BITMAP_COMPLETED:
+            return &by_completed[value != 0];
+        case BITMAP_RECURRENCE:
+            return value < INDEXED_RECURRENCES ? &by_recurrence[value] : &empty_bitmap;
+    }
+    return &empty_bitmap;
+}
+
+void bitmap_index_free() {
+    bitmap_free(&all_tasks);
+    for (uint32_t i = 0; i < category_bitmaps; i++) {
+        bitmap_free(&by_category[i]);
+    }
+    free(by_category);
+    by_category = NULL;
+    category_bitmaps = 0;
+    for (int i = 0; i < INDEXED_PRIORITIES; i++) {
+        bitmap_free(&by_priority[i]);
+    }
+    bitmap_free(&by_completed[0]);
+    bitmap_free(&by_completed[1]);
+    for (int i = 0; i < INDEXED_RECURRENCES; i++) {
+        bitmap_free(&by_recurrence[i]);
+    }
+    free(fields);
+    fields = NULL;
+    field_capacity = 0;
+    index_built = false;
+}
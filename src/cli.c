@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "todo.h"
+
+// Command-line mode.
+//
+// `todo add|list|query|view|agenda|done|rm|import|export ...` works on the
+// tasks without a terminal, for scripts and cron jobs. ncurses is never
+// started: the tasks are loaded, the command runs and, if it changed
+// anything, the change is saved like an autosave, all from the one thread.
+//
+// `todo batch` reads such commands from stdin, one per line, with words split
+// as the shell would (quotes and backslashes work, and '#' starts a comment).
+// The whole batch is one transaction: every command runs against the tasks
+// loaded once, and only if all of them succeed is anything saved and their
+// output printed. Otherwise the first error is reported and nothing changes.
+//
+// Output is meant for other programs. Tasks are printed as lines of the
+// tasks file (ID, title, category, priority, completion, due date and
+// recurrence, separated by tabs), and `add` prints the ID of the new task.
+
+extern TaskTable tasks;
+
+#define MAX_COMMAND_WORDS 64
+
+typedef struct {
+    FILE *out;        // Held back until every command has succeeded
+    char error[256];
+    bool changed;
+    bool reading_stdin;  // Running commands from stdin
+} Batch;
+
+typedef struct {
+    const char *name;
+    int (*run)(Batch *batch, int argc, char **argv);
+    bool read_only;   // Output can go straight to stdout
+} Command;
+
+static int fail(Batch *batch, const char *format, const char *detail) {
+    snprintf(batch->error, sizeof(batch->error), format, detail);
+    return 0;
+}
+
+// Titles and categories are stored one per line, between tabs
+static int check_text(Batch *batch, const char *what, const char *text) {
+    if (text[0] == '\0') {
+        return fail(batch, "%s cannot be empty", what);
+    }
+    if (strpbrk(text, "\t\r\n") != NULL) {
+        return fail(batch, "%s cannot contain tabs or line breaks", what);
+    }
+    return 1;
+}
+
+// Join `count` words with spaces; the result is freed by the caller
+static char *join_words(char **words, int count) {
+    size_t length = 1;
+    for (int i = 0; i < count; i++) {
+        length += strlen(words[i]) + 1;
+    }
+    char *text = malloc(length);
+    if (text == NULL) {
+        handle_error("Error allocating memory for the command.");
+        exit(1);
+    }
+    text[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            strcat(text, " ");
+        }
+        strcat(text, words[i]);
+    }
+    return text;
+}
+
+// Move the options in argv[1..argc) (those in `options`, each taking a value)
+// to `values` and the other words to the front of argv, over the command
+// name. Returns the number of other words, or -1 after an unknown or
+// incomplete option.
+static int split_options(Batch *batch, int argc, char **argv, const char *options, char **values) {
+    int words = 0;
+    bool options_done = false;
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (options_done || arg[0] != '-' || arg[1] == '\0') {
+            argv[words++] = arg;
+        } else if (strcmp(arg, "--") == 0) {
+            options_done = true;
+        } else if (arg[2] != '\0' || strchr(options, arg[1]) == NULL) {
+            fail(batch, "unknown option '%s'", arg);
+            return -1;
+        } else if (i + 1 == argc) {
+            fail(batch, "option '%s' needs a value", arg);
+            return -1;
+        } else {
+            values[strchr(options, arg[1]) - options] = argv[++i];
+        }
+    }
+    return words;
+}
+
+static int parse_id(Batch *batch, const char *text, int *position) {
+    char *end;
+    errno = 0;
+    long id = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || id < INT_MIN || id > INT_MAX) {
+        return fail(batch, "invalid task ID '%s'", text);
+    }
+    *position = task_position((int)id);
+    if (*position < 0 || TASK_IS_DELETED(TASK_AT(&tasks, *position))) {
+        return fail(batch, "no task with ID %s", text);
+    }
+    return 1;
+}
+
+static int apply_sort(Batch *batch, const char *text) {
+    SortSpec spec;
+    if (text == NULL) {
+        return 1;
+    }
+    if (!parse_sort_spec(text, &spec)) {
+        return fail(batch, "invalid sort order '%s'", text);
+    }
+    set_sort_spec(&spec);
+    return 1;
+}
+
+// add TITLE... [-c CATEGORY] [-d YYYY-MM-DD] [-r RECURRENCE] [-p PRIORITY]
+static int command_add(Batch *batch, int argc, char **argv) {
+    char *values[4] = {DEFAULT_CATEGORY, NULL, NULL, NULL};
+    int words = split_options(batch, argc, argv, "cdrp", values);
+    if (words < 0) {
+        return 0;
+    }
+
+    int due_day = NO_DUE_DAY;
+    RecurrenceType recurrence = RECURRENCE_NONE;
+    int priority = DEFAULT_PRIORITY;
+    if (!check_text(batch, "category", values[0])) {
+        return 0;
+    }
+    if (strlen(values[0]) >= MAX_CATEGORY_LEN) {
+        return fail(batch, "category '%s' is too long", values[0]);
+    }
+    if (values[1] != NULL && strcmp(values[1], NO_DUE_DATE) != 0 && !parse_date(values[1], &due_day)) {
+        return fail(batch, "invalid due date '%s' (expected YYYY-MM-DD)", values[1]);
+    }
+    if (values[2] != NULL && !parse_recurrence_name(values[2], strlen(values[2]), &recurrence)) {
+        return fail(batch, "invalid recurrence '%s' (expected none, daily, weekly, biweekly, monthly or yearly)", values[2]);
+    }
+    if (values[3] != NULL) {
+        char *end;
+        priority = (int)strtol(values[3], &end, 10);
+        if (end == values[3] || *end != '\0' || priority < 1 || priority > 5) {
+            return fail(batch, "invalid priority '%s' (expected 1-5)", values[3]);
+        }
+    }
+
+    char *title = join_words(argv, words);
+    if (!check_text(batch, "title", title)) {
+        free(title);
+        return 0;
+    }
+    int position = add_task(&tasks, title, values[0], due_day, recurrence, priority);
+    free(title);
+    fprintf(batch->out, "%d\n", TASK_AT(&tasks, position)->id);
+    batch->changed = true;
+    return 1;
+}
+
+// Write the tasks matching a query, in the order they are sorted in
+static int write_tasks_where(Batch *batch, const char *query) {
+    uint32_t *view;
+    char error[128];
+    int count = tasks_where(&tasks, query, &view, error, sizeof(error));
+    if (count < 0) {
+        return fail(batch, "invalid query: %s", error);
+    }
+    for (int row = 0; row < count; row++) {
+        write_task_line(batch->out, TASK_AT(&tasks, view[row]));
+    }
+    free(view);
+    return 1;
+}
+
+// list [-s SORT] [-w QUERY]: every task, or those matching QUERY
+static int command_list(Batch *batch, int argc, char **argv) {
+    char *values[2] = {NULL, NULL};
+    int words = split_options(batch, argc, argv, "sw", values);
+    if (words > 0) {
+        return fail(batch, "list takes no argument '%s'", argv[0]);
+    }
+    if (words < 0 || !apply_sort(batch, values[0])) {
+        return 0;
+    }
+    if (values[1] != NULL) {
+        int ok = write_tasks_where(batch, values[1]);
+        set_sort_mode(&tasks, SORT_NONE);
+        return ok;
+    } else {
+        int count = sort_view_count(&tasks);
+        for (int row = 0; row < count; row++) {
+            write_task_line(batch->out, TASK_AT(&tasks, sort_view_position(&tasks, row)));
+        }
+    }
+    set_sort_mode(&tasks, SORT_NONE);
+    return 1;
+}
+
+// query [-s SORT] TEXT...: tasks whose title or category contains TEXT
+static int command_query(Batch *batch, int argc, char **argv) {
+    char *values[1] = {NULL};
+    int words = split_options(batch, argc, argv, "s", values);
+    if (words < 0 || !apply_sort(batch, values[0])) {
+        return 0;
+    }
+
+    char *text = join_words(argv, words);
+    search_filter_begin(sort_view_count(&tasks), sort_view_order(&tasks));
+    for (const char *c = text; *c != '\0'; c++) {
+        search_filter_push(&tasks, *c);
+    }
+    int count;
+    const uint32_t *view = search_filter_view(&count);
+    for (int row = 0; row < count; row++) {
+        int position = view != NULL ? (int)view[row] : sort_view_position(&tasks, row);
+        write_task_line(batch->out, TASK_AT(&tasks, position));
+    }
+    search_filter_end();
+    free(text);
+    set_sort_mode(&tasks, SORT_NONE);
+    return 1;
+}
+
+// view [-s SORT] NAME: tasks matching a saved view
+// view NAME QUERY...: save QUERY as the view NAME, replacing any of that name
+// view -d NAME: delete a view
+// view: list the saved views, as NAME<TAB>QUERY lines
+static int command_view(Batch *batch, int argc, char **argv) {
+    char *values[2] = {NULL, NULL};
+    int words = split_options(batch, argc, argv, "sd", values);
+    if (words < 0) {
+        return 0;
+    }
+    // Views are not part of the tasks a batch holds back
+    if ((values[1] != NULL || words > 1) && batch->reading_stdin) {
+        return fail(batch, "views cannot be changed in a batch%s", "");
+    }
+    if (values[1] != NULL) {
+        if (words > 0 || values[0] != NULL) {
+            return fail(batch, "view -d takes only a view name%s", "");
+        }
+        return delete_view(values[1]) ? 1 : fail(batch, "no saved view named '%s'", values[1]);
+    }
+    if (words == 0) {
+        return list_views(batch->out) ? 1 : fail(batch, "could not list the views%s", "");
+    }
+    if (words > 1) {
+        char error[128];
+        char *query = join_words(argv + 1, words - 1);
+        int ok = save_view(argv[0], query, error, sizeof(error));
+        free(query);
+        return ok ? 1 : fail(batch, "%s", error);
+    }
+
+    char query[MAX_TITLE_LEN];
+    snprintf(query, sizeof(query), "@%s", argv[0]);
+    if (!apply_sort(batch, values[0])) {
+        return 0;
+    }
+    int ok = write_tasks_where(batch, query);
+    set_sort_mode(&tasks, SORT_NONE);
+    return ok;
+}
+
+// agenda [today|week|month|FROM [TO]]: tasks due in a span of days, by day
+// and then priority; this week by default
+static int command_agenda(Batch *batch, int argc, char **argv) {
+    int first_day, last_day;
+    if (argc > 3) {
+        return fail(batch, "agenda takes at most two dates, not '%s'", argv[3]);
+    }
+    if (argc == 1) {
+        agenda_span("week", today_day(), &first_day, &last_day);
+    } else if (agenda_span(argv[1], today_day(), &first_day, &last_day)) {
+        if (argc == 3) {
+            return fail(batch, "'%s' takes no second date", argv[1]);
+        }
+    } else {
+        if (!parse_date(argv[1], &first_day) || first_day == NO_DUE_DAY) {
+            return fail(batch, "invalid date '%s' (expected YYYY-MM-DD, today, week or month)", argv[1]);
+        }
+        last_day = first_day;
+        if (argc == 3 && (!parse_date(argv[2], &last_day) || last_day == NO_DUE_DAY)) {
+            return fail(batch, "invalid date '%s' (expected YYYY-MM-DD)", argv[2]);
+        }
+    }
+
+    uint32_t *view;
+    int count = agenda_tasks(&tasks, first_day, last_day, &view);
+    for (int row = 0; row < count; row++) {
+        write_task_line(batch->out, TASK_AT(&tasks, view[row]));
+    }
+    free(view);
+    return 1;
+}
+
+// done ID...: mark tasks completed; a recurring task moves to its next date
+static int command_done(Batch *batch, int argc, char **argv) {
+    if (argc < 2) {
+        return fail(batch, "%s needs a task ID", argv[0]);
+    }
+    for (int i = 1; i < argc; i++) {
+        int position;
+        if (!parse_id(batch, argv[i], &position)) {
+            return 0;
+        }
+        if (!TASK_AT(&tasks, position)->completed) {
+            toggle_task_completion(task_for_write(&tasks, position));
+            batch->changed = true;
+        }
+    }
+    return 1;
+}
+
+// rm ID...
+static int command_rm(Batch *batch, int argc, char **argv) {
+    if (argc < 2) {
+        return fail(batch, "%s needs a task ID", argv[0]);
+    }
+    for (int i = 1; i < argc; i++) {
+        int position;
+        if (!parse_id(batch, argv[i], &position)) {
+            return 0;
+        }
+        remove_task(&tasks, position);
+        batch->changed = true;
+    }
+    return 1;
+}
+
+// import FORMAT [FILE]: add the tasks in FILE, or stdin
+static int command_import(Batch *batch, int argc, char **argv) {
+    ExchangeFormat format;
+    if (argc < 2 || argc > 3) {
+        return fail(batch, "%s needs a format and optionally a file", argv[0]);
+    }
+    if (!parse_exchange_format(argv[1], &format)) {
+        return fail(batch, "unknown format '%s' (expected csv, jsonl or ical)", argv[1]);
+    }
+    bool from_stdin = argc == 2 || strcmp(argv[2], "-") == 0;
+    if (from_stdin && batch->reading_stdin) {
+        return fail(batch, "%s needs a file in a batch", argv[0]);
+    }
+    FILE *in = from_stdin ? stdin : fopen(argv[2], "r");
+    if (in == NULL) {
+        return fail(batch, "cannot open '%s'", argv[2]);
+    }
+
+    char error[200];
+    int imported = import_tasks(&tasks, format, in, error, sizeof(error));
+    if (!from_stdin) {
+        fclose(in);
+    }
+    if (imported < 0) {
+        return fail(batch, "%s", error);
+    }
+    fprintf(batch->out, "%d\n", imported);
+    batch->changed = true;
+    return 1;
+}
+
+// export FORMAT
+static int command_export(Batch *batch, int argc, char **argv) {
+    ExchangeFormat format;
+    if (argc != 2) {
+        return fail(batch, "%s needs a format", argv[0]);
+    }
+    if (!parse_exchange_format(argv[1], &format)) {
+        return fail(batch, "unknown format '%s' (expected csv, jsonl or ical)", argv[1]);
+    }
+    if (!export_tasks(&tasks, format, batch->out)) {
+        return fail(batch, "%s", "error writing the tasks");
+    }
+    return 1;
+}
+
+static const Command commands[] = {
+    {"add", command_add, false},
+    {"list", command_list, true},
+    {"query", command_query, true},
+    {"view", command_view, true},
+    {"agenda", command_agenda, true},
+    {"done", command_done, false},
+    {"rm", command_rm, false},
+    {"import", command_import, false},
+    {"export", command_export, true},
+};
+
+static const Command *find_command(const char *name) {
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, name) == 0) {
+            return &commands[i];
+        }
+    }
+    return NULL;
+}
+
+// Split `line` into words in place, the way the shell does: quotes group
+// words and a backslash outside single quotes keeps the next character as it
+// is. Returns the number of words, or -1 if a quote is left open or there are
+// more than `max` words.
+static int split_words(char *line, char **words, int max) {
+    int count = 0;
+    char *in = line;
+    char *out = line;
+    while (1) {
+        while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n') {
+            in++;
+        }
+        if (*in == '\0' || *in == '#') {
+            return count;
+        }
+        if (count == max) {
+            return -1;
+        }
+        words[count++] = out;
+
+        char quote = '\0';
+        while (*in != '\0' && (quote != '\0' || strchr(" \t\r\n", *in) == NULL)) {
+            if (quote == '\0' && (*in == '\'' || *in == '"')) {
+                quote = *in++;
+            } else if (*in == quote) {
+                quote = '\0';
+                in++;
+            } else if (*in == '\\' && quote != '\'' && in[1] != '\0') {
+                in++;
+                *out++ = *in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        if (quote != '\0') {
+            return -1;
+        }
+        // The word is never longer than the text it came from, so this only
+        // overwrites what has been read already
+        bool last = *in == '\0';
+        *out++ = '\0';
+        if (last) {
+            return count;
+        }
+        in++;
+    }
+}
+
+static int run_words(Batch *batch, int argc, char **argv) {
+    const Command *command = find_command(argv[0]);
+    if (command == NULL) {
+        return fail(batch, "unknown command '%s'", argv[0]);
+    }
+    return command->run(batch, argc, argv);
+}
+
+// Run the commands on stdin; stops at the first that fails
+static int run_batch(Batch *batch) {
+    char *line = NULL;
+    size_t capacity = 0;
+    int line_number = 0;
+    int ok = 1;
+
+    while (ok && getline(&line, &capacity, stdin) != -1) {
+        char *words[MAX_COMMAND_WORDS];
+        line_number++;
+        int count = split_words(line, words, MAX_COMMAND_WORDS);
+        if (count < 0) {
+            fail(batch, "%s", "unbalanced quotes or too many words");
+        }
+        ok = count > 0 ? run_words(batch, count, words) : count == 0;
+        if (!ok) {
+            char error[sizeof(batch->error)];
+            snprintf(error, sizeof(error), "%s", batch->error);
+            snprintf(batch->error, sizeof(batch->error), "line %d: %.200s", line_number, error);
+        }
+    }
+    free(line);
+    return ok;
+}
+
+void print_usage(FILE *file, const char *program) {
+    fprintf(file,
+            "Usage: %s                     open the task list\n"
+            "       %s add TITLE [-c CATEGORY] [-d YYYY-MM-DD] [-r RECURRENCE] [-p 1-5]\n"
+            "       %s list [-s SORT] [-w QUERY]\n"
+            "       %s query [-s SORT] TEXT\n"
+            "       %s view [-s SORT] [NAME [QUERY]] | view -d NAME\n"
+            "       %s agenda [today|week|month|FROM [TO]]\n"
+            "       %s done ID...\n"
+            "       %s rm ID...\n"
+            "       %s import csv|jsonl|ical [FILE]\n"
+            "       %s export csv|jsonl|ical\n"
+            "       %s batch < COMMANDS\n"
+            "       %s --convert text|binary\n",
+            program, program, program, program, program, program, program, program, program, program, program, program);
+}
+
+// Run a command given on the command line (argv[0] is its name). Returns the
+// exit status.
+int run_command(int argc, char **argv, const char *program) {
+    bool batch_mode = strcmp(argv[0], "batch") == 0;
+    if (batch_mode ? argc != 1 : find_command(argv[0]) == NULL) {
+        print_usage(stderr, program);
+        return 1;
+    }
+
+    load_tasks(&tasks);
+
+    // A command that changes nothing has nothing to hold its output back for,
+    // and a long listing is better streamed than kept in memory
+    char *output = NULL;
+    size_t output_size = 0;
+    Batch batch = {0};
+    batch.reading_stdin = batch_mode;
+    bool streaming = !batch_mode && find_command(argv[0])->read_only;
+    batch.out = streaming ? stdout : open_memstream(&output, &output_size);
+    if (batch.out == NULL) {
+        handle_error("Error allocating memory for the command output.");
+        exit(1);
+    }
+    int ok = batch_mode ? run_batch(&batch) : run_words(&batch, argc, argv);
+    if (!streaming) {
+        fclose(batch.out);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", program, batch.error);
+    } else if (batch.changed && !save_now()) {
+        ok = 0;
+    } else if (!streaming) {
+        fwrite(output, 1, output_size, stdout);
+    }
+
+    free(output);
+    release_tasks(&tasks);
+    search_index_free();
+    sort_index_free();
+    free_task_ids();
+    free_text_store();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,977 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "todo.h"
+
+// Bulk import and export.
+//
+// Tasks can be written out and read back as CSV (with a header row), JSON
+// Lines (one object per line) or iCalendar VTODO components. Both directions
+// stream: exporting formats one task at a time into the output, and
+// importing reads one record at a time, so apart from the tasks themselves
+// memory use is bounded by the longest record.
+//
+// Imported tasks are collected in a batch of IMPORT_BATCH rows, and each full
+// batch is added to the task table at once: its room is reserved in one go,
+// the rows get new IDs and are copied a chunk at a time. Nothing is written
+// to the journal for them; the next save rewrites the base file instead,
+// which is cheaper than journaling every task of a large import.
+//
+// The fields are those of the tasks file. IDs are exported but not imported,
+// since they only make sense in the list they came from. A missing category
+// or priority takes the defaults of `todo add`. Tabs and line breaks, which
+// the tasks file cannot hold, are turned into spaces. A record that cannot be
+// read stops the import with an error naming it.
+
+#define IMPORT_BATCH 4096
+#define MAX_CSV_FIELDS 64
+#define ICAL_LINE_OCTETS 75
+
+// The fields of one imported task as read, before they are checked
+typedef struct {
+    char *title;
+    size_t title_len;
+    char *category;
+    size_t category_len;
+    const char *priority;    // Text of the number, or NULL
+    size_t priority_len;
+    int completed;
+    int due_day;
+    RecurrenceType recurrence;
+} ImportFields;
+
+typedef struct {
+    TaskTable *tasks;
+    Task *rows;
+    int count;
+    int imported;
+    long record;             // Number of the record being read, for errors
+    char *error;
+    size_t error_size;
+} Importer;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} TextBuffer;
+
+static void text_reserve(TextBuffer *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
+    }
+    char *temp = realloc(buffer->data, capacity);
+    if (temp == NULL) {
+        handle_error("Error allocating memory for importing tasks.");
+        exit(1);
+    }
+    buffer->data = temp;
+    buffer->capacity = capacity;
+}
+
+static void text_append(TextBuffer *buffer, const char *text, size_t length) {
+    text_reserve(buffer, length);
+    memcpy(buffer->data + buffer->size, text, length);
+    buffer->size += length;
+}
+
+int parse_exchange_format(const char *name, ExchangeFormat *format) {
+    if (strcmp(name, "csv") == 0) {
+        *format = EXCHANGE_CSV;
+    } else if (strcmp(name, "jsonl") == 0) {
+        *format = EXCHANGE_JSONL;
+    } else if (strcmp(name, "ical") == 0) {
+        *format = EXCHANGE_ICAL;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Export
+
+static void write_csv_field(FILE *out, const char *text) {
+    if (strpbrk(text, ",\"\r\n") == NULL && text[0] != ' ') {
+        fputs(text, out);
+        return;
+    }
+    putc_unlocked('"', out);
+    for (; *text != '\0'; text++) {
+        if (*text == '"') {
+            putc_unlocked('"', out);
+        }
+        putc_unlocked(*text, out);
+    }
+    putc_unlocked('"', out);
+}
+
+static void write_json_string(FILE *out, const char *text) {
+    putc_unlocked('"', out);
+    for (; *text != '\0'; text++) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            putc_unlocked('\\', out);
+            putc_unlocked(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            putc_unlocked(c, out);
+        }
+    }
+    putc_unlocked('"', out);
+}
+
+// Write a content line, folded into lines of at most ICAL_LINE_OCTETS octets
+// without splitting a UTF-8 sequence. `value` is escaped as TEXT if `text`.
+static void write_ical_line(FILE *out, const char *name, const char *value, bool text) {
+    char line[1024];
+    TextBuffer buffer = {line, 0, 0};
+    size_t name_len = strlen(name);
+    bool heap = false;
+
+    // Escape into the stack buffer, or the heap for very long values
+    size_t worst = name_len + 1 + strlen(value) * 2;
+    if (worst > sizeof(line)) {
+        buffer.data = NULL;
+        text_reserve(&buffer, worst);
+        heap = true;
+    }
+    memcpy(buffer.data, name, name_len);
+    buffer.data[name_len] = ':';
+    buffer.size = name_len + 1;
+    for (; *value != '\0'; value++) {
+        if (text && (*value == '\\' || *value == ';' || *value == ',')) {
+            buffer.data[buffer.size++] = '\\';
+        }
+        buffer.data[buffer.size++] = *value;
+    }
+
+    size_t start = 0;
+    size_t limit = ICAL_LINE_OCTETS;
+    while (buffer.size - start > limit) {
+        size_t end = start + limit;
+        while ((buffer.data[end] & 0xC0) == 0x80) {
+            end--;
+        }
+        fwrite(buffer.data + start, 1, end - start, out);
+        fputs("\r\n ", out);
+        start = end;
+        limit = ICAL_LINE_OCTETS - 1;  // The leading space counts
+    }
+    fwrite(buffer.data + start, 1, buffer.size - start, out);
+    fputs("\r\n", out);
+    if (heap) {
+        free(buffer.data);
+    }
+}
+
+static const char *ical_rrules[] = {
+    NULL,
+    "FREQ=DAILY",
+    "FREQ=WEEKLY",
+    "FREQ=WEEKLY;INTERVAL=2",
+    "FREQ=MONTHLY",
+    "FREQ=YEARLY"
+};
+
+static void export_ical_task(FILE *out, const Task *task, const char *stamp) {
+    char value[32];
+    fputs("BEGIN:VTODO\r\n", out);
+    snprintf(value, sizeof(value), "%d@todo", task->id);
+    write_ical_line(out, "UID", value, false);
+    write_ical_line(out, "DTSTAMP", stamp, false);
+    write_ical_line(out, "SUMMARY", task->title, true);
+    write_ical_line(out, "CATEGORIES", category_name(task->category), true);
+    // iCalendar priorities run from 1 (highest) to 9
+    if (task->priority >= 1 && task->priority <= 5) {
+        snprintf(value, sizeof(value), "%d", task->priority * 2 - 1);
+        write_ical_line(out, "PRIORITY", value, false);
+    }
+    write_ical_line(out, "STATUS", task->completed ? "COMPLETED" : "NEEDS-ACTION", false);
+    if (task->due_day != NO_DUE_DAY) {
+        int year, month, day;
+        civil_from_days(task->due_day, &year, &month, &day);
+        snprintf(value, sizeof(value), "%04d%02d%02d", year, month, day);
+        write_ical_line(out, "DUE;VALUE=DATE", value, false);
+    }
+    if (task->recurrence != RECURRENCE_NONE && task->recurrence <= RECURRENCE_YEARLY) {
+        write_ical_line(out, "RRULE", ical_rrules[task->recurrence], false);
+    }
+    fputs("END:VTODO\r\n", out);
+}
+
+// Write every task to `out`; returns 0 on a write error
+int export_tasks(const TaskTable *tasks, ExchangeFormat format, FILE *out) {
+    char stamp[20];
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+
+    if (format == EXCHANGE_CSV) {
+        fputs("id,title,category,priority,completed,due,recurrence\n", out);
+    } else if (format == EXCHANGE_ICAL) {
+        fputs("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//todo//todo//EN\r\n", out);
+    }
+
+    char due_date[MAX_DATE_LEN];
+    for (int i = 0; i < tasks->count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        if (task->due_day != NO_DUE_DAY) {
+            format_date(due_date, sizeof(due_date), task->due_day);
+        }
+        switch (format) {
+            case EXCHANGE_CSV:
+                fprintf(out, "%d,", task->id);
+                write_csv_field(out, task->title);
+                putc_unlocked(',', out);
+                write_csv_field(out, category_name(task->category));
+                fprintf(out, ",%d,%d,%s,%s\n", task->priority, task->completed,
+                        task->due_day != NO_DUE_DAY ? due_date : "", recurrence_strings[task->recurrence]);
+                break;
+            case EXCHANGE_JSONL:
+                fprintf(out, "{\"id\":%d,\"title\":", task->id);
+                write_json_string(out, task->title);
+                fputs(",\"category\":", out);
+                write_json_string(out, category_name(task->category));
+                fprintf(out, ",\"priority\":%d,\"completed\":%s,\"due\":", task->priority,
+                        task->completed ? "true" : "false");
+                if (task->due_day != NO_DUE_DAY) {
+                    fprintf(out, "\"%s\"", due_date);
+                } else {
+                    fputs("null", out);
+                }
+                fprintf(out, ",\"recurrence\":\"%s\"}\n", recurrence_strings[task->recurrence]);
+                break;
+            case EXCHANGE_ICAL:
+                export_ical_task(out, task, stamp);
+                break;
+        }
+    }
+
+    if (format == EXCHANGE_ICAL) {
+        fputs("END:VCALENDAR\r\n", out);
+    }
+    return fflush(out) == 0 && !ferror(out);
+}
+
+// Import
+
+static int import_error(Importer *importer, const char *message) {
+    snprintf(importer->error, importer->error_size, "record %ld: %s", importer->record, message);
+    return 0;
+}
+
+static void flush_rows(Importer *importer) {
+    TaskTable *tasks = importer->tasks;
+    reserve_tasks(tasks, importer->count);
+    for (int i = 0; i < importer->count; i++) {
+        importer->rows[i].id = new_task_id(tasks->count + i);
+    }
+    append_tasks(tasks, importer->rows, importer->count);
+    importer->imported += importer->count;
+    importer->count = 0;
+}
+
+static void clean_text(char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\t' || text[i] == '\r' || text[i] == '\n') {
+            text[i] = ' ';
+        }
+    }
+}
+
+static void reset_fields(ImportFields *fields) {
+    memset(fields, 0, sizeof(*fields));
+    fields->due_day = NO_DUE_DAY;
+    fields->recurrence = RECURRENCE_NONE;
+}
+
+// Check the fields of a record and add it to the batch
+static int add_record(Importer *importer, ImportFields *fields) {
+    if (fields->title == NULL || fields->title_len == 0) {
+        return import_error(importer, "missing title");
+    }
+    int priority = DEFAULT_PRIORITY;
+    if (fields->priority != NULL && fields->priority_len > 0) {
+        if (fields->priority_len != 1 || fields->priority[0] < '1' || fields->priority[0] > '5') {
+            return import_error(importer, "priority must be 1-5");
+        }
+        priority = fields->priority[0] - '0';
+    }
+
+    clean_text(fields->title, fields->title_len);
+    Task *task = &importer->rows[importer->count];
+    memset(task, 0, sizeof(*task));
+    task->title = store_text_n(fields->title, fields->title_len);
+    if (fields->category != NULL && fields->category_len > 0) {
+        clean_text(fields->category, fields->category_len);
+        task->category = intern_category_n(fields->category, fields->category_len);
+    } else {
+        task->category = intern_category(DEFAULT_CATEGORY);
+    }
+    task->priority = priority;
+    task->completed = fields->completed;
+    task->due_day = fields->due_day;
+    task->recurrence = fields->recurrence;
+
+    if (++importer->count == IMPORT_BATCH) {
+        flush_rows(importer);
+    }
+    return 1;
+}
+
+static int parse_completed(const char *text, size_t length, int *completed) {
+    if ((length == 1 && text[0] == '0') || (length == 5 && strncasecmp(text, "false", 5) == 0) || length == 0) {
+        *completed = 0;
+    } else if ((length == 1 && text[0] == '1') || (length == 4 && strncasecmp(text, "true", 4) == 0)) {
+        *completed = 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_due(const char *text, size_t length, int *due_day) {
+    if (length == 0 || (length == strlen(NO_DUE_DATE) && memcmp(text, NO_DUE_DATE, length) == 0)) {
+        *due_day = NO_DUE_DAY;
+        return 1;
+    }
+    return parse_date_n(text, length, due_day);
+}
+
+static int parse_recurrence_field(const char *text, size_t length, RecurrenceType *recurrence) {
+    if (length == 0) {
+        *recurrence = RECURRENCE_NONE;
+        return 1;
+    }
+    return parse_recurrence_name(text, length, recurrence);
+}
+
+// CSV
+
+enum {
+    CSV_TITLE,
+    CSV_CATEGORY,
+    CSV_PRIORITY,
+    CSV_COMPLETED,
+    CSV_DUE,
+    CSV_RECURRENCE,
+    CSV_COLUMNS
+};
+
+static const char *csv_columns[CSV_COLUMNS] = {"title", "category", "priority", "completed", "due", "recurrence"};
+
+typedef struct {
+    TextBuffer text;                 // The fields, each followed by a NUL
+    size_t starts[MAX_CSV_FIELDS + 1];
+    int count;
+} CsvRecord;
+
+// Read one record as RFC 4180 describes it. Returns its number of fields,
+// 0 at the end of the input, or -1 if it is malformed.
+static int read_csv_record(FILE *in, CsvRecord *record) {
+    record->text.size = 0;
+    record->count = 0;
+    int c = getc_unlocked(in);
+    if (c == EOF) {
+        return 0;
+    }
+
+    while (1) {
+        if (record->count == MAX_CSV_FIELDS) {
+            return -1;
+        }
+        record->starts[record->count++] = record->text.size;
+        if (c == '"') {
+            while (1) {
+                c = getc_unlocked(in);
+                if (c == EOF) {
+                    return -1;  // Unterminated quote
+                }
+                if (c == '"' && (c = getc_unlocked(in)) != '"') {
+                    break;
+                }
+                text_reserve(&record->text, 1);
+                record->text.data[record->text.size++] = c;
+            }
+            if (c != ',' && c != '\n' && c != '\r' && c != EOF) {
+                return -1;  // Text after the closing quote
+            }
+        } else {
+            while (c != ',' && c != '\n' && c != '\r' && c != EOF) {
+                text_reserve(&record->text, 1);
+                record->text.data[record->text.size++] = c;
+                c = getc_unlocked(in);
+            }
+        }
+        text_reserve(&record->text, 1);
+        record->text.data[record->text.size++] = '\0';
+
+        if (c != ',') {
+            break;
+        }
+        c = getc_unlocked(in);
+    }
+    if (c == '\r' && (c = getc_unlocked(in)) != '\n' && c != EOF) {
+        ungetc(c, in);
+    }
+    record->starts[record->count] = record->text.size;
+    return record->count;
+}
+
+static int import_csv(Importer *importer, FILE *in) {
+    CsvRecord record = {0};
+    int columns[CSV_COLUMNS];
+    int ok = 1;
+
+    importer->record = 1;
+    int count = read_csv_record(in, &record);
+    if (count <= 0) {
+        free(record.text.data);
+        return count == 0 ? 1 : import_error(importer, "malformed header");
+    }
+    for (int column = 0; column < CSV_COLUMNS; column++) {
+        columns[column] = -1;
+        for (int i = 0; i < count; i++) {
+            if (strcasecmp(record.text.data + record.starts[i], csv_columns[column]) == 0) {
+                columns[column] = i;
+            }
+        }
+    }
+    if (columns[CSV_TITLE] < 0) {
+        free(record.text.data);
+        return import_error(importer, "the header has no title column");
+    }
+
+    while (ok) {
+        importer->record++;
+        count = read_csv_record(in, &record);
+        if (count == 0) {
+            break;
+        }
+        if (count < 0) {
+            ok = import_error(importer, "malformed CSV");
+            break;
+        }
+        if (count == 1 && record.starts[1] == 1) {
+            continue;  // Blank line
+        }
+
+        char *field[CSV_COLUMNS];
+        size_t length[CSV_COLUMNS];
+        for (int column = 0; column < CSV_COLUMNS; column++) {
+            int i = columns[column];
+            field[column] = i >= 0 && i < count ? record.text.data + record.starts[i] : "";
+            length[column] = i >= 0 && i < count ? record.starts[i + 1] - record.starts[i] - 1 : 0;
+        }
+
+        ImportFields fields;
+        reset_fields(&fields);
+        fields.title = field[CSV_TITLE];
+        fields.title_len = length[CSV_TITLE];
+        fields.category = field[CSV_CATEGORY];
+        fields.category_len = length[CSV_CATEGORY];
+        fields.priority = field[CSV_PRIORITY];
+        fields.priority_len = length[CSV_PRIORITY];
+        if (!parse_completed(field[CSV_COMPLETED], length[CSV_COMPLETED], &fields.completed)) {
+            ok = import_error(importer, "completed must be 0 or 1");
+        } else if (!parse_due(field[CSV_DUE], length[CSV_DUE], &fields.due_day)) {
+            ok = import_error(importer, "due date must be YYYY-MM-DD");
+        } else if (!parse_recurrence_field(field[CSV_RECURRENCE], length[CSV_RECURRENCE], &fields.recurrence)) {
+            ok = import_error(importer, "unknown recurrence");
+        } else {
+            ok = add_record(importer, &fields);
+        }
+    }
+    free(record.text.data);
+    return ok;
+}
+
+// JSON Lines
+
+static void skip_space(char **p) {
+    while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n') {
+        (*p)++;
+    }
+}
+
+static void put_utf8(char **out, unsigned code) {
+    if (code < 0x80) {
+        *(*out)++ = code;
+    } else if (code < 0x800) {
+        *(*out)++ = 0xC0 | (code >> 6);
+        *(*out)++ = 0x80 | (code & 0x3F);
+    } else if (code < 0x10000) {
+        *(*out)++ = 0xE0 | (code >> 12);
+        *(*out)++ = 0x80 | ((code >> 6) & 0x3F);
+        *(*out)++ = 0x80 | (code & 0x3F);
+    } else {
+        *(*out)++ = 0xF0 | (code >> 18);
+        *(*out)++ = 0x80 | ((code >> 12) & 0x3F);
+        *(*out)++ = 0x80 | ((code >> 6) & 0x3F);
+        *(*out)++ = 0x80 | (code & 0x3F);
+    }
+}
+
+static int read_hex4(const char *p, unsigned *value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return 0;
+        }
+        *value = *value * 16 + digit;
+    }
+    return 1;
+}
+
+// Decode the string starting at the opening quote at *p, in place: the text
+// never gets longer. Leaves *p after the closing quote.
+static int parse_json_string(char **p, char **text, size_t *length) {
+    char *in = *p + 1;
+    char *out = in;
+    *text = in;
+    while (*in != '"') {
+        if (*in == '\0') {
+            return 0;
+        }
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in++) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                unsigned code, low;
+                if (!read_hex4(in, &code)) {
+                    return 0;
+                }
+                in += 4;
+                // A surrogate pair, written as two escapes
+                if (code >= 0xD800 && code < 0xDC00 && in[0] == '\\' && in[1] == 'u' &&
+                    read_hex4(in + 2, &low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    in += 6;
+                }
+                put_utf8(&out, code);
+                break;
+            }
+            default:
+                return 0;
+        }
+    }
+    *length = out - *text;
+    *p = in + 1;
+    return 1;
+}
+
+// Step over a value that is not used, objects and arrays included
+static int skip_json_value(char **p) {
+    int depth = 0;
+    do {
+        skip_space(p);
+        char c = **p;
+        if (c == '"') {
+            char *text;
+            size_t length;
+            if (!parse_json_string(p, &text, &length)) {
+                return 0;
+            }
+        } else if (c == '{' || c == '[') {
+            depth++;
+            (*p)++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0) {
+                return 0;
+            }
+            depth--;
+            (*p)++;
+        } else if (c == ',' || c == ':') {
+            if (depth == 0) {
+                return 0;
+            }
+            (*p)++;
+        } else if (c == '\0') {
+            return 0;
+        } else {
+            char *start = *p;
+            while (**p != '\0' && strchr(",:{}[] \t\r\n\"", **p) == NULL) {
+                (*p)++;
+            }
+            if (*p == start) {
+                return 0;
+            }
+        }
+    } while (depth > 0);
+    return 1;
+}
+
+// A value that is a string, a bare word (number, true, false, null) or null
+static int parse_json_scalar(char **p, char **text, size_t *length, bool *is_string) {
+    skip_space(p);
+    *is_string = **p == '"';
+    if (*is_string) {
+        return parse_json_string(p, text, length);
+    }
+    *text = *p;
+    while (**p != '\0' && strchr(",}] \t\r\n", **p) == NULL) {
+        (*p)++;
+    }
+    *length = *p - *text;
+    return *length > 0;
+}
+
+static int parse_json_record(Importer *importer, char *line) {
+    ImportFields fields;
+    reset_fields(&fields);
+    char *p = line;
+
+    skip_space(&p);
+    if (*p != '{') {
+        return import_error(importer, "expected a JSON object");
+    }
+    p++;
+    skip_space(&p);
+    bool first = true;
+    while (*p != '}') {
+        if (!first) {
+            if (*p != ',') {
+                return import_error(importer, "malformed JSON");
+            }
+            p++;
+            skip_space(&p);
+        }
+        first = false;
+
+        char *key;
+        size_t key_len;
+        if (*p != '"' || !parse_json_string(&p, &key, &key_len)) {
+            return import_error(importer, "malformed JSON");
+        }
+        skip_space(&p);
+        if (*p != ':') {
+            return import_error(importer, "malformed JSON");
+        }
+        p++;
+        skip_space(&p);
+
+        char *value;
+        size_t length;
+        bool is_string;
+        bool is_null = strncmp(p, "null", 4) == 0;
+        #define KEY_IS(name) (key_len == strlen(name) && memcmp(key, name, key_len) == 0)
+        if (KEY_IS("title") || KEY_IS("category") || KEY_IS("priority") ||
+            KEY_IS("completed") || KEY_IS("due") || KEY_IS("recurrence")) {
+            if (!parse_json_scalar(&p, &value, &length, &is_string)) {
+                return import_error(importer, "malformed JSON");
+            }
+            if (is_null) {
+                length = 0;
+            }
+            if (KEY_IS("title")) {
+                fields.title = value;
+                fields.title_len = length;
+            } else if (KEY_IS("category")) {
+                fields.category = value;
+                fields.category_len = length;
+            } else if (KEY_IS("priority")) {
+                fields.priority = value;
+                fields.priority_len = length;
+            } else if (KEY_IS("completed")) {
+                if (!parse_completed(value, length, &fields.completed)) {
+                    return import_error(importer, "completed must be true or false");
+                }
+            } else if (KEY_IS("due")) {
+                if (!parse_due(value, length, &fields.due_day)) {
+                    return import_error(importer, "due date must be YYYY-MM-DD or null");
+                }
+            } else if (!parse_recurrence_field(value, length, &fields.recurrence)) {
+                return import_error(importer, "unknown recurrence");
+            }
+        } else if (!skip_json_value(&p)) {
+            return import_error(importer, "malformed JSON");
+        }
+        #undef KEY_IS
+        skip_space(&p);
+    }
+    p++;
+    skip_space(&p);
+    if (*p != '\0') {
+        return import_error(importer, "text after the JSON object");
+    }
+    return add_record(importer, &fields);
+}
+
+static int import_jsonl(Importer *importer, FILE *in) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int ok = 1;
+    while (ok && (length = getline(&line, &capacity, in)) != -1) {
+        importer->record++;
+        if (strspn(line, " \t\r\n") == (size_t)length) {
+            continue;
+        }
+        ok = parse_json_record(importer, line);
+    }
+    free(line);
+    return ok;
+}
+
+// iCalendar
+
+// Undo TEXT escaping in place, stopping at the first unescaped comma when
+// `first_only` (for lists such as CATEGORIES). Returns the new length.
+static size_t unescape_ical_text(char *text, bool first_only) {
+    char *in = text;
+    char *out = text;
+    while (*in != '\0') {
+        if (*in == ',' && first_only) {
+            break;
+        }
+        if (*in == '\\' && in[1] != '\0') {
+            in++;
+            *out++ = *in == 'n' || *in == 'N' ? ' ' : *in;
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+    return out - text;
+}
+
+static int parse_ical_date(const char *value, int *due_day) {
+    char date[MAX_DATE_LEN];
+    if (strlen(value) < 8 || strspn(value, "0123456789") < 8) {
+        return 0;
+    }
+    snprintf(date, sizeof(date), "%.4s-%.2s-%.2s", value, value + 4, value + 6);
+    return parse_date_n(date, 10, due_day);
+}
+
+static RecurrenceType parse_rrule(const char *value) {
+    char freq[16] = "";
+    int interval = 1;
+    for (const char *part = value; part != NULL; part = strchr(part, ';') ? strchr(part, ';') + 1 : NULL) {
+        if (strncasecmp(part, "FREQ=", 5) == 0) {
+            snprintf(freq, sizeof(freq), "%.*s", (int)strcspn(part + 5, ";"), part + 5);
+        } else if (strncasecmp(part, "INTERVAL=", 9) == 0) {
+            interval = atoi(part + 9);
+        }
+    }
+    if (strcasecmp(freq, "DAILY") == 0 && interval == 1) {
+        return RECURRENCE_DAILY;
+    } else if (strcasecmp(freq, "WEEKLY") == 0 && (interval == 1 || interval == 2)) {
+        return interval == 1 ? RECURRENCE_WEEKLY : RECURRENCE_BIWEEKLY;
+    } else if (strcasecmp(freq, "MONTHLY") == 0 && interval == 1) {
+        return RECURRENCE_MONTHLY;
+    } else if (strcasecmp(freq, "YEARLY") == 0 && interval == 1) {
+        return RECURRENCE_YEARLY;
+    }
+    return RECURRENCE_NONE;  // Not one the app can repeat
+}
+
+typedef struct {
+    bool open;               // Inside a VTODO
+    int depth;               // Of components nested inside it, e.g. VALARM
+    ImportFields fields;
+    TextBuffer summary;
+    TextBuffer category;
+    char priority[2];
+} IcalTodo;
+
+// Handle one unfolded content line
+static int ical_content_line(Importer *importer, IcalTodo *todo, char *line) {
+    // The name ends at the first ';' or ':', the value after the first ':'
+    // outside a quoted parameter value
+    size_t name_len = strcspn(line, ";:");
+    char *value = line + name_len;
+    bool quoted = false;
+    for (; *value != '\0' && (quoted || *value != ':'); value++) {
+        if (*value == '"') {
+            quoted = !quoted;
+        }
+    }
+    if (*value != ':') {
+        return line[0] == '\0' ? 1 : import_error(importer, "malformed content line");
+    }
+    value++;
+    line[name_len] = '\0';
+
+    if (strcasecmp(line, "BEGIN") == 0) {
+        if (todo->open) {
+            todo->depth++;
+        } else if (strcasecmp(value, "VTODO") == 0) {
+            importer->record++;
+            todo->open = true;
+            todo->depth = 0;
+            reset_fields(&todo->fields);
+            todo->summary.size = 0;
+            todo->category.size = 0;
+            todo->priority[0] = '\0';
+        }
+        return 1;
+    }
+    if (!todo->open) {
+        return 1;
+    }
+    if (strcasecmp(line, "END") == 0) {
+        if (todo->depth > 0) {
+            todo->depth--;
+            return 1;
+        }
+        todo->open = false;
+        ImportFields *fields = &todo->fields;
+        if (todo->summary.size > 0) {
+            fields->title = todo->summary.data;
+            fields->title_len = todo->summary.size;
+        }
+        if (todo->category.size > 0) {
+            fields->category = todo->category.data;
+            fields->category_len = todo->category.size;
+        }
+        if (todo->priority[0] != '\0') {
+            fields->priority = todo->priority;
+            fields->priority_len = 1;
+        }
+        return add_record(importer, fields);
+    }
+    if (todo->depth > 0) {
+        return 1;  // A property of a nested component
+    }
+
+    if (strcasecmp(line, "SUMMARY") == 0) {
+        size_t length = unescape_ical_text(value, false);
+        todo->summary.size = 0;
+        text_append(&todo->summary, value, length);
+    } else if (strcasecmp(line, "CATEGORIES") == 0 && todo->category.size == 0) {
+        size_t length = unescape_ical_text(value, true);
+        text_append(&todo->category, value, length);
+    } else if (strcasecmp(line, "PRIORITY") == 0) {
+        // 1 is the highest of 9, and 0 means none
+        int priority = atoi(value);
+        if (priority >= 1 && priority <= 9) {
+            todo->priority[0] = '0' + (priority + 1) / 2;
+            todo->priority[1] = '\0';
+        }
+    } else if (strcasecmp(line, "STATUS") == 0) {
+        todo->fields.completed = strcasecmp(value, "COMPLETED") == 0;
+    } else if (strcasecmp(line, "COMPLETED") == 0) {
+        todo->fields.completed = 1;
+    } else if (strcasecmp(line, "DUE") == 0) {
+        if (!parse_ical_date(value, &todo->fields.due_day)) {
+            return import_error(importer, "malformed DUE");
+        }
+    } else if (strcasecmp(line, "RRULE") == 0) {
+        todo->fields.recurrence = parse_rrule(value);
+    }
+    return 1;
+}
+
+static int import_ical(Importer *importer, FILE *in) {
+    TextBuffer logical = {0};
+    IcalTodo todo = {0};
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int ok = 1;
+
+    while (ok && (length = getline(&line, &capacity, in)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            length--;
+        }
+        // A line starting with a space or tab continues the one before
+        if (length > 0 && (line[0] == ' ' || line[0] == '\t') && logical.size > 0) {
+            logical.size--;  // Its terminator
+            text_append(&logical, line + 1, length - 1);
+            text_append(&logical, "", 1);
+            continue;
+        }
+        if (logical.size > 0) {
+            ok = ical_content_line(importer, &todo, logical.data);
+        }
+        logical.size = 0;
+        text_append(&logical, line, length);
+        text_append(&logical, "", 1);
+    }
+    if (ok && logical.size > 0) {
+        ok = ical_content_line(importer, &todo, logical.data);
+    }
+    if (ok && todo.open) {
+        ok = import_error(importer, "VTODO is not closed");
+    }
+
+    free(line);
+    free(logical.data);
+    free(todo.summary.data);
+    free(todo.category.data);
+    return ok;
+}
+
+// Add the tasks read from `in` to the end of `tasks`. Returns the number
+// added, or -1 with a message in `error`; the tasks read before the error
+// stay added. The new tasks are not added to the search and sort indexes, so
+// this is for the command line, which does not build them.
+int import_tasks(TaskTable *tasks, ExchangeFormat format, FILE *in, char *error, size_t error_size) {
+    Importer importer = {0};
+    importer.tasks = tasks;
+    importer.error = error;
+    importer.error_size = error_size;
+    importer.rows = malloc(IMPORT_BATCH * sizeof(Task));
+    if (importer.rows == NULL) {
+        handle_error("Error allocating memory for importing tasks.");
+        exit(1);
+    }
+
+    int ok;
+    switch (format) {
+        case EXCHANGE_CSV:
+            ok = import_csv(&importer, in);
+            break;
+        case EXCHANGE_JSONL:
+            ok = import_jsonl(&importer, in);
+            break;
+        default:
+            ok = import_ical(&importer, in);
+            break;
+    }
+    if (ok && ferror(in)) {
+        snprintf(error, error_size, "error reading the input");
+        ok = 0;
+    }
+    flush_rows(&importer);
+    free(importer.rows);
+
+    // The indexes and cached statuses catch up with the new rows; the bitmap
+    // and due-date indexes are built again when next queried
+    sort_index_compacted();
+    bitmap_index_free();
+    due_index_free();
+    invalidate_due_status();
+    if (importer.imported > 0) {
+        journal_request_compaction();
+    }
+    return ok ? importer.imported : -1;
+}
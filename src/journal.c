@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include "todo.h"
+
+// Write-ahead journal.
+//
+// Every change to the task list is encoded as a small record and kept in a
+// pending buffer. Autosaves append the pending records to tasks.journal with
+// a single write and fsync, so the cost of a save is proportional to the
+// number of changes rather than the number of tasks. Once the journal grows
+// past JOURNAL_COMPACT_SIZE (or a change such as sorting touches every task)
+// it is folded into the base file by a full save and started afresh.
+//
+// The journal header records the identity of the base file it applies to.
+// A full save replaces the base through a rename, so after a crash between
+// writing the base and resetting the journal the stale journal is recognised
+// and ignored instead of being replayed twice.
+//
+// Records name the task they change by its stable ID (see slots.c). A journal
+// of any other version is reset like a stale one.
+
+#define JOURNAL_MAGIC "TDOJ"
+#define JOURNAL_VERSION 4
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t base_ino;
+    int64_t base_size;
+    int64_t base_mtime_sec;
+    int64_t base_mtime_nsec;
+} JournalHeader;
+
+typedef struct {
+    uint32_t length;    // Payload bytes following this header
+    uint32_t checksum;  // Over the op, id and payload
+    uint8_t op;         // ActionType
+    uint8_t reserved[3];
+    int32_t id;         // ID of the task
+} JournalRecord;
+
+// Fixed-size part of an encoded task; the strings follow it
+typedef struct {
+    uint8_t priority;
+    uint8_t completed;
+    uint8_t recurrence;
+    uint8_t reserved;
+    int32_t due_day;
+    uint32_t title_len;
+    uint32_t category_len;
+} JournalTask;
+
+// Largest record payload accepted when replaying
+#define JOURNAL_MAX_PAYLOAD (16 * 1024 * 1024)
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+// pending_mutex guards the in-memory buffers and counters and is only ever
+// held briefly; file_mutex serialises writers of the journal file so the UI
+// thread never waits on an fsync.
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compaction_done = PTHREAD_COND_INITIALIZER;
+
+static ByteBuffer pending;      // Records not yet written to the journal
+static ByteBuffer compacting;   // Records covered by a full save in progress
+static size_t journal_size = 0; // Bytes of records in the journal file
+static bool compaction_requested = false;
+static bool compaction_running = false;
+
+static char *get_journal_path() {
+    static char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/%s", getenv("HOME"), JOURNAL_FILE_PATH);
+    return file_path;
+}
+
+static char *get_base_path() {
+    return is_binary_store_active() ? get_binary_path() : get_database_path();
+}
+
+static int buffer_append(ByteBuffer *buffer, const void *data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        char *temp = realloc(buffer->data, capacity);
+        if (temp == NULL) {
+            return 0;
+        }
+        buffer->data = temp;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 1;
+}
+
+static void buffer_swap(ByteBuffer *a, ByteBuffer *b) {
+    ByteBuffer temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+static uint32_t record_checksum(const JournalRecord *record, const char *payload) {
+    uint64_t hash = checksum64(&record->op, sizeof(record->op)) ^
+                    checksum64(&record->id, sizeof(record->id)) * 31 ^
+                    checksum64(payload, record->length) * 961;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static void fill_header(JournalHeader *header, const struct stat *base) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+    header->version = JOURNAL_VERSION;
+    header->base_ino = base->st_ino;
+    header->base_size = base->st_size;
+    header->base_mtime_sec = base->st_mtim.tv_sec;
+    header->base_mtime_nsec = base->st_mtim.tv_nsec;
+}
+
+void journal_record(ActionType type, int id, const Task *task) {
+    ByteBuffer payload = {0};
+    JournalRecord record = {0};
+    record.op = type;
+    record.id = id;
+    int ok = 1;
+
+    if (task != NULL) {
+        // Categories are written by name; IDs are only meaningful in memory
+        const char *category = category_name(task->category);
+        JournalTask encoded = {0};
+        encoded.priority = task->priority;
+        encoded.completed = task->completed;
+        encoded.recurrence = task->recurrence;
+        encoded.due_day = task->due_day;
+        encoded.title_len = strlen(task->title);
+        encoded.category_len = strlen(category);
+
+        ok = buffer_append(&payload, &encoded, sizeof(encoded)) &&
+             buffer_append(&payload, task->title, encoded.title_len) &&
+             buffer_append(&payload, category, encoded.category_len);
+        record.length = payload.size;
+    }
+    record.checksum = record_checksum(&record, payload.data);
+
+    pthread_mutex_lock(&pending_mutex);
+    if (!ok || !buffer_append(&pending, &record, sizeof(record)) ||
+        !buffer_append(&pending, payload.data, record.length)) {
+        // Fall back to a full save rather than silently dropping the change
+        compaction_requested = true;
+    }
+    pthread_mutex_unlock(&pending_mutex);
+    free(payload.data);
+}
+
+void journal_request_compaction() {
+    pthread_mutex_lock(&pending_mutex);
+    compaction_requested = true;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+bool journal_needs_compaction() {
+    pthread_mutex_lock(&pending_mutex);
+    bool needed = !compaction_running &&
+                  (compaction_requested || journal_size + pending.size > JOURNAL_COMPACT_SIZE);
+    pthread_mutex_unlock(&pending_mutex);
+    return needed;
+}
+
+// Append all pending records to the journal and fsync once for the group.
+// `*appended`, unless NULL, is set to whether any records were written.
+int journal_flush(bool *appended) {
+    ByteBuffer batch = {0};
+    int ok = 1;
+
+    pthread_mutex_lock(&file_mutex);
+    pthread_mutex_lock(&pending_mutex);
+    if (!compaction_running) {
+        buffer_swap(&batch, &pending);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+
+    if (batch.size > 0) {
+        int fd = open(get_journal_path(), O_WRONLY | O_APPEND);
+        size_t written = 0;
+        if (fd != -1) {
+            while (written < batch.size) {
+                ssize_t n = write(fd, batch.data + written, batch.size - written);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                written += n;
+            }
+            ok = written == batch.size && fsync(fd) == 0;
+            close(fd);
+        } else {
+            ok = 0;
+        }
+
+        pthread_mutex_lock(&pending_mutex);
+        if (ok) {
+            journal_size += batch.size;
+        } else {
+            // Cut off any partial write and let the next save rewrite the base
+            if (written > 0 && truncate(get_journal_path(), sizeof(JournalHeader) + journal_size) != 0) {
+                handle_error("Error truncating task journal.");
+            }
+            compaction_requested = true;
+            buffer_append(&batch, pending.data, pending.size);
+            buffer_swap(&batch, &pending);
+        }
+        pthread_mutex_unlock(&pending_mutex);
+    }
+    pthread_mutex_unlock(&file_mutex);
+
+    if (!ok) {
+        handle_error("Error writing task journal.");
+    }
+    if (appended != NULL) {
+        *appended = ok && batch.size > 0;
+    }
+    free(batch.data);
+    return ok;
+}
+
+// Start an empty journal for the current base file
+void journal_reset() {
+    struct stat base;
+    if (stat(get_base_path(), &base) != 0) {
+        return;
+    }
+
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", get_journal_path());
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        handle_error("Error: Could not create task journal.");
+        return;
+    }
+
+    JournalHeader header;
+    fill_header(&header, &base);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path, get_journal_path()) != 0) {
+        handle_error("Error: Could not create task journal.");
+        unlink(tmp_path);
+        return;
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    journal_size = 0;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+// Called with a snapshot of the tasks taken: every pending record is covered
+// by the full save that follows, so set them aside until it succeeds.
+void journal_begin_compaction() {
+    pthread_mutex_lock(&pending_mutex);
+    buffer_swap(&compacting, &pending);
+    compaction_requested = false;
+    compaction_running = true;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+void journal_finish_compaction(bool saved) {
+    pthread_mutex_lock(&file_mutex);
+    if (saved) {
+        journal_reset();
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    if (!saved) {
+        // Put the set-aside records back in front of anything newer
+        buffer_append(&compacting, pending.data, pending.size);
+        buffer_swap(&compacting, &pending);
+        compaction_requested = true;
+    }
+    compacting.size = 0;
+    compaction_running = false;
+    pthread_cond_broadcast(&compaction_done);
+    pthread_mutex_unlock(&pending_mutex);
+    pthread_mutex_unlock(&file_mutex);
+}
+
+void journal_wait_for_compaction() {
+    pthread_mutex_lock(&pending_mutex);
+    while (compaction_running) {
+        pthread_cond_wait(&compaction_done, &pending_mutex);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+static int decode_task(const char *payload, uint32_t length, Task *task) {
+    JournalTask encoded;
+    if (length < sizeof(encoded)) {
+        return 0;
+    }
+    memcpy(&encoded, payload, sizeof(encoded));
+    if (encoded.title_len > length || encoded.category_len > length ||
+        length != sizeof(encoded) + encoded.title_len + encoded.category_len ||
+        encoded.recurrence > RECURRENCE_YEARLY) {
+        return 0;
+    }
+
+    const char *p = payload + sizeof(encoded);
+    memset(task, 0, sizeof(*task));
+    task->title = store_text_n(p, encoded.title_len);
+    p += encoded.title_len;
+    task->category = intern_category_n(p, encoded.category_len);
+    task->priority = encoded.priority;
+    task->completed = encoded.completed;
+    task->recurrence = encoded.recurrence;
+    task->due_day = encoded.due_day;
+    return 1;
+}
+
+static int apply_record(const JournalRecord *record, const char *payload, TaskTable *tasks) {
+    Task task;
+    if (record->op != ACTION_DELETE && !decode_task(payload, record->length, &task)) {
+        return 0;
+    }
+    int position = task_position(record->id);
+    task.id = record->id;
+
+    switch (record->op) {
+        case ACTION_ADD:
+            return restore_task(tasks, &task) >= 0;
+        case ACTION_DELETE:
+            if (position < 0 || TASK_IS_DELETED(TASK_AT(tasks, position))) {
+                return 0;
+            }
+            task_for_write(tasks, position)->title = NULL;
+            break;
+        case ACTION_EDIT:
+        case ACTION_COMPLETE:
+            if (position < 0 || TASK_IS_DELETED(TASK_AT(tasks, position))) {
+                return 0;
+            }
+            *task_for_write(tasks, position) = task;
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+// Apply the journal on top of freshly loaded base tasks. A torn or corrupt
+// tail (e.g. from a crash mid-append) is cut off at the last good record.
+void journal_replay(TaskTable *tasks) {
+    char *path = get_journal_path();
+    struct stat base;
+    JournalHeader expected;
+    if (stat(get_base_path(), &base) != 0) {
+        return;
+    }
+    fill_header(&expected, &base);
+
+    FILE *file = fopen(path, "rb");
+    JournalHeader header;
+    bool has_header = file != NULL && fread(&header, sizeof(header), 1, file) == 1;
+    if (!has_header || memcmp(&header, &expected, sizeof(header)) != 0) {
+        // Missing, of another version, or written against an older base that
+        // already includes it
+        if (file != NULL) {
+            fclose(file);
+        }
+        journal_reset();
+        return;
+    }
+
+    size_t good = 0;
+    int replayed = 0;
+    char *payload = NULL;
+    JournalRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.length > JOURNAL_MAX_PAYLOAD) {
+            break;
+        }
+        char *temp = realloc(payload, record.length + 1);
+        if (temp == NULL) {
+            break;
+        }
+        payload = temp;
+        if (fread(payload, 1, record.length, file) != record.length ||
+            record_checksum(&record, payload) != record.checksum ||
+            !apply_record(&record, payload, tasks)) {
+            break;
+        }
+        good += sizeof(record) + record.length;
+        replayed++;
+    }
+    free(payload);
+    fclose(file);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t)st.st_size != sizeof(header) + good) {
+        handle_error("Warning: Discarding a damaged tail of the task journal.");
+        if (truncate(path, sizeof(header) + good) != 0) {
+            handle_error("Error truncating task journal.");
+        }
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    journal_size = good;
+    pthread_mutex_unlock(&pending_mutex);
+
+    if (replayed > 0) {
+        log_message("Replayed task journal.");
+    }
+}
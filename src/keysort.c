@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "todo.h"
+
+// Compound sorts.
+//
+// A sort spec such as "-priority,due,title" is compiled into one 64-bit key
+// per task: each field in turn gets just enough bits, inverted when it sorts
+// descending, so comparing two keys as integers compares the tasks field by
+// field. Titles contribute their first bytes, as many as still fit. The keys
+// are sorted with a stable LSD radix sort, one byte per pass and skipping
+// bytes that are the same in every key, split across threads for large lists.
+// Only when the key could not hold the whole spec (a title, or fields past
+// the 64th bit) are runs of equal keys finished with a comparison sort.
+
+#define RADIX_MIN_PER_THREAD 32768
+#define RADIX_MAX_THREADS 16
+
+static const struct {
+    const char *name;
+    SortField field;
+} sort_field_names[] = {
+    {"priority", SORT_FIELD_PRIORITY},
+    {"due", SORT_FIELD_DUE},
+    {"title", SORT_FIELD_TITLE},
+    {"category", SORT_FIELD_CATEGORY},
+    {"completed", SORT_FIELD_COMPLETED},
+};
+
+// Parse a comma-separated list of field names, each optionally prefixed
+// with '-' for descending order. Returns 1 on success.
+int parse_sort_spec(const char *text, SortSpec *spec) {
+    spec->count = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        while (isspace((unsigned char)*p)) p++;
+        bool descending = *p == '-';
+        if (*p == '-' || *p == '+') p++;
+
+        size_t length = 0;
+        while (isalpha((unsigned char)p[length])) length++;
+        int field = -1;
+        for (size_t i = 0; i < sizeof(sort_field_names) / sizeof(sort_field_names[0]); i++) {
+            if (length == strlen(sort_field_names[i].name) && strncmp(p, sort_field_names[i].name, length) == 0) {
+                field = sort_field_names[i].field;
+            }
+        }
+        if (field < 0 || spec->count == MAX_SORT_KEYS) {
+            return 0;
+        }
+        spec->keys[spec->count].field = field;
+        spec->keys[spec->count].descending = descending;
+        spec->count++;
+
+        p += length;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return 0;
+        }
+    }
+    return spec->count > 0;
+}
+
+// Rank of every category ID when the names are sorted
+static uint32_t *category_ranks = NULL;
+static uint32_t category_rank_count = 0;
+
+static int compare_category_ids(const void *a, const void *b) {
+    return strcmp(category_name(*(const uint32_t *)a), category_name(*(const uint32_t *)b));
+}
+
+static void rank_categories() {
+    uint32_t count = category_count();
+    uint32_t *ids = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t *ranks = realloc(category_ranks, (count + 1) * sizeof(uint32_t));
+    if (ids == NULL || ranks == NULL) {
+        handle_error("Error allocating memory for sorting.");
+        exit(1);
+    }
+    for (uint32_t id = 0; id < count; id++) {
+        ids[id] = id;
+    }
+    qsort(ids, count, sizeof(uint32_t), compare_category_ids);
+    for (uint32_t rank = 0; rank < count; rank++) {
+        ranks[ids[rank]] = rank;
+    }
+    free(ids);
+    category_ranks = ranks;
+    category_rank_count = count;
+}
+
+static int bits_for(uint32_t values) {
+    int bits = 0;
+    while (bits < 32 && (1ULL << bits) < values) bits++;
+    return bits;
+}
+
+// Bits given to a field in the key; titles take whatever is left
+static int field_bits(SortField field) {
+    switch (field) {
+        case SORT_FIELD_PRIORITY:
+            return 8;
+        case SORT_FIELD_DUE:
+            return 32;
+        case SORT_FIELD_CATEGORY:
+            return bits_for(category_rank_count);
+        case SORT_FIELD_COMPLETED:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static uint64_t field_value(const Task *task, SortField field, bool descending, int bits) {
+    uint64_t mask = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+    uint64_t value = 0;
+    switch (field) {
+        case SORT_FIELD_PRIORITY:
+            value = task->priority;
+            break;
+        case SORT_FIELD_DUE:
+            if (task->due_day == NO_DUE_DAY) {
+                return mask;  // Tasks without a due date come last either way
+            }
+            value = (uint32_t)task->due_day ^ 0x80000000u;
+            break;
+        case SORT_FIELD_CATEGORY:
+            value = task->category < category_rank_count ? category_ranks[task->category] : 0;
+            break;
+        case SORT_FIELD_COMPLETED:
+            value = task->completed != 0;
+            break;
+        case SORT_FIELD_TITLE: {
+            // Leading bytes in strcmp order, zero past the end of the title
+            const char *title = task->title;
+            for (int shift = bits - 8; shift >= 0; shift -= 8) {
+                uint8_t c = *title;
+                value |= (uint64_t)c << shift;
+                title += c != '\0';
+            }
+            break;
+        }
+    }
+    return (descending ? ~value : value) & mask;
+}
+
+// How the spec maps onto the key: the first `packed` fields with their
+// widths, and whether that decides every comparison
+typedef struct {
+    int packed;
+    int bits[MAX_SORT_KEYS];
+    bool exact;
+} KeyLayout;
+
+static KeyLayout plan_key(const SortSpec *spec) {
+    KeyLayout layout = {0, {0}, true};
+    int left = 64;
+    for (int i = 0; i < spec->count; i++) {
+        if (spec->keys[i].field == SORT_FIELD_TITLE) {
+            layout.bits[layout.packed++] = left / 8 * 8;
+            layout.exact = false;
+            break;
+        }
+        int bits = field_bits(spec->keys[i].field);
+        if (bits > left) {
+            layout.exact = false;
+            break;
+        }
+        layout.bits[layout.packed++] = bits;
+        left -= bits;
+    }
+    return layout;
+}
+
+static uint64_t make_key(const Task *task, const SortSpec *spec, const KeyLayout *layout) {
+    uint64_t key = 0;
+    int used = 0;
+    for (int i = 0; i < layout->packed; i++) {
+        int bits = layout->bits[i];
+        if (bits == 0) {
+            continue;
+        }
+        uint64_t value = field_value(task, spec->keys[i].field, spec->keys[i].descending, bits);
+        key = bits == 64 ? value : key << bits | value;
+        used += bits;
+    }
+    return used == 0 || used == 64 ? key : key << (64 - used);
+}
+
+typedef struct {
+    uint64_t key;
+    uint32_t position;
+} SortItem;
+
+// Threads are started before it is known how many will be, so each waits
+// here until its range and the barrier are set up
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool ready;
+} RadixStart;
+
+typedef struct {
+    SortItem *items;
+    SortItem *scratch;
+    size_t begin;
+    size_t end;
+    int thread;
+    int threads;
+    const int *passes;
+    int pass_count;
+    size_t (*histograms)[256];  // One per thread
+    pthread_barrier_t *barrier;
+    RadixStart *start;
+} RadixWorker;
+
+// One thread's share of every pass: count its digits, wait for the others,
+// then scatter its items behind those of the threads before it, which keeps
+// the sort stable
+static void *radix_worker(void *arg) {
+    RadixWorker *worker = arg;
+    pthread_mutex_lock(&worker->start->lock);
+    while (!worker->start->ready) {
+        pthread_cond_wait(&worker->start->wakeup, &worker->start->lock);
+    }
+    pthread_mutex_unlock(&worker->start->lock);
+
+    SortItem *source = worker->items;
+    SortItem *dest = worker->scratch;
+
+    for (int p = 0; p < worker->pass_count; p++) {
+        int shift = worker->passes[p] * 8;
+        size_t *histogram = worker->histograms[worker->thread];
+        memset(histogram, 0, 256 * sizeof(size_t));
+        for (size_t i = worker->begin; i < worker->end; i++) {
+            histogram[(source[i].key >> shift) & 0xff]++;
+        }
+        pthread_barrier_wait(worker->barrier);
+
+        size_t offsets[256];
+        size_t total = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (int t = 0; t < worker->threads; t++) {
+                if (t == worker->thread) {
+                    offsets[digit] = total;
+                }
+                total += worker->histograms[t][digit];
+            }
+        }
+        for (size_t i = worker->begin; i < worker->end; i++) {
+            dest[offsets[(source[i].key >> shift) & 0xff]++] = source[i];
+        }
+        pthread_barrier_wait(worker->barrier);
+
+        SortItem *temp = source;
+        source = dest;
+        dest = temp;
+    }
+    return NULL;
+}
+
+// Sort the items by key, stably; returns whichever buffer holds the result
+static SortItem *radix_sort(SortItem *items, SortItem *scratch, size_t count) {
+    // Bytes that are the same in every key do not need a pass
+    uint64_t all_ones = UINT64_MAX, any_ones = 0;
+    for (size_t i = 0; i < count; i++) {
+        all_ones &= items[i].key;
+        any_ones |= items[i].key;
+    }
+    int passes[8];
+    int pass_count = 0;
+    for (int byte = 0; byte < 8; byte++) {
+        if ((((all_ones ^ any_ones) >> (byte * 8)) & 0xff) != 0) {
+            passes[pass_count++] = byte;
+        }
+    }
+    if (pass_count == 0) {
+        return items;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = count / RADIX_MIN_PER_THREAD;
+    if (threads > cpus) threads = cpus;
+    if (threads > RADIX_MAX_THREADS) threads = RADIX_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    size_t histograms[RADIX_MAX_THREADS][256];
+    RadixWorker workers[RADIX_MAX_THREADS];
+    pthread_t ids[RADIX_MAX_THREADS];
+    pthread_barrier_t barrier;
+    RadixStart start = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false};
+
+    // The items are split between the threads that could be started, this
+    // one included, so a failed start only means fewer threads
+    int started = 1;
+    for (int t = 0; t < threads; t++) {
+        workers[t] = (RadixWorker){items, scratch, 0, 0, t, 0, passes, pass_count, histograms, &barrier, &start};
+    }
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&ids[t], NULL, radix_worker, &workers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    pthread_barrier_init(&barrier, NULL, started);
+    for (int t = 0; t < started; t++) {
+        workers[t].begin = count * t / started;
+        workers[t].end = count * (t + 1) / started;
+        workers[t].threads = started;
+    }
+    pthread_mutex_lock(&start.lock);
+    start.ready = true;
+    pthread_cond_broadcast(&start.wakeup);
+    pthread_mutex_unlock(&start.lock);
+
+    radix_worker(&workers[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return pass_count % 2 == 0 ? items : scratch;
+}
+
+// Comparison for runs of equal keys, over the whole spec
+static const TaskTable *compare_tasks;
+static const SortSpec *compare_spec;
+
+static int compare_field(const Task *a, const Task *b, SortField field) {
+    switch (field) {
+        case SORT_FIELD_PRIORITY:
+            return (a->priority > b->priority) - (a->priority < b->priority);
+        case SORT_FIELD_DUE:
+            return (a->due_day > b->due_day) - (a->due_day < b->due_day);
+        case SORT_FIELD_TITLE:
+            return strcmp(a->title, b->title);
+        case SORT_FIELD_CATEGORY:
+            return strcmp(category_name(a->category), category_name(b->category));
+        case SORT_FIELD_COMPLETED:
+            return (a->completed != 0) - (b->completed != 0);
+    }
+    return 0;
+}
+
+static int compare_items(const void *a, const void *b) {
+    const SortItem *itemA = a;
+    const SortItem *itemB = b;
+    const Task *taskA = TASK_AT(compare_tasks, itemA->position);
+    const Task *taskB = TASK_AT(compare_tasks, itemB->position);
+
+    for (int i = 0; i < compare_spec->count; i++) {
+        SortField field = compare_spec->keys[i].field;
+        if (field == SORT_FIELD_DUE && (taskA->due_day == NO_DUE_DAY) != (taskB->due_day == NO_DUE_DAY)) {
+            return taskA->due_day == NO_DUE_DAY ? 1 : -1;  // Last in both directions
+        }
+        int result = compare_field(taskA, taskB, field);
+        if (result != 0) {
+            return compare_spec->keys[i].descending ? -result : result;
+        }
+    }
+    return (itemA->position > itemB->position) - (itemA->position < itemB->position);
+}
+
+// Fill `order` with the positions of the tasks sorted by `spec`, leaving
+// out tombstones, and return how many there are. Tasks that compare equal
+// keep their order in the table.
+int sort_positions(const TaskTable *tasks, const SortSpec *spec, uint32_t *order) {
+    int count = tasks->count;
+    SortItem *items = malloc((count + 1) * sizeof(SortItem));
+    SortItem *scratch = malloc((count + 1) * sizeof(SortItem));
+    if (items == NULL || scratch == NULL) {
+        handle_error("Error allocating memory for sorting.");
+        exit(1);
+    }
+
+    rank_categories();
+    KeyLayout layout = plan_key(spec);
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        items[live].key = make_key(task, spec, &layout);
+        items[live].position = i;
+        live++;
+    }
+    SortItem *sorted = radix_sort(items, scratch, live);
+
+    if (!layout.exact) {
+        compare_tasks = tasks;
+        compare_spec = spec;
+        for (int start = 0; start < live;) {
+            int end = start + 1;
+            while (end < live && sorted[end].key == sorted[start].key) end++;
+            if (end - start > 1) {
+                qsort(sorted + start, end - start, sizeof(SortItem), compare_items);
+            }
+            start = end;
+        }
+    }
+
+    for (int i = 0; i < live; i++) {
+        order[i] = sorted[i].position;
+    }
+    free(items);
+    free(scratch);
+    return live;
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "todo.h"
+
+// Asynchronous log.
+//
+// Logging must never hold up the UI or the loader, so callers only format
+// their message into a slot of a fixed ring buffer and return. The ring is
+// a bounded multi-producer queue: a writer claims a slot by advancing the
+// write counter with a compare-and-swap, fills it and publishes it through
+// the slot's sequence number, so no lock is taken. When the ring is full the
+// message is dropped and counted instead of waiting for room.
+//
+// A background thread, started by the first message, drains the ring every
+// LOG_FLUSH_MS, or sooner when it is filling up, into a buffer and appends
+// it to the log file with one write. The file is opened once and kept open.
+// Dropped messages are reported in the log as a single line once there is
+// room again. Whatever is still in the ring at exit is written by an atexit
+// handler.
+//
+// Messages below the level named by TODO_LOG_LEVEL (debug, info, warning or
+// error; info by default) are discarded before being formatted.
+
+#define LOG_SLOTS 1024          // Power of two
+#define LOG_MESSAGE_LEN 240
+#define LOG_FLUSH_MS 200
+
+typedef struct {
+    uint64_t sequence;          // Slot index when free, index + 1 when filled
+    time_t time;
+    uint8_t level;
+    char message[LOG_MESSAGE_LEN];
+} LogSlot;
+
+static LogSlot slots[LOG_SLOTS];
+static uint64_t write_position;  // Next slot to claim
+static uint64_t read_position;   // Next slot to drain, drain thread only
+static uint64_t dropped;
+
+static LogLevel min_level = LOG_INFO;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static bool running = false;
+
+static pthread_t drainer;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_wakeup;
+static bool stopping = false;
+static int log_fd = -1;
+
+static const char *level_names[] = {"debug", "info", "warning", "error"};
+
+static void write_log(const char *data, size_t length) {
+    // The log directory may not exist before the tasks file is first set up
+    if (log_fd == -1) {
+        char log_path[512];
+        snprintf(log_path, sizeof(log_path), "%s/%s", getenv("HOME"), LOG_FILE_PATH);
+        log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+    for (size_t done = 0; log_fd != -1 && done < length;) {
+        ssize_t n = write(log_fd, data + done, length - done);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        done += n > 0 ? n : 0;
+    }
+}
+
+// Append everything in the ring to the log file, a ring's worth at a time
+static void drain() {
+    static char batch[LOG_SLOTS * (LOG_MESSAGE_LEN + 48)];
+    time_t formatted_time = 0;
+    char time_str[26] = "";
+
+    while (1) {
+        size_t length = 0;
+        int count = 0;
+        for (; count < LOG_SLOTS; count++) {
+            LogSlot *slot = &slots[read_position & (LOG_SLOTS - 1)];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != read_position + 1) {
+                break;
+            }
+            // Timestamps only change once a second, so they are formatted once
+            if (slot->time != formatted_time || time_str[0] == '\0') {
+                formatted_time = slot->time;
+                ctime_r(&formatted_time, time_str);
+                time_str[strlen(time_str) - 1] = '\0';  // Remove newline character
+            }
+            length += snprintf(batch + length, sizeof(batch) - length, "%s [%s] %s\n",
+                               time_str, level_names[slot->level], slot->message);
+            __atomic_store_n(&slot->sequence, read_position + LOG_SLOTS, __ATOMIC_RELEASE);
+            read_position++;
+        }
+
+        uint64_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+        if (lost > 0) {
+            if (time_str[0] == '\0') {
+                formatted_time = time(NULL);
+                ctime_r(&formatted_time, time_str);
+                time_str[strlen(time_str) - 1] = '\0';
+            }
+            length += snprintf(batch + length, sizeof(batch) - length,
+                               "%s [warning] %llu log messages dropped\n", time_str, (unsigned long long)lost);
+        }
+        write_log(batch, length);
+        if (count < LOG_SLOTS) {
+            return;
+        }
+    }
+}
+
+static void *drain_worker(void *arg) {
+    pthread_mutex_lock(&drain_mutex);
+    while (!stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&drain_wakeup, &drain_mutex, &deadline);
+        pthread_mutex_unlock(&drain_mutex);
+        drain();
+        pthread_mutex_lock(&drain_mutex);
+    }
+    pthread_mutex_unlock(&drain_mutex);
+    return NULL;
+}
+
+static void stop_logger() {
+    pthread_mutex_lock(&drain_mutex);
+    stopping = true;
+    pthread_cond_signal(&drain_wakeup);
+    pthread_mutex_unlock(&drain_mutex);
+    pthread_join(drainer, NULL);
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);  // Anything later is written at once
+    drain();
+    if (log_fd != -1) {
+        close(log_fd);
+        log_fd = -1;
+    }
+}
+
+static void start_logger() {
+    for (int i = 0; i < LOG_SLOTS; i++) {
+        slots[i].sequence = i;
+    }
+
+    const char *level = getenv("TODO_LOG_LEVEL");
+    for (int i = 0; level != NULL && i <= LOG_ERROR; i++) {
+        if (strcmp(level, level_names[i]) == 0) {
+            min_level = i;
+        }
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&drain_wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // Without the thread, messages are written as they come
+    if (pthread_create(&drainer, NULL, drain_worker, NULL) == 0) {
+        __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+        atexit(stop_logger);
+    }
+}
+
+void log_at(LogLevel level, const char *format, ...) {
+    pthread_once(&start_once, start_logger);
+    if (level < min_level) {
+        return;
+    }
+
+    // Claim a slot, unless the ring is full
+    uint64_t position = __atomic_load_n(&write_position, __ATOMIC_RELAXED);
+    LogSlot *slot;
+    while (1) {
+        slot = &slots[position & (LOG_SLOTS - 1)];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position) {
+            if (__atomic_compare_exchange_n(&write_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (sequence < position) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            position = __atomic_load_n(&write_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->message, sizeof(slot->message), format, args);
+    va_end(args);
+    slot->time = time(NULL);
+    slot->level = level;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&drain_mutex);
+        drain();
+        pthread_mutex_unlock(&drain_mutex);
+    } else if ((position & (LOG_SLOTS / 2 - 1)) == LOG_SLOTS / 2 - 1) {
+        // Half the ring has filled since the last nudge: drain it early rather
+        // than drop messages in a burst. A missed wakeup only delays the drain.
+        pthread_cond_signal(&drain_wakeup);
+    }
+}
+
+void log_message(const char *message) {
+    log_at(LOG_INFO, "%s", message);
+}
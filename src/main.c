@@ -5,27 +5,16 @@
 #include <pthread.h>
 #include "todo.h"
 
-#define ACTIONS_BEFORE_AUTOSAVE 5
-
-Task *tasks = NULL;          // Dynamic array of tasks
-int task_count = 0;          // Number of tasks
-int task_capacity = 0;       // Capacity of the tasks array
+TaskTable tasks = {0};      // The tasks, including tombstones
 int selected_task = 0;       // Index of the currently selected task
 
 // Booleans to track sort order
 bool priority_ascending = true;  // Start with highest to lowest priority
 bool date_ascending = true;      // Start with closest to latest due date
 
-// Action stack for undo functionality
-Action action_stack[MAX_ACTIONS];
-int action_count = 0;
-
 // Mutex for thread safety
 pthread_mutex_t task_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Counter for autosave
-int action_counter = 0;
-
 // Function to clear input prompt after getting the input
 void get_input_and_clear(char *buffer, int size, const char *prompt) {
     mvprintw(LINES - 2, 0, "%s", prompt);
@@ -34,7 +23,7 @@ void get_input_and_clear(char *buffer, int size, const char *prompt) {
     getnstr(buffer, size - 1);  // Get user input
     noecho();
     buffer[size - 1] = '\0';  // Null-terminate the string
-    clear();  // Clear the entire screen after each input
+    erase();  // Clear the entire screen after each input
     refresh();
 }
 
@@ -49,7 +38,7 @@ void delete_task_interactive() {
         // pthread_mutex_lock(&task_mutex);
 
         // Check if selected_task index is within valid bounds
-        if (selected_task < 0 || selected_task >= task_count) {
+        if (selected_task < 0 || selected_task >= sort_view_count(&tasks)) {
             // pthread_mutex_unlock(&task_mutex);
             mvprintw(LINES - 2, 0, "Error: Invalid task selected. Press any key...");
             refresh();
@@ -57,77 +46,157 @@ void delete_task_interactive() {
             return;
         }
 
-        // Push the action onto the stack before deletion
-        if (action_count < MAX_ACTIONS) {
-            action_stack[action_count].type = ACTION_DELETE;
-            action_stack[action_count].task = tasks[selected_task];
-            action_stack[action_count].index = selected_task;
-            action_count++;
-        }
+        // Record the task for undo before deletion
+        int position = sort_view_position(&tasks, selected_task);
+        undo_record(ACTION_DELETE, TASK_AT(&tasks, position), NULL);
 
-        remove_task(&tasks, &task_count, selected_task);
-        update_task_ids(tasks, task_count);
+        remove_task(&tasks, position);
 
         // Remove the mutex unlock here
         // pthread_mutex_unlock(&task_mutex);
 
-        if (selected_task >= task_count && task_count > 0) {
-            selected_task = task_count - 1;
+        if (selected_task >= sort_view_count(&tasks) && sort_view_count(&tasks) > 0) {
+            selected_task = sort_view_count(&tasks) - 1;
         }
 
         log_message("Task deleted.");
-        action_counter++;
+        request_save();
+    }
+    erase();
+}
+
+// The marked tasks the batch keys act on, taking in an open visual range
+static bool have_marked_tasks() {
+    select_visual_end(&tasks, selected_task);
+    return select_count() > 0;
+}
+
+void delete_marked_interactive() {
+    mvprintw(LINES - 2, 0, "Are you sure you want to delete the %d marked tasks? (y/n): ", select_count());
+    clrtoeol();
+    refresh();
+    int ch = getch();
+
+    if (ch == 'y' || ch == 'Y') {
+        int count = batch_delete(&tasks);
+        log_at(LOG_INFO, "%d marked tasks deleted.", count);
+        request_save();
+    }
+    erase();
+}
 
-        if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-            trigger_save_tasks(tasks, task_count, false);
-            action_counter = 0;
+// Give the marked tasks a new priority, category or both
+void edit_marked_interactive() {
+    char priority_input[3];
+    char category[MAX_CATEGORY_LEN];
+    int priority = 0;
+    int count = select_count();
+
+    mvprintw(LINES - 2, 0, "Set priority of %d marked tasks (1-5, leave blank to keep): ", count);
+    clrtoeol();
+    echo();
+    getnstr(priority_input, sizeof(priority_input) - 1);
+    noecho();
+    if (strlen(priority_input) > 0) {
+        priority = atoi(priority_input);
+        if (priority < 1 || priority > 5) {
+            mvprintw(LINES - 2, 0, "Invalid priority. Press any key...");
+            clrtoeol();
+            refresh();
+            getch();
+            return;
         }
     }
-    clear();
+    get_input_and_clear(category, MAX_CATEGORY_LEN, "Set category of the marked tasks (leave blank to keep): ");
+
+    if (priority != 0 || strlen(category) > 0) {
+        count = batch_edit(&tasks, priority, strlen(category) > 0 ? category : NULL);
+        log_at(LOG_INFO, "%d marked tasks edited.", count);
+        request_save();
+    }
 }
 
-int main() {
-    init_ncurses();
-    
-    load_tasks(&tasks, &task_count, &task_capacity);
+// Mark the tasks matching a query such as "priority>=3 and due<today+7", or
+// a saved view as "@NAME"
+void mark_where_interactive() {
+    char query[MAX_TITLE_LEN];
+    char error[128];
+    get_input_and_clear(query, MAX_TITLE_LEN,
+                        "Mark tasks where (e.g. priority>=3 and due<today+7, or @VIEW): ");
+    if (strlen(query) == 0) {
+        return;
+    }
+    int count = select_where(&tasks, query, error, sizeof(error));
+    if (count < 0) {
+        mvprintw(LINES - 2, 0, "Invalid query: %s. Press any key...", error);
+    } else {
+        mvprintw(LINES - 2, 0, "%d tasks marked. Press any key...", count);
+    }
+    clrtoeol();
+    refresh();
+    getch();
+}
 
-    // Ensure that tasks is initialized
-    if (tasks == NULL) {
-        endwin();  // Cleanup ncurses before exiting
-        fprintf(stderr, "Error: Failed to initialize tasks.\n");
-        exit(1);
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--convert") == 0) {
+        return convert_task_store(argv[2]) ? 0 : 1;
+    } else if (argc > 1) {
+        return run_command(argc - 1, argv + 1, argv[0]);  // Scripted use, without a screen
     }
 
-    display_tasks(tasks, task_count, selected_task);  // Initial display
+    init_ncurses();
+    
+    load_tasks(&tasks);
+
+    display_tasks(&tasks, selected_task);  // Initial display
     int ch;
     
-    while ((ch = getch()) != 'q') {
+    while (1) {
+        // Sleep until a key press or until a task becomes due soon or overdue
+        timeout(due_status_timeout());
+        ch = getch();
+        timeout(-1);
+
+        if (ch == 'q') {
+            break;
+        }
+        if (ch == ERR) {
+            invalidate_due_status();
+            display_tasks(&tasks, selected_task);
+            continue;
+        }
+
         pthread_mutex_lock(&task_mutex);
 
+        // Anything but moving the selection may have drawn over the task list
+        if (ch != 'j' && ch != 'k' && ch != KEY_NPAGE && ch != KEY_PPAGE && ch != 'n' && ch != 'N') {
+            render_invalidate();
+        }
+
         switch (ch) {
             case 'j':
-                if (selected_task < task_count - 1) selected_task++;
+                if (selected_task < sort_view_count(&tasks) - 1) selected_task++;
                 break;
             case 'k':
                 if (selected_task > 0) selected_task--;
                 break;
+            case KEY_NPAGE:
+                selected_task += task_list_height();
+                if (selected_task >= sort_view_count(&tasks)) selected_task = sort_view_count(&tasks) - 1;
+                break;
+            case KEY_PPAGE:
+                selected_task -= task_list_height();
+                if (selected_task < 0) selected_task = 0;
+                break;
             case 'a':
-                add_task(&tasks, &task_count, &task_capacity, "", "", "", RECURRENCE_NONE, 0);
-                update_task_ids(tasks, task_count);
-                action_counter++;
-                if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-                    trigger_save_tasks(tasks, task_count, false);  // Asynchronous save
-                    action_counter = 0;
-                }
+                add_task(&tasks, "", "", NO_DUE_DAY, RECURRENCE_NONE, 0);
+                request_save();
                 break;
             case 'd':
-                if (task_count > 0) {
+                if (have_marked_tasks()) {
+                    delete_marked_interactive();
+                } else if (sort_view_count(&tasks) > 0) {
                     delete_task_interactive();
-                    action_counter++;
-                    if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-                        trigger_save_tasks(tasks, task_count, false);  // Asynchronous save
-                        action_counter = 0;
-                    }
                 } else {
                     mvprintw(LINES - 2, 0, "No tasks to delete. Press any key...");
                     refresh();
@@ -135,70 +204,129 @@ int main() {
                 }
                 break;
             case 'c':
-                if (selected_task >= 0 && selected_task < task_count) {
-                    toggle_task_completion(&tasks[selected_task]);
-                    action_counter++;
-                    if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-                        trigger_save_tasks(tasks, task_count, false);  // Asynchronous save
-                        action_counter = 0;
-                    }
+                if (have_marked_tasks()) {
+                    int count = batch_complete(&tasks);
+                    log_at(LOG_INFO, "Completion status of %d marked tasks toggled.", count);
+                    request_save();
+                } else if (selected_task >= 0 && selected_task < sort_view_count(&tasks)) {
+                    int position = sort_view_position(&tasks, selected_task);
+                    toggle_task_completion(task_for_write(&tasks, position));
+                    selected_task = sort_view_row(&tasks, position);  // A new due date may move it
+                    request_save();
                 }
                 break;
             case 'e':
-                if (selected_task >= 0 && selected_task < task_count) {
-                    edit_task(&tasks[selected_task]);
-                    action_counter++;
-                    if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-                        trigger_save_tasks(tasks, task_count, false);  // Asynchronous save
-                        action_counter = 0;
-                    }
+                if (have_marked_tasks()) {
+                    edit_marked_interactive();
+                } else if (selected_task >= 0 && selected_task < sort_view_count(&tasks)) {
+                    int position = sort_view_position(&tasks, selected_task);
+                    edit_task(task_for_write(&tasks, position));
+                    selected_task = sort_view_row(&tasks, position);  // Follow the task to its new row
+                    request_save();
+                }
+                break;
+            case ' ':  // Mark or unmark the task and move on
+                if (selected_task >= 0 && selected_task < sort_view_count(&tasks)) {
+                    select_toggle(TASK_AT(&tasks, sort_view_position(&tasks, selected_task)));
+                    if (selected_task < sort_view_count(&tasks) - 1) selected_task++;
                 }
                 break;
+            case 'v':  // Start or end a range of marked tasks
+                if (select_visual_active()) {
+                    select_visual_end(&tasks, selected_task);
+                } else if (sort_view_count(&tasks) > 0) {
+                    select_visual_start(selected_task);
+                }
+                break;
+            case 'V':  // Mark tasks by a query
+                mark_where_interactive();
+                break;
+            case 27:  // Esc clears the marks
+                select_clear();
+                break;
             case 's':  // Search functionality
-                search_task(tasks, task_count, &selected_task);
+                search_task(&tasks, &selected_task);
+                break;
+            case '/':  // Filter as you type
+                filter_tasks(&tasks, &selected_task);
+                break;
+            case 'F':  // Show the tasks matching a query
+                view_tasks_where(&tasks, &selected_task);
+                break;
+            case 'A':  // Tasks due this week, by day
+                view_agenda(&tasks, &selected_task);
+                break;
+            case 'n':  // Next search match
+                step_search_match(&tasks, &selected_task, 1);
+                break;
+            case 'N':  // Previous search match
+                step_search_match(&tasks, &selected_task, -1);
                 break;
             case 'P':  // Toggle priority sorting
-                sort_tasks(tasks, task_count, 'p', priority_ascending);
-                update_task_ids(tasks, task_count);
+                sort_tasks(&tasks, 'p', priority_ascending);
                 priority_ascending = !priority_ascending;  // Toggle the boolean
                 selected_task = 0;  // Reset selection to the first task after sorting
                 break;
             case 'S':  // Toggle due date sorting
-                sort_tasks(tasks, task_count, 'd', date_ascending);
-                update_task_ids(tasks, task_count);
+                sort_tasks(&tasks, 'd', date_ascending);
                 date_ascending = !date_ascending;  // Toggle the boolean
                 selected_task = 0;  // Reset selection to the first task after sorting
                 break;
+            case 'O':  // Sort by several fields
+                sort_tasks_by_spec(&tasks);
+                selected_task = 0;
+                break;
             case 'u':
-                undo_last_action(&tasks, &task_count, &task_capacity);
-                update_task_ids(tasks, task_count);
-                action_counter++;
-                if (action_counter >= ACTIONS_BEFORE_AUTOSAVE) {
-                    trigger_save_tasks(tasks, task_count, false);  // Asynchronous save
-                    action_counter = 0;
-                }
+                undo_last_action(&tasks);
+                request_save();
+                break;
+            case 18:  // Ctrl-R redoes what was undone
+                redo_last_action(&tasks);
+                request_save();
                 break;
             case 'h':
                 show_help();
                 break;
+            case KEY_RESIZE:
+                break;  // The next frame is laid out for the new size
+            case 12:  // Ctrl-L repaints the whole terminal
+                clearok(curscr, TRUE);
+                break;
             default:
                 mvprintw(LINES - 2, 0, "Unknown command. Press 'h' for help.");
                 refresh();
                 break;
         }
 
+        // Drop the tombstones of deleted tasks once there are enough of them
+        compact_tasks(&tasks, false);
         pthread_mutex_unlock(&task_mutex);
         
         // Ensure that selected_task is always within bounds
         if (selected_task < 0) selected_task = 0;
-        if (selected_task >= task_count && task_count > 0) selected_task = task_count - 1;
+        if (selected_task >= sort_view_count(&tasks) && sort_view_count(&tasks) > 0) {
+            selected_task = sort_view_count(&tasks) - 1;
+        }
 
-        display_tasks(tasks, task_count, selected_task);
+        display_tasks(&tasks, selected_task);
     }
 
     // Save tasks and clean up before exiting
-    trigger_save_tasks(tasks, task_count, true);  // Synchronous save
+    save_now();  // Synchronous save
+
+    SaveStats stats;
+    get_save_stats(&stats);
+    log_at(LOG_INFO, "Saves: %lld changes, %lld writes (%lld full), %lld failed, %.1f ms writing.",
+           stats.requested, stats.performed, stats.full_saves, stats.failed, stats.write_ms);
     cleanup_ncurses();
-    free(tasks);  // Free dynamically allocated tasks array
+    release_tasks(&tasks);
+    search_index_free();
+    sort_index_free();
+    bitmap_index_free();
+    due_index_free();
+    undo_history_free();
+    select_free();
+    free_task_ids();
+    free_text_store();
     return 0;
 }
@@ -0,0 +1,1003 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "todo.h"
+
+// Task queries.
+//
+// A query such as `due < today+7 and priority >= 3 and category in (ops,
+// infra)` is parsed once into a small tree and compiled into a program: the
+// conditions joined by the top-level `and`s become separate clauses, each a
+// short postfix sequence of instructions over one task. Comparisons are
+// compiled to ranges of integers and sets of IDs, with dates and `today`
+// resolved up front, so running the program never touches text except for
+// title words.
+//
+// Clauses on category, priority, completion and recurrence on their own are
+// answered from the bitmap indexes (bitmap.c), and a due date range from the
+// due-date index (agenda.c) when few tasks fall in it; these give the
+// candidates, and with none of them every task is a candidate. The other
+// clauses are run over the candidates QUERY_BATCH tasks at a time, cheapest
+// first: each clause narrows the batch's list of survivors and the next one
+// only looks at those, so an empty batch stops early and title words are
+// only matched against tasks every cheaper condition let through.
+//
+// Words written next to each other are joined by `and`, and a word that is
+// not part of a condition matches titles containing it, so
+// `priority>=4 category=work open report` works too.
+//
+// Saved views are named queries, kept one per line as NAME<TAB>QUERY in
+// views.txt next to the tasks file. `@NAME` in a query stands for the view's
+// query in parentheses, so `@ops and priority>=3` narrows a view down.
+
+#define MAX_QUERY_NODES 128
+#define MAX_SET_VALUES 64
+#define MAX_QUERY_DEPTH 32
+#define QUERY_BATCH 1024
+#define MAX_VIEW_NAME 32
+#define DUE_INDEX_SHARE 8
+
+typedef enum {
+    OP_PRIORITY,     // low <= priority <= high
+    OP_DUE,          // low <= due day <= high, and there is a due date
+    OP_NO_DUE,
+    OP_COMPLETED,    // completed == low
+    OP_CATEGORY,     // category among sets[low .. low + high)
+    OP_RECURRENCE,   // recurrence among sets[low .. low + high)
+    OP_TITLE,        // title contains text, ignoring case
+    OP_FALSE,
+    OP_AND,
+    OP_OR,
+    OP_NOT
+} QueryOp;
+
+typedef struct {
+    uint8_t op;
+    int low;
+    int high;
+    const char *text;
+    size_t length;
+} Instruction;
+
+typedef struct {
+    int start;      // First instruction of the clause
+    int length;
+    int cost;
+} Clause;
+
+struct Query {
+    Instruction code[MAX_QUERY_NODES];
+    int code_length;
+    Clause clauses[MAX_QUERY_NODES];
+    int clause_count;
+    uint32_t sets[MAX_SET_VALUES];
+    int set_count;
+    char words[MAX_TITLE_LEN * 2];  // Title words, NUL-separated
+    size_t words_length;
+};
+
+// Parse tree: leaves hold an instruction, inner nodes join their children
+typedef struct {
+    uint8_t op;     // OP_AND, OP_OR, OP_NOT or a leaf op
+    int left;
+    int right;
+    Instruction leaf;
+} Node;
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_STRING,
+    TOKEN_OPEN,
+    TOKEN_CLOSE,
+    TOKEN_COMMA,
+    TOKEN_OPERATOR
+} TokenType;
+
+typedef struct {
+    const char *text;      // Query text left to read
+    TokenType type;        // Current token
+    char token[MAX_TITLE_LEN];
+    Node nodes[MAX_QUERY_NODES];
+    int node_count;
+    int depth;
+    Query *query;
+    char *error;
+    size_t error_size;
+    bool failed;
+} Parser;
+
+static int parse_error(Parser *parser, const char *format, const char *detail) {
+    if (!parser->failed) {
+        snprintf(parser->error, parser->error_size, format, detail);
+        parser->failed = true;
+    }
+    return -1;
+}
+
+static bool is_operator_char(char c) {
+    return c == '=' || c == '!' || c == '<' || c == '>' || c == '~';
+}
+
+static void next_token(Parser *parser) {
+    const char *c = parser->text;
+    while (isspace((unsigned char)*c)) {
+        c++;
+    }
+    size_t length = 0;
+    if (*c == '\0') {
+        parser->type = TOKEN_END;
+    } else if (*c == '(' || *c == ')' || *c == ',') {
+        parser->type = *c == '(' ? TOKEN_OPEN : *c == ')' ? TOKEN_CLOSE : TOKEN_COMMA;
+        parser->token[length++] = *c++;
+    } else if (is_operator_char(*c)) {
+        parser->type = TOKEN_OPERATOR;
+        while (is_operator_char(*c) && length < 2) {
+            parser->token[length++] = *c++;
+        }
+    } else if (*c == '"') {
+        parser->type = TOKEN_STRING;
+        for (c++; *c != '\0' && *c != '"'; c++) {
+            if (*c == '\\' && c[1] != '\0') {
+                c++;
+            }
+            if (length < sizeof(parser->token) - 1) {
+                parser->token[length++] = *c;
+            }
+        }
+        if (*c == '"') {
+            c++;
+        }
+    } else {
+        parser->type = TOKEN_WORD;
+        while (*c != '\0' && !isspace((unsigned char)*c) && *c != '(' && *c != ')' && *c != ',' &&
+               *c != '"' && !is_operator_char(*c)) {
+            if (length < sizeof(parser->token) - 1) {
+                parser->token[length++] = *c;
+            }
+            c++;
+        }
+    }
+    parser->token[length] = '\0';
+    parser->text = c;
+}
+
+static bool is_word(const Parser *parser, const char *word) {
+    return parser->type == TOKEN_WORD && strcasecmp(parser->token, word) == 0;
+}
+
+static int new_node(Parser *parser, uint8_t op, int left, int right) {
+    if (parser->node_count == MAX_QUERY_NODES) {
+        return parse_error(parser, "query is too long%s", "");
+    }
+    Node *node = &parser->nodes[parser->node_count];
+    memset(node, 0, sizeof(*node));
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    node->leaf.op = op;
+    return parser->node_count++;
+}
+
+static int leaf(Parser *parser, uint8_t op, int low, int high) {
+    int node = new_node(parser, op, -1, -1);
+    if (node >= 0) {
+        parser->nodes[node].leaf.low = low;
+        parser->nodes[node].leaf.high = high;
+    }
+    return node;
+}
+
+// A leaf matching titles that contain the current token
+static int title_leaf(Parser *parser) {
+    Query *query = parser->query;
+    size_t length = strlen(parser->token);
+    if (length == 0) {
+        return leaf(parser, OP_PRIORITY, INT_MIN, INT_MAX);  // "" is in every title
+    }
+    if (query->words_length + length + 1 > sizeof(query->words)) {
+        return parse_error(parser, "query is too long%s", "");
+    }
+    char *word = query->words + query->words_length;
+    memcpy(word, parser->token, length + 1);
+    query->words_length += length + 1;
+    int node = leaf(parser, OP_TITLE, 0, 0);
+    if (node >= 0) {
+        parser->nodes[node].leaf.text = word;
+        parser->nodes[node].leaf.length = length;
+    }
+    return node;
+}
+
+// Turn `field OP value` into a range [low, high], with != as the negation of =
+static int range_leaf(Parser *parser, uint8_t op, const char *operator, int value) {
+    int node;
+    if (strcmp(operator, "=") == 0 || strcmp(operator, "==") == 0 || strcmp(operator, "!=") == 0) {
+        node = leaf(parser, op, value, value);
+    } else if (strcmp(operator, "<") == 0) {
+        node = value == INT_MIN ? leaf(parser, OP_FALSE, 0, 0) : leaf(parser, op, INT_MIN, value - 1);
+    } else if (strcmp(operator, "<=") == 0) {
+        node = leaf(parser, op, INT_MIN, value);
+    } else if (strcmp(operator, ">") == 0) {
+        node = value == INT_MAX ? leaf(parser, OP_FALSE, 0, 0) : leaf(parser, op, value + 1, INT_MAX);
+    } else if (strcmp(operator, ">=") == 0) {
+        node = leaf(parser, op, value, INT_MAX);
+    } else {
+        return parse_error(parser, "operator '%s' does not fit this field", operator);
+    }
+    if (node >= 0 && strcmp(operator, "!=") == 0) {
+        node = new_node(parser, OP_NOT, node, -1);
+    }
+    return node;
+}
+
+// A due date: YYYY-MM-DD, today, or today+N / today-N days
+static int parse_day(Parser *parser, int *day) {
+    const char *text = parser->token;
+    if (strncasecmp(text, "today", 5) == 0) {
+        char *end;
+        long offset = text[5] == '\0' ? 0 : strtol(text + 5, &end, 10);
+        if (text[5] != '\0' && ((text[5] != '+' && text[5] != '-') || *end != '\0' || offset < -100000 || offset > 100000)) {
+            return parse_error(parser, "invalid date '%s'", text);
+        }
+        *day = today_day() + (int)offset;
+        return 1;
+    }
+    if (!parse_date(text, day)) {
+        return parse_error(parser, "invalid date '%s' (expected YYYY-MM-DD or today+N)", text);
+    }
+    return 1;
+}
+
+// Value of a category or recurrence, as its ID, or -1 if no task has it.
+// Unlike field names and keywords, values are matched exactly, case included.
+static int parse_set_value(Parser *parser, uint8_t op) {
+    if (op == OP_RECURRENCE) {
+        RecurrenceType recurrence;
+        if (!parse_recurrence_name(parser->token, strlen(parser->token), &recurrence)) {
+            return parse_error(parser, "unknown recurrence '%s'", parser->token);
+        }
+        return recurrence;
+    }
+    // Looked up, not interned, so a typo adds no category
+    for (uint32_t id = 0; id < category_count(); id++) {
+        if (strcmp(category_name(id), parser->token) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// `category = NAME`, `category in (A, B)` and the like for recurrence
+static int set_leaf(Parser *parser, uint8_t op, const char *operator) {
+    Query *query = parser->query;
+    int start = query->set_count;
+    bool list = strcasecmp(operator, "in") == 0;
+    if (!list && strcmp(operator, "=") != 0 && strcmp(operator, "==") != 0 && strcmp(operator, "!=") != 0) {
+        return parse_error(parser, "operator '%s' does not fit this field", operator);
+    }
+    if (list) {
+        next_token(parser);
+        if (parser->type != TOKEN_OPEN) {
+            return parse_error(parser, "expected '(' after 'in'%s", "");
+        }
+    }
+    do {
+        next_token(parser);
+        if (parser->type != TOKEN_WORD && parser->type != TOKEN_STRING) {
+            return parse_error(parser, "expected a value, not '%s'", parser->token);
+        }
+        int value = parse_set_value(parser, op);
+        if (parser->failed) {
+            return -1;
+        }
+        if (value >= 0) {
+            if (query->set_count == MAX_SET_VALUES) {
+                return parse_error(parser, "too many values in the query%s", "");
+            }
+            query->sets[query->set_count++] = value;
+        }
+        if (list) {
+            next_token(parser);
+        }
+    } while (list && parser->type == TOKEN_COMMA);
+    if (list && parser->type != TOKEN_CLOSE) {
+        return parse_error(parser, "expected ')' to close the list%s", "");
+    }
+
+    int node = leaf(parser, op, start, query->set_count - start);
+    if (node >= 0 && strcmp(operator, "!=") == 0) {
+        node = new_node(parser, OP_NOT, node, -1);
+    }
+    return node;
+}
+
+// `field OP value`, once the field name has been read
+static int parse_comparison(Parser *parser, const char *field) {
+    char operator[4];
+    next_token(parser);
+    if (parser->type != TOKEN_OPERATOR && !is_word(parser, "in")) {
+        return parse_error(parser, "expected a comparison after '%s'", field);
+    }
+    snprintf(operator, sizeof(operator), "%.3s", parser->token);
+
+    if (strcasecmp(field, "category") == 0 || strcasecmp(field, "recurrence") == 0) {
+        int node = set_leaf(parser, field[0] == 'c' ? OP_CATEGORY : OP_RECURRENCE, operator);
+        next_token(parser);
+        return node;
+    }
+
+    next_token(parser);
+    if (parser->type != TOKEN_WORD && parser->type != TOKEN_STRING) {
+        return parse_error(parser, "expected a value after '%s'", operator);
+    }
+    int node;
+    if (strcasecmp(field, "title") == 0) {
+        if (strcmp(operator, "~") != 0) {
+            return parse_error(parser, "titles are matched with '~', not '%s'", operator);
+        }
+        node = title_leaf(parser);
+    } else if (strcasecmp(field, "priority") == 0) {
+        char *end;
+        long value = strtol(parser->token, &end, 10);
+        if (*end != '\0' || end == parser->token || value < 0 || value > 255) {
+            return parse_error(parser, "invalid priority '%s'", parser->token);
+        }
+        node = range_leaf(parser, OP_PRIORITY, operator, (int)value);
+    } else {  // due
+        int day;
+        if (strcasecmp(parser->token, "none") == 0) {
+            if (strcmp(operator, "=") != 0 && strcmp(operator, "==") != 0 && strcmp(operator, "!=") != 0) {
+                return parse_error(parser, "only = and != compare with '%s'", "none");
+            }
+            node = leaf(parser, OP_NO_DUE, 0, 0);
+            if (node >= 0 && strcmp(operator, "!=") == 0) {
+                node = new_node(parser, OP_NOT, node, -1);
+            }
+        } else if (parse_day(parser, &day) < 0) {
+            return -1;
+        } else {
+            node = range_leaf(parser, OP_DUE, operator, day);
+        }
+    }
+    next_token(parser);
+    return node;
+}
+
+static int parse_or(Parser *parser);
+
+static const char *find_view(const char *name, char *query, size_t size);
+
+// `@NAME`: the query of a saved view, parsed in place as if in parentheses
+static int parse_view(Parser *parser) {
+    char view_query[MAX_TITLE_LEN];
+    if (find_view(parser->token + 1, view_query, sizeof(view_query)) == NULL) {
+        return parse_error(parser, "no saved view named '%s'", parser->token + 1);
+    }
+    if (++parser->depth > MAX_QUERY_DEPTH) {
+        return parse_error(parser, "views name each other in a loop%s", "");
+    }
+    const char *rest = parser->text;
+    parser->text = view_query;
+    next_token(parser);
+    int node = parser->type == TOKEN_END ? leaf(parser, OP_PRIORITY, INT_MIN, INT_MAX) : parse_or(parser);
+    if (node >= 0 && parser->type != TOKEN_END) {
+        node = parse_error(parser, "unexpected '%s' in a saved view", parser->token);
+    }
+    parser->text = rest;
+    parser->depth--;
+    next_token(parser);
+    return node;
+}
+
+static int parse_primary(Parser *parser) {
+    if (parser->type == TOKEN_OPEN) {
+        if (++parser->depth > MAX_QUERY_DEPTH) {
+            return parse_error(parser, "query is nested too deeply%s", "");
+        }
+        next_token(parser);
+        int node = parse_or(parser);
+        if (node < 0) {
+            return -1;
+        }
+        if (parser->type != TOKEN_CLOSE) {
+            return parse_error(parser, "expected ')'%s", "");
+        }
+        parser->depth--;
+        next_token(parser);
+        return node;
+    }
+    if (parser->type == TOKEN_STRING) {
+        int node = title_leaf(parser);
+        next_token(parser);
+        return node;
+    }
+    if (parser->type != TOKEN_WORD) {
+        return parse_error(parser, "unexpected '%s'", parser->type == TOKEN_END ? "end of query" : parser->token);
+    }
+
+    if (parser->token[0] == '@') {
+        return parse_view(parser);
+    }
+
+    static const char *fields[] = {"priority", "due", "category", "recurrence", "title"};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (is_word(parser, fields[i])) {
+            return parse_comparison(parser, fields[i]);
+        }
+    }
+
+    int node;
+    int today = today_day();
+    if (is_word(parser, "done") || is_word(parser, "completed")) {
+        node = leaf(parser, OP_COMPLETED, 1, 1);
+    } else if (is_word(parser, "open") || is_word(parser, "pending")) {
+        node = leaf(parser, OP_COMPLETED, 0, 0);
+    } else if (is_word(parser, "overdue")) {
+        node = leaf(parser, OP_DUE, INT_MIN, today);     // As is_task_overdue
+    } else if (is_word(parser, "soon")) {
+        node = leaf(parser, OP_DUE, today + 1, today + 1);  // As is_task_due_soon
+    } else {
+        node = title_leaf(parser);
+    }
+    next_token(parser);
+    return node;
+}
+
+static int parse_not(Parser *parser) {
+    if (is_word(parser, "not")) {
+        if (++parser->depth > MAX_QUERY_DEPTH) {
+            return parse_error(parser, "query is nested too deeply%s", "");
+        }
+        next_token(parser);
+        int child = parse_not(parser);
+        parser->depth--;
+        return child < 0 ? -1 : new_node(parser, OP_NOT, child, -1);
+    }
+    return parse_primary(parser);
+}
+
+// Terms joined by `and`, or just written one after another
+static int parse_and(Parser *parser) {
+    int node = parse_not(parser);
+    while (node >= 0 && parser->type != TOKEN_END && parser->type != TOKEN_CLOSE && !is_word(parser, "or")) {
+        if (is_word(parser, "and")) {
+            next_token(parser);
+        }
+        int right = parse_not(parser);
+        node = right < 0 ? -1 : new_node(parser, OP_AND, node, right);
+    }
+    return node;
+}
+
+static int parse_or(Parser *parser) {
+    int node = parse_and(parser);
+    while (node >= 0 && is_word(parser, "or")) {
+        next_token(parser);
+        int right = parse_and(parser);
+        node = right < 0 ? -1 : new_node(parser, OP_OR, node, right);
+    }
+    return node;
+}
+
+static int instruction_cost(const Instruction *instruction) {
+    return instruction->op == OP_TITLE ? 16 : 1;
+}
+
+// Append the postfix code of a subtree; returns its cost
+static int emit(Parser *parser, int node) {
+    Query *query = parser->query;
+    const Node *n = &parser->nodes[node];
+    int cost = 0;
+    if (n->left >= 0) {
+        cost += emit(parser, n->left);
+    }
+    if (n->right >= 0) {
+        cost += emit(parser, n->right);
+    }
+    query->code[query->code_length] = n->leaf;
+    query->code[query->code_length].op = n->op;
+    cost += instruction_cost(&query->code[query->code_length]);
+    query->code_length++;
+    return cost;
+}
+
+// Make each operand of the top-level `and`s a clause of its own
+static void add_clauses(Parser *parser, int node) {
+    Query *query = parser->query;
+    if (parser->nodes[node].op == OP_AND) {
+        add_clauses(parser, parser->nodes[node].left);
+        add_clauses(parser, parser->nodes[node].right);
+        return;
+    }
+    Clause *clause = &query->clauses[query->clause_count++];
+    clause->start = query->code_length;
+    clause->cost = emit(parser, node);
+    clause->length = query->code_length - clause->start;
+}
+
+// Fold clauses that each bound the same field, as in `due >= today and
+// due < today+7`, into one range, which the indexes can answer on its own
+static void merge_ranges(Query *query) {
+    int kept = 0;
+    for (int i = 0; i < query->clause_count; i++) {
+        Clause *clause = &query->clauses[i];
+        Instruction *instruction = &query->code[clause->start];
+        bool range = clause->length == 1 && (instruction->op == OP_DUE || instruction->op == OP_PRIORITY);
+        int merged = -1;
+        for (int j = 0; range && j < kept; j++) {
+            Instruction *earlier = &query->code[query->clauses[j].start];
+            if (query->clauses[j].length == 1 && earlier->op == instruction->op) {
+                merged = j;
+            }
+        }
+        if (merged < 0) {
+            query->clauses[kept++] = *clause;
+            continue;
+        }
+        Instruction *earlier = &query->code[query->clauses[merged].start];
+        earlier->low = instruction->low > earlier->low ? instruction->low : earlier->low;
+        earlier->high = instruction->high < earlier->high ? instruction->high : earlier->high;
+        if (earlier->low > earlier->high) {
+            earlier->op = OP_FALSE;
+        }
+    }
+    query->clause_count = kept;
+}
+
+static int compare_clauses(const void *a, const void *b) {
+    const Clause *x = a, *y = b;
+    if (x->cost != y->cost) {
+        return x->cost - y->cost;
+    }
+    return x->start - y->start;
+}
+
+// Parse and compile `text`. Returns NULL with a message in `error` if it is
+// not a valid query.
+Query *compile_query(const char *text, char *error, size_t error_size) {
+    Query *query = calloc(1, sizeof(Query));
+    Parser *parser = calloc(1, sizeof(Parser));
+    if (query == NULL || parser == NULL) {
+        handle_error("Error allocating memory for a query.");
+        exit(1);
+    }
+    parser->text = text;
+    parser->query = query;
+    parser->error = error;
+    parser->error_size = error_size;
+
+    next_token(parser);
+    int root = parser->type == TOKEN_END ? -1 : parse_or(parser);
+    if (!parser->failed && parser->type != TOKEN_END) {
+        parse_error(parser, "unexpected '%s'", parser->token);
+    }
+    if (parser->failed) {
+        free(parser);
+        free(query);
+        return NULL;
+    }
+    if (root >= 0) {
+        add_clauses(parser, root);
+        merge_ranges(query);
+        qsort(query->clauses, query->clause_count, sizeof(Clause), compare_clauses);
+    }
+    free(parser);
+    return query;
+}
+
+void free_query(Query *query) {
+    free(query);
+}
+
+static bool contains_word(const char *text, const char *word, size_t length) {
+    for (; *text != '\0'; text++) {
+        if (strncasecmp(text, word, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool run_instruction(const Query *query, const Instruction *instruction, const Task *task) {
+    switch (instruction->op) {
+        case OP_PRIORITY:
+            return task->priority >= instruction->low && task->priority <= instruction->high;
+        case OP_DUE:
+            return task->due_day != NO_DUE_DAY && task->due_day >= instruction->low && task->due_day <= instruction->high;
+        case OP_NO_DUE:
+            return task->due_day == NO_DUE_DAY;
+        case OP_COMPLETED:
+            return (task->completed != 0) == instruction->low;
+        case OP_CATEGORY:
+        case OP_RECURRENCE: {
+            uint32_t value = instruction->op == OP_CATEGORY ? task->category : task->recurrence;
+            for (int i = 0; i < instruction->high; i++) {
+                if (query->sets[instruction->low + i] == value) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case OP_TITLE:
+            return contains_word(task->title, instruction->text, instruction->length);
+        default:
+            return false;
+    }
+}
+
+// Run a clause over one task with a stack of results
+static bool run_clause(const Query *query, const Clause *clause, const Task *task) {
+    bool stack[MAX_QUERY_NODES];
+    int depth = 0;
+    for (int i = clause->start; i < clause->start + clause->length; i++) {
+        const Instruction *instruction = &query->code[i];
+        switch (instruction->op) {
+            case OP_AND:
+                depth--;
+                stack[depth - 1] = stack[depth - 1] && stack[depth];
+                break;
+            case OP_OR:
+                depth--;
+                stack[depth - 1] = stack[depth - 1] || stack[depth];
+                break;
+            case OP_NOT:
+                stack[depth - 1] = !stack[depth - 1];
+                break;
+            default:
+                stack[depth++] = run_instruction(query, instruction, task);
+                break;
+        }
+    }
+    return stack[0];
+}
+
+// Keep the tasks of a batch that pass the clause; returns how many are left
+static int filter_batch(const Query *query, const Clause *clause, const Task **rows, uint32_t *positions, int count) {
+    int kept = 0;
+    if (clause->length == 1) {
+        const Instruction *instruction = &query->code[clause->start];
+        for (int i = 0; i < count; i++) {
+            if (run_instruction(query, instruction, rows[i])) {
+                rows[kept] = rows[i];
+                positions[kept++] = positions[i];
+            }
+        }
+        return kept;
+    }
+    for (int i = 0; i < count; i++) {
+        if (run_clause(query, clause, rows[i])) {
+            rows[kept] = rows[i];
+            positions[kept++] = positions[i];
+        }
+    }
+    return kept;
+}
+
+// Whether a clause is one condition the bitmap indexes hold, maybe negated
+static const Instruction *indexed_clause(const Query *query, const Clause *clause, bool *negated) {
+    const Instruction *first = &query->code[clause->start];
+    *negated = clause->length == 2 && query->code[clause->start + 1].op == OP_NOT;
+    if (clause->length != 1 && !*negated) {
+        return NULL;
+    }
+    if (first->op == OP_PRIORITY || first->op == OP_COMPLETED || first->op == OP_CATEGORY || first->op == OP_RECURRENCE) {
+        return first;
+    }
+    if (first->op == OP_DUE && !*negated) {
+        return first;
+    }
+    return NULL;
+}
+
+// Slots of the tasks matching an indexed condition: one bitmap, or the OR of
+// those of each value it allows
+static void lookup_instruction(const Query *query, const Instruction *instruction, Bitmap *result) {
+    Bitmap scratch = {0};
+    bitmap_free(result);
+    if (instruction->op == OP_COMPLETED) {
+        bitmap_copy(result, bitmap_index_lookup(BITMAP_COMPLETED, instruction->low));
+        return;
+    }
+    int count = instruction->op == OP_PRIORITY ? 256 : instruction->high;
+    if (instruction->op == OP_PRIORITY && instruction->low <= 0 && instruction->high >= 255) {
+        bitmap_copy(result, bitmap_index_lookup(BITMAP_ALL, 0));
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        const Bitmap *bitmap;
+        if (instruction->op == OP_PRIORITY) {
+            if (i < instruction->low || i > instruction->high) {
+                continue;
+            }
+            bitmap = bitmap_index_lookup(BITMAP_PRIORITY, i);
+        } else {
+            bitmap = bitmap_index_lookup(instruction->op == OP_CATEGORY ? BITMAP_CATEGORY : BITMAP_RECURRENCE,
+                                         query->sets[instruction->low + i]);
+        }
+        if (bitmap->length == 0) {
+            continue;
+        }
+        bitmap_or(&scratch, result, bitmap);
+        Bitmap swap = *result;
+        *result = scratch;
+        scratch = swap;
+    }
+    bitmap_free(&scratch);
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const uint32_t *x = a, *y = b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// Slots of the tasks due in a range, from the due-date index (agenda.c). Only
+// used when at most one task in DUE_INDEX_SHARE is due in it, so that sorting
+// the slots costs less than checking every task; returns false otherwise.
+static bool lookup_due(const TaskTable *tasks, const Instruction *instruction, Bitmap *result) {
+    if (!due_index_ready()) {
+        due_index_build(tasks);
+    }
+    int buckets;
+    const DueBucket *due = due_index_range(instruction->low, instruction->high, &buckets);
+    uint32_t total = 0;
+    for (int i = 0; i < buckets; i++) {
+        total += due[i].count;
+    }
+    if (total > (uint32_t)tasks->count / DUE_INDEX_SHARE) {
+        return false;
+    }
+
+    uint32_t *slots = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+    if (slots == NULL) {
+        handle_error("Error allocating memory for the matching tasks.");
+        exit(1);
+    }
+    uint32_t count = 0;
+    for (int i = 0; i < buckets; i++) {
+        memcpy(slots + count, due[i].slots, due[i].count * sizeof(uint32_t));
+        count += due[i].count;
+    }
+    // In order, each add appends to the end of its container
+    qsort(slots, count, sizeof(uint32_t), compare_rows);
+    bitmap_free(result);
+    for (uint32_t i = 0; i < count; i++) {
+        bitmap_add(result, slots[i]);
+    }
+    free(slots);
+    return true;
+}
+
+// Positions of the tasks matching the query, in the order the list is shown
+// in. Returns their number; the array is the caller's to free.
+int run_query(const TaskTable *tasks, const Query *query, uint32_t **positions) {
+    // The indexed clauses narrow the candidates down first
+    Bitmap candidates = {0}, condition = {0}, scratch = {0};
+    bool indexed = false;
+    bool is_indexed[MAX_QUERY_NODES] = {false};
+    for (int i = 0; i < query->clause_count; i++) {
+        bool negated;
+        const Instruction *instruction = indexed_clause(query, &query->clauses[i], &negated);
+        if (instruction == NULL) {
+            continue;
+        }
+        if (instruction->op == OP_DUE) {
+            if (!lookup_due(tasks, instruction, &condition)) {
+                continue;
+            }
+        } else {
+            if (!bitmap_index_ready()) {
+                bitmap_index_build(tasks);
+            }
+            lookup_instruction(query, instruction, &condition);
+        }
+        if (!indexed) {
+            if (negated) {
+                bitmap_andnot(&candidates, bitmap_index_lookup(BITMAP_ALL, 0), &condition);
+            } else {
+                bitmap_copy(&candidates, &condition);
+            }
+        } else {
+            (negated ? bitmap_andnot : bitmap_and)(&scratch, &candidates, &condition);
+            Bitmap swap = candidates;
+            candidates = scratch;
+            scratch = swap;
+        }
+        indexed = true;
+        is_indexed[i] = true;
+    }
+    bitmap_free(&condition);
+    bitmap_free(&scratch);
+
+    uint32_t total = indexed ? bitmap_count(&candidates) : (uint32_t)tasks->count;
+    uint32_t *slots = NULL;
+    if (indexed) {
+        slots = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+        if (slots == NULL) {
+            handle_error("Error allocating memory for the matching tasks.");
+            exit(1);
+        }
+        bitmap_values(&candidates, slots);
+        bitmap_free(&candidates);
+    }
+
+    // Pairs of row and position, sorted by row at the end
+    uint32_t *pairs = malloc((total > 0 ? total : 1) * 2 * sizeof(uint32_t));
+    if (pairs == NULL) {
+        handle_error("Error allocating memory for the matching tasks.");
+        exit(1);
+    }
+    bool sorted = get_sort_mode() != SORT_NONE;
+    uint32_t matched = 0;
+    const Task *rows[QUERY_BATCH];
+    uint32_t batch_positions[QUERY_BATCH];
+    for (uint32_t first = 0; first < total; first += QUERY_BATCH) {
+        int count = 0;
+        for (uint32_t i = first; i < total && i < first + QUERY_BATCH; i++) {
+            int position = indexed ? task_slot_position(slots[i]) : (int)i;
+            if (position < 0 || TASK_IS_DELETED(TASK_AT(tasks, position))) {
+                continue;
+            }
+            rows[count] = TASK_AT(tasks, position);
+            batch_positions[count++] = position;
+        }
+        for (int i = 0; i < query->clause_count && count > 0; i++) {
+            if (!is_indexed[i]) {
+                count = filter_batch(query, &query->clauses[i], rows, batch_positions, count);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            pairs[2 * matched] = sorted ? (uint32_t)sort_view_row(tasks, batch_positions[i]) : batch_positions[i];
+            pairs[2 * matched + 1] = batch_positions[i];
+            matched++;
+        }
+    }
+    free(slots);
+
+    // Candidates from the bitmaps come in slot order, not position order
+    if (sorted || indexed) {
+        qsort(pairs, matched, 2 * sizeof(uint32_t), compare_rows);
+    }
+    for (uint32_t i = 0; i < matched; i++) {
+        pairs[i] = pairs[2 * i + 1];
+    }
+    *positions = pairs;
+    return matched;
+}
+
+// compile_query and run_query in one. Returns -1 with a message in `error`
+// if the text is not a valid query.
+int tasks_where(const TaskTable *tasks, const char *text, uint32_t **positions, char *error, size_t error_size) {
+    *positions = NULL;
+    Query *query = compile_query(text, error, error_size);
+    if (query == NULL) {
+        return -1;
+    }
+    int count = run_query(tasks, query, positions);
+    free_query(query);
+    return count;
+}
+
+// Saved views
+
+static char *get_views_path() {
+    static char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/%s", getenv("HOME"), VIEWS_FILE_PATH);
+    return file_path;
+}
+
+static bool valid_view_name(const char *name) {
+    size_t length = strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-");
+    return length > 0 && length <= MAX_VIEW_NAME && name[length] == '\0';
+}
+
+// Copy the query of the view `name` to `query`; returns NULL if there is no
+// such view
+static const char *find_view(const char *name, char *query, size_t size) {
+    FILE *file = fopen(get_views_path(), "r");
+    if (file == NULL) {
+        return NULL;
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    const char *found = NULL;
+    size_t length = strlen(name);
+    while (found == NULL && getline(&line, &capacity, file) != -1) {
+        if (strncmp(line, name, length) == 0 && line[length] == '\t') {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(query, size, "%s", line + length + 1);
+            found = query;
+        }
+    }
+    free(line);
+    fclose(file);
+    return found;
+}
+
+// Write every view but `name` to a new views file, then `query` under
+// `name` unless it is NULL, and put the new file in place
+static int rewrite_views(const char *name, const char *query) {
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", get_views_path());
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        return 0;
+    }
+    // Lines are read whole, however long, so no view is split in two
+    FILE *in = fopen(get_views_path(), "r");
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length = strlen(name);
+    while (in != NULL && getline(&line, &capacity, in) != -1) {
+        if (!(strncmp(line, name, length) == 0 && line[length] == '\t')) {
+            fputs(line, out);
+        }
+    }
+    free(line);
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (query != NULL) {
+        fprintf(out, "%s\t%s\n", name, query);
+    }
+    int ok = fflush(out) == 0;
+    ok = fsync(fileno(out)) == 0 && ok;
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path, get_views_path()) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Save `query` as the view `name`, replacing any view of that name. The query
+// must compile. Returns 0 with a message in `error` otherwise.
+int save_view(const char *name, const char *query, char *error, size_t error_size) {
+    if (!valid_view_name(name)) {
+        snprintf(error, error_size, "view names are letters, digits, '_' and '-', up to %d of them", MAX_VIEW_NAME);
+        return 0;
+    }
+    if (strpbrk(query, "\t\r\n") != NULL) {
+        snprintf(error, error_size, "a view's query cannot contain tabs or line breaks");
+        return 0;
+    }
+    // Views are read back into buffers of this size
+    if (strlen(query) >= MAX_TITLE_LEN) {
+        snprintf(error, error_size, "a view's query can be at most %d characters", MAX_TITLE_LEN - 1);
+        return 0;
+    }
+    Query *compiled = compile_query(query, error, error_size);
+    if (compiled == NULL) {
+        return 0;
+    }
+    free_query(compiled);
+    if (!rewrite_views(name, query)) {
+        snprintf(error, error_size, "could not write %s", get_views_path());
+        return 0;
+    }
+    return 1;
+}
+
+// Returns 0 if there is no view `name` or it could not be removed
+int delete_view(const char *name) {
+    char query[MAX_TITLE_LEN];
+    return find_view(name, query, sizeof(query)) != NULL && rewrite_views(name, NULL);
+}
+
+// Write the saved views, one NAME<TAB>QUERY line each
+int list_views(FILE *out) {
+    FILE *file = fopen(get_views_path(), "r");
+    if (file == NULL) {
+        return 1;  // No views saved yet
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, file) != -1) {
+        fputs(line, out);
+    }
+    free(line);
+    fclose(file);
+    return !ferror(out);
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ncurses.h>
+#include "todo.h"
+
+// Row-diffing render layer.
+//
+// display_tasks describes each frame row by row. The text and attributes of
+// every row of the previous frame are kept, and a row is only handed to
+// ncurses when it differs, so moving the selection touches the two rows whose
+// highlight changed plus the footer. With TODO_RENDER_STATS set, the footer
+// also reports how many rows and bytes each frame sent to the terminal.
+
+#define RENDER_ROW_LEN 512
+
+typedef struct {
+    char text[RENDER_ROW_LEN];
+    attr_t attr;
+    bool valid;    // Row on screen is known to match text/attr
+    bool touched;  // Row was drawn in the current frame
+} RenderRow;
+
+static RenderRow *frame = NULL;
+static int frame_rows = 0;
+static int show_stats = -1;  // Read from the environment on first use
+static long long bytes_total = 0;
+static long long bytes_last_frame = 0;
+static int rows_drawn = 0;
+static int rows_last_frame = 0;
+
+// Characters the calling thread has passed to write(2) so far, or -1 if
+// unknown. Counted for this thread alone, so that around refresh() it is
+// what went to the terminal and not what the log and save threads wrote in
+// the meantime. Only read when statistics are shown, since it costs a few
+// syscalls.
+static long long written_chars() {
+    FILE *io = fopen("/proc/thread-self/io", "r");
+    if (io == NULL) {
+        return -1;
+    }
+    char line[64];
+    long long wchar = -1;
+    while (fgets(line, sizeof(line), io) != NULL) {
+        if (sscanf(line, "wchar: %lld", &wchar) == 1) {
+            break;
+        }
+    }
+    fclose(io);
+    return wchar;
+}
+
+void render_cleanup() {
+    free(frame);
+    frame = NULL;
+    frame_rows = 0;
+}
+
+// Forget what is on screen, e.g. after a prompt or the help menu drew over it
+void render_invalidate() {
+    for (int row = 0; row < frame_rows; row++) {
+        frame[row].valid = false;
+    }
+}
+
+void render_begin() {
+    if (frame_rows != LINES) {
+        RenderRow *temp = realloc(frame, LINES * sizeof(RenderRow));
+        if (temp == NULL && LINES > 0) {
+            handle_error("Error allocating memory for the screen.");
+            exit(1);
+        }
+        frame = temp;
+        frame_rows = LINES;
+        render_invalidate();
+    }
+    for (int row = 0; row < frame_rows; row++) {
+        frame[row].touched = false;
+    }
+    rows_drawn = 0;
+    if (show_stats == -1) {
+        show_stats = getenv("TODO_RENDER_STATS") != NULL;
+    }
+}
+
+static void draw_row(int row, attr_t attr, const char *text) {
+    RenderRow *cached = &frame[row];
+    cached->touched = true;
+    if (cached->valid && cached->attr == attr && strcmp(cached->text, text) == 0) {
+        return;  // Unchanged since the last frame
+    }
+
+    move(row, 0);
+    attron(attr);
+    addnstr(text, COLS);
+    attroff(attr);
+    clrtoeol();
+
+    strncpy(cached->text, text, RENDER_ROW_LEN - 1);
+    cached->text[RENDER_ROW_LEN - 1] = '\0';
+    cached->attr = attr;
+    cached->valid = true;
+    rows_drawn++;
+}
+
+void render_row(int row, attr_t attr, const char *format, ...) {
+    if (row < 0 || row >= frame_rows) {
+        return;
+    }
+    char text[RENDER_ROW_LEN];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    draw_row(row, attr, text);
+}
+
+void render_end() {
+    // Blank out rows that were drawn last frame but not in this one
+    for (int row = 0; row < frame_rows; row++) {
+        if (!frame[row].touched && (!frame[row].valid || frame[row].text[0] != '\0' || frame[row].attr != A_NORMAL)) {
+            frame[row].valid = false;
+            draw_row(row, A_NORMAL, "");
+        }
+    }
+
+    long long before = show_stats ? written_chars() : -1;
+    refresh();
+    if (before >= 0) {
+        bytes_last_frame = written_chars() - before;
+        bytes_total += bytes_last_frame;
+    }
+    rows_last_frame = rows_drawn;
+}
+
+// Text for the footer when TODO_RENDER_STATS is set, otherwise empty
+const char *render_stats() {
+    static char stats[96];
+    if (!show_stats) {
+        return "";
+    }
+    snprintf(stats, sizeof(stats), " | last frame: %d rows, %lld bytes, total %lld bytes",
+             rows_last_frame, bytes_last_frame, bytes_total);
+    return stats;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "todo.h"
+
+// Background saves.
+//
+// One worker thread does all autosaving. The UI only reports that something
+// changed; requests are coalesced into a single pending save, so however
+// many arrive while the worker is busy or waiting, one write covers them
+// all, and writes can never overtake each other. The worker waits until
+// ACTIONS_BEFORE_AUTOSAVE changes have piled up or no change has come for
+// SAVE_DEBOUNCE_MS, whichever is first, then appends the journal, or folds
+// it into the base file when it has grown too large.
+//
+// A full save writes a snapshot of the task table (see table.c). The UI
+// thread takes it in request_save as soon as the journal needs folding in,
+// which costs a reference count and no copying, and the worker writes it
+// without taking any lock. Changes made after the snapshot are journaled
+// as usual and appended once the full save is done.
+
+extern TaskTable tasks;
+extern pthread_mutex_t task_mutex;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_changed;
+static pthread_t worker;
+static bool worker_running = false;
+static bool stopping = false;
+static int pending_changes = 0;
+static struct timespec last_request;
+
+static SaveStats stats;
+
+// Tasks for a full save the worker has not started yet
+static TaskTable snapshot;
+static bool snapshot_taken = false;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Count the writes one save made: whether it wrote the base file and how
+// that went, and whether it appended to the journal and how that went
+static void count_writes(bool full, bool full_ok, bool flushed, bool appended, bool flush_ok,
+                         const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_lock(&queue_mutex);
+    stats.performed += (full && full_ok) + appended;
+    stats.full_saves += full && full_ok;
+    stats.failed += (full && !full_ok) + (flushed && !flush_ok);
+    stats.write_ms += elapsed_ms(start, &end);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Write the snapshot if there is one, then append the journal. While the
+// journal needs folding in and there is no snapshot to do it with, the
+// changes stay pending for the next request, or for save_now.
+static void write_changes() {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&queue_mutex);
+    TaskTable table = snapshot;
+    bool full = snapshot_taken;
+    snapshot_taken = false;
+    snapshot = (TaskTable){0};
+    pthread_mutex_unlock(&queue_mutex);
+
+    bool full_ok = false;
+    if (full) {
+        full_ok = save_tasks(&table);
+        journal_finish_compaction(full_ok);
+        release_tasks(&table);
+    }
+    bool flushed = !journal_needs_compaction();
+    bool appended = false, flush_ok = false;
+    if (flushed) {
+        flush_ok = journal_flush(&appended);
+    }
+    count_writes(full, full_ok, flushed, appended, flush_ok, &start);
+}
+
+static void *save_worker(void *arg) {
+    pthread_mutex_lock(&queue_mutex);
+    while (1) {
+        while (pending_changes == 0 && !stopping) {
+            pthread_cond_wait(&queue_changed, &queue_mutex);
+        }
+        // Wait for a quiet spell, unless enough changes have piled up
+        while (!stopping && pending_changes < ACTIONS_BEFORE_AUTOSAVE) {
+            struct timespec deadline = last_request;
+            deadline.tv_sec += SAVE_DEBOUNCE_MS / 1000;
+            deadline.tv_nsec += (SAVE_DEBOUNCE_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&queue_changed, &queue_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (stopping) {
+            break;  // The final save on exit covers whatever is left
+        }
+
+        pending_changes = 0;
+        pthread_mutex_unlock(&queue_mutex);
+        write_changes();
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+static bool start_worker() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue_changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&worker, NULL, save_worker, NULL) != 0) {
+        pthread_cond_destroy(&queue_changed);
+        return false;
+    }
+    worker_running = true;
+    return true;
+}
+
+// Report a change to the tasks; it is saved in the background soon after.
+// Called from the thread that changes the tasks, right after the change.
+void request_save() {
+    pthread_mutex_lock(&queue_mutex);
+    stats.requested++;
+    pending_changes++;
+    if (!snapshot_taken && journal_needs_compaction()) {
+        snapshot = snapshot_tasks(&tasks);
+        snapshot_taken = true;
+        journal_begin_compaction();
+    }
+    if (!worker_running && !start_worker()) {
+        // The change stays pending; the next request or the exit saves it
+        pthread_mutex_unlock(&queue_mutex);
+        handle_error("Error creating thread for saving tasks.");
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &last_request);
+    pthread_cond_signal(&queue_changed);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Stop the worker, dropping any save it has not started yet
+static void stop_worker() {
+    pthread_mutex_lock(&queue_mutex);
+    if (!worker_running) {
+        pthread_mutex_unlock(&queue_mutex);
+        return;
+    }
+    stopping = true;
+    pthread_cond_signal(&queue_changed);
+    pthread_mutex_unlock(&queue_mutex);
+
+    pthread_join(worker, NULL);
+    pthread_cond_destroy(&queue_changed);
+    worker_running = false;
+    stopping = false;
+    pending_changes = 0;
+}
+
+// Save everything now, from the calling thread, e.g. before exiting. Returns
+// whether everything was written.
+int save_now() {
+    struct timespec start;
+    stop_worker();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&task_mutex);
+    if (snapshot_taken) {
+        // Superseded by saving the tasks as they are now
+        release_tasks(&snapshot);
+        snapshot_taken = false;
+        journal_finish_compaction(false);
+    }
+    int ok;
+    bool appended = false;
+    bool full = journal_needs_compaction();
+    if (full) {
+        journal_begin_compaction();
+        ok = save_tasks(&tasks);
+        journal_finish_compaction(ok);
+    } else {
+        ok = journal_flush(&appended);
+    }
+    pthread_mutex_unlock(&task_mutex);
+
+    count_writes(full, ok, !full, appended, ok, &start);
+    return ok;
+}
+
+void get_save_stats(SaveStats *out) {
+    pthread_mutex_lock(&queue_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&queue_mutex);
+}
@@ -0,0 +1,601 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "todo.h"
+
+// Trigram search index.
+//
+// Every task is a document, and every run of three characters in its title or
+// category (ignoring case) maps to a sorted posting list of the documents that
+// contain it. A query looks up the lists for its own trigrams, intersects them
+// starting from the shortest, and checks the few remaining candidates with a
+// substring match, so the cost follows the number of likely hits rather than
+// the number of tasks. Queries shorter than three characters have no trigram
+// and fall back to checking every task.
+//
+// Document numbers only ever grow, which keeps the posting lists sorted by
+// appending. Documents hold the stable ID of their task and doc_of maps task
+// slots back to documents, so nothing here moves when tasks are deleted or
+// the task table is compacted. Editing a task's text retires its document
+// and adds a new one; retired documents are skipped by queries and dropped
+// by rebuilding the index once they outnumber live ones.
+
+#define NO_TASK 0
+#define MIN_REBUILD_DOCS 1024
+
+// Sixteen bytes handled as one value; GCC and Clang lower the operations on
+// it to SSE2 or NEON instructions, or to plain integer code elsewhere
+typedef uint8_t ByteVector __attribute__((vector_size(16)));
+
+typedef struct {
+    uint32_t trigram;  // 0 marks an empty slot
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *docs;
+} Posting;
+
+typedef struct {
+    const char *title;
+    uint32_t category;
+    int id;  // NO_TASK once the task is gone or was edited
+} Doc;
+
+static Posting *postings = NULL;
+static uint32_t posting_slots = 0;
+static uint32_t posting_count = 0;
+
+static Doc *docs = NULL;
+static uint32_t doc_count = 0;
+static uint32_t doc_capacity = 0;
+static uint32_t dead_docs = 0;
+
+static uint32_t *doc_of = NULL;  // Document of the task in each slot
+static uint32_t slot_capacity = 0;
+
+static bool index_built = false;
+
+// Result of the last query, best match first
+static uint32_t *matches = NULL;
+static int match_count = 0;
+static int current_match = 0;
+
+static void *grow_array(void *array, uint32_t *capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    uint32_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *temp = realloc(array, new_capacity * size);
+    if (temp == NULL) {
+        handle_error("Error allocating memory for the search index.");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return temp;
+}
+
+// ASCII lower case; cheaper than tolower, and the same in the C locale
+static inline uint8_t fold(char c) {
+    uint8_t byte = (uint8_t)c;
+    return (uint8_t)(byte - 'A') < 26 ? byte | 0x20 : byte;
+}
+
+static uint32_t trigram_at(const char *p) {
+    return (uint32_t)fold(p[0]) << 16 | (uint32_t)fold(p[1]) << 8 | fold(p[2]);
+}
+
+static uint32_t trigram_slot(uint32_t trigram, uint32_t slots) {
+    return (trigram * 2654435761u) & (slots - 1);
+}
+
+static Posting *find_posting(uint32_t trigram) {
+    if (posting_slots == 0) {
+        return NULL;
+    }
+    uint32_t slot = trigram_slot(trigram, posting_slots);
+    while (postings[slot].trigram != 0) {
+        if (postings[slot].trigram == trigram) {
+            return &postings[slot];
+        }
+        slot = (slot + 1) & (posting_slots - 1);
+    }
+    return NULL;
+}
+
+static void grow_postings() {
+    uint32_t slots = posting_slots ? posting_slots * 2 : 4096;
+    Posting *table = calloc(slots, sizeof(Posting));
+    if (table == NULL) {
+        handle_error("Error allocating memory for the search index.");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < posting_slots; i++) {
+        if (postings[i].trigram != 0) {
+            uint32_t slot = trigram_slot(postings[i].trigram, slots);
+            while (table[slot].trigram != 0) {
+                slot = (slot + 1) & (slots - 1);
+            }
+            table[slot] = postings[i];
+        }
+    }
+    free(postings);
+    postings = table;
+    posting_slots = slots;
+}
+
+static void index_text(uint32_t doc, const char *text) {
+    size_t length = strlen(text);
+    for (size_t i = 0; i + 3 <= length; i++) {
+        uint32_t trigram = trigram_at(text + i);
+        Posting *posting = find_posting(trigram);
+        if (posting == NULL) {
+            if ((posting_count + 1) * 2 > posting_slots) {
+                grow_postings();
+            }
+            uint32_t slot = trigram_slot(trigram, posting_slots);
+            while (postings[slot].trigram != 0) {
+                slot = (slot + 1) & (posting_slots - 1);
+            }
+            posting = &postings[slot];
+            posting->trigram = trigram;
+            posting_count++;
+        } else if (posting->docs[posting->count - 1] == doc) {
+            continue;  // Trigram occurs more than once in this task
+        }
+        posting->docs = grow_array(posting->docs, &posting->capacity, posting->count + 1, sizeof(uint32_t));
+        posting->docs[posting->count++] = doc;
+    }
+}
+
+static void add_doc(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    docs = grow_array(docs, &doc_capacity, doc_count + 1, sizeof(Doc));
+    doc_of = grow_array(doc_of, &slot_capacity, slot + 1, sizeof(uint32_t));
+    uint32_t doc = doc_count++;
+    docs[doc].title = task->title;
+    docs[doc].category = task->category;
+    docs[doc].id = task->id;
+    doc_of[slot] = doc;
+    index_text(doc, task->title);
+    index_text(doc, category_name(task->category));
+}
+
+// Live document of a task, or UINT32_MAX
+static uint32_t find_doc(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    if (slot >= slot_capacity || doc_of[slot] >= doc_count || docs[doc_of[slot]].id != task->id) {
+        return UINT32_MAX;
+    }
+    return doc_of[slot];
+}
+
+static void reset_index() {
+    for (uint32_t i = 0; i < posting_slots; i++) {
+        free(postings[i].docs);
+    }
+    free(postings);
+    postings = NULL;
+    posting_slots = 0;
+    posting_count = 0;
+    doc_count = 0;
+    dead_docs = 0;
+    match_count = 0;
+    current_match = 0;
+}
+
+// Index every task from scratch. Until this is first called the other
+// updates are ignored, so the index costs nothing unless search is used.
+void search_index_build(const TaskTable *tasks) {
+    reset_index();
+    for (int i = 0; i < tasks->count; i++) {
+        if (!TASK_IS_DELETED(TASK_AT(tasks, i))) {
+            add_doc(TASK_AT(tasks, i));
+        }
+    }
+    index_built = true;
+}
+
+bool search_index_ready() {
+    return index_built;
+}
+
+// Drop retired documents by indexing the live ones again
+static void compact_index() {
+    uint32_t live_count = 0;
+    Doc *live = malloc((doc_count - dead_docs + 1) * sizeof(Doc));
+    if (live == NULL) {
+        handle_error("Error allocating memory for the search index.");
+        exit(1);
+    }
+    for (uint32_t doc = 0; doc < doc_count; doc++) {
+        if (docs[doc].id != NO_TASK) {
+            live[live_count++] = docs[doc];
+        }
+    }
+    reset_index();
+    for (uint32_t i = 0; i < live_count; i++) {
+        Task task = {0};
+        task.id = live[i].id;
+        task.title = live[i].title;
+        task.category = live[i].category;
+        add_doc(&task);
+    }
+    free(live);
+}
+
+// A task was added, or put back after a delete
+void search_index_insert(const Task *task) {
+    if (!index_built) {
+        return;
+    }
+    add_doc(task);
+}
+
+// A task was deleted
+void search_index_remove(const Task *task) {
+    uint32_t doc = index_built ? find_doc(task) : UINT32_MAX;
+    if (doc == UINT32_MAX) {
+        return;
+    }
+    docs[doc].id = NO_TASK;
+    dead_docs++;
+}
+
+// A task may have a new title or category
+void search_index_update(const Task *task) {
+    uint32_t doc = index_built ? find_doc(task) : UINT32_MAX;
+    if (doc == UINT32_MAX) {
+        return;
+    }
+    if (docs[doc].title == task->title && docs[doc].category == task->category) {
+        return;  // Text is immutable, so the same pointers mean the same text
+    }
+    docs[doc].id = NO_TASK;
+    dead_docs++;
+    add_doc(task);
+}
+
+static inline bool matches_at(const char *text, const char *query, size_t query_len) {
+    for (size_t i = 0; i < query_len; i++) {
+        if (fold(text[i]) != fold(query[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Case-insensitive substring search; returns the offset of the first match
+// or -1. Sixteen start offsets are screened at a time by comparing the first
+// two query characters with ASCII case folded out (c | 0x20), which can let
+// through a few non-letters but never drops a match, and only the offsets
+// that pass are compared in full. The last block is copied into a zeroed
+// buffer so that no load reads past the end of the text.
+static long find_text(const char *text, const char *query, size_t query_len) {
+    if (query_len == 0) {
+        return 0;
+    }
+    size_t length = strlen(text);
+    if (length < query_len) {
+        return -1;
+    }
+    size_t last = length - query_len;  // Last offset a match can start at
+    size_t step = query_len > 1;       // Offset of the second compared character
+
+    ByteVector first = (ByteVector){0} + (uint8_t)(query[0] | 0x20);
+    ByteVector second = (ByteVector){0} + (uint8_t)(query[step] | 0x20);
+    for (size_t i = 0; i <= last; i += sizeof(ByteVector)) {
+        ByteVector here, next;
+        if (i + sizeof(ByteVector) + 1 <= length) {
+            memcpy(&here, text + i, sizeof(here));
+            memcpy(&next, text + i + step, sizeof(next));
+        } else {
+            char tail[2 * sizeof(ByteVector)] = {0};
+            memcpy(tail, text + i, length - i);
+            memcpy(&here, tail, sizeof(here));
+            memcpy(&next, tail + step, sizeof(next));
+        }
+        ByteVector hits = (ByteVector)(((here | 0x20) == first) & ((next | 0x20) == second));
+
+        uint64_t words[2];
+        memcpy(words, &hits, sizeof(words));
+        if ((words[0] | words[1]) == 0) {
+            continue;
+        }
+        for (size_t k = 0; k < sizeof(ByteVector) && i + k <= last; k++) {
+            if (hits[k] && matches_at(text + i + k, query, query_len)) {
+                return i + k;
+            }
+        }
+    }
+    return -1;
+}
+
+// Lower is better: title prefix, then a word in the title, then anywhere in
+// the title, then the category only. -1 means no match.
+static int match_rank(const Doc *doc, const char *query, size_t query_len) {
+    long at = find_text(doc->title, query, query_len);
+    if (at == 0) {
+        return 0;
+    }
+    if (at > 0) {
+        return isalnum((unsigned char)doc->title[at - 1]) ? 2 : 1;
+    }
+    return find_text(category_name(doc->category), query, query_len) >= 0 ? 3 : -1;
+}
+
+static bool posting_contains(const Posting *posting, uint32_t doc) {
+    uint32_t low = 0, high = posting->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (posting->docs[mid] < doc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < posting->count && posting->docs[low] == doc;
+}
+
+typedef struct {
+    uint32_t doc;
+    uint32_t position;
+    int rank;
+} Match;
+
+static int compare_matches(const void *a, const void *b) {
+    const Match *matchA = a;
+    const Match *matchB = b;
+    if (matchA->rank != matchB->rank) {
+        return matchA->rank - matchB->rank;
+    }
+    return (matchA->position > matchB->position) - (matchA->position < matchB->position);
+}
+
+static void add_match(Match **found, uint32_t *found_capacity, int *found_count, uint32_t doc,
+                      const char *query, size_t query_len) {
+    if (docs[doc].id == NO_TASK) {
+        return;
+    }
+    int rank = match_rank(&docs[doc], query, query_len);
+    if (rank < 0) {
+        return;
+    }
+    *found = grow_array(*found, found_capacity, *found_count + 1, sizeof(Match));
+    (*found)[*found_count].doc = doc;
+    (*found)[*found_count].position = task_position(docs[doc].id);
+    (*found)[*found_count].rank = rank;
+    (*found_count)++;
+}
+
+// Find the tasks whose title or category contains `query`, ignoring case,
+// and make them the current matches. Returns the number of matches.
+int search_index_query(const char *query) {
+    if (!index_built) {
+        return 0;
+    }
+    if (dead_docs > MIN_REBUILD_DOCS && dead_docs > doc_count - dead_docs) {
+        compact_index();
+    }
+
+    size_t query_len = strlen(query);
+    Match *found = NULL;
+    uint32_t found_capacity = 0;
+    int found_count = 0;
+
+    if (query_len < 3) {
+        for (uint32_t doc = 0; doc < doc_count; doc++) {
+            add_match(&found, &found_capacity, &found_count, doc, query, query_len);
+        }
+    } else {
+        // Intersect the posting lists, walking the shortest one
+        size_t trigram_count = query_len - 2;
+        Posting **lists = malloc(trigram_count * sizeof(Posting *));
+        if (lists == NULL) {
+            handle_error("Error allocating memory for the search index.");
+            exit(1);
+        }
+        size_t shortest = 0;
+        bool missing = false;
+        for (size_t i = 0; i < trigram_count && !missing; i++) {
+            lists[i] = find_posting(trigram_at(query + i));
+            if (lists[i] == NULL) {
+                missing = true;  // Some trigram occurs nowhere, so nothing matches
+            } else if (lists[i]->count < lists[shortest]->count) {
+                shortest = i;
+            }
+        }
+        for (uint32_t j = 0; !missing && j < lists[shortest]->count; j++) {
+            uint32_t doc = lists[shortest]->docs[j];
+            bool candidate = true;
+            for (size_t i = 0; i < trigram_count && candidate; i++) {
+                candidate = i == shortest || posting_contains(lists[i], doc);
+            }
+            if (candidate) {
+                add_match(&found, &found_capacity, &found_count, doc, query, query_len);
+            }
+        }
+        free(lists);
+    }
+
+    qsort(found, found_count, sizeof(Match), compare_matches);
+    free(matches);
+    matches = malloc((found_count + 1) * sizeof(uint32_t));
+    if (matches == NULL) {
+        handle_error("Error allocating memory for the search index.");
+        exit(1);
+    }
+    for (int i = 0; i < found_count; i++) {
+        matches[i] = found[i].doc;
+    }
+    free(found);
+    match_count = found_count;
+    current_match = 0;
+    return match_count;
+}
+
+// Move `step` matches forwards or backwards from the current one (wrapping
+// around) and return its position, skipping tasks deleted or edited since the
+// query. Returns -1 if no match is left.
+int search_match(int step) {
+    int direction = step < 0 ? -1 : 1;
+    for (int tries = 0; tries < match_count; tries++) {
+        current_match = ((current_match + step) % match_count + match_count) % match_count;
+        int id = docs[matches[current_match]].id;
+        if (id != NO_TASK) {
+            return task_position(id);
+        }
+        step = direction;
+    }
+    return -1;
+}
+
+void search_clear() {
+    match_count = 0;
+    current_match = 0;
+}
+
+// Text for the footer while there are matches to step through
+const char *search_status() {
+    static char status[48];
+    if (match_count == 0) {
+        return "";
+    }
+    snprintf(status, sizeof(status), " | Match %d of %d", current_match + 1, match_count);
+    return status;
+}
+
+// Live filter.
+//
+// While the filter text is typed, the result for every prefix of it is kept.
+// Anything matching the longer text also matches the shorter one, so each
+// keystroke only rechecks the tasks left by the previous one, and backspace
+// just steps back to the cached result. The result of the empty filter is
+// every task, in the order given to search_filter_begin, and is not stored;
+// the results keep that order.
+
+typedef struct {
+    uint32_t *positions;
+    int count;
+} FilterLevel;
+
+static FilterLevel filter_levels[MAX_TITLE_LEN];
+static char filter_text[MAX_TITLE_LEN];
+static int filter_length = 0;
+static int filter_total = 0;
+static uint32_t *filter_order = NULL;  // Positions of all tasks, NULL for 0..n-1
+
+// Start filtering `count` tasks, shown in `order` (which the filter takes
+// over and frees) or in array order when that is NULL
+void search_filter_begin(int count, uint32_t *order) {
+    filter_length = 0;
+    filter_text[0] = '\0';
+    filter_total = count;
+    free(filter_order);
+    filter_order = order;
+}
+
+// Add a character to the filter text; returns the number of tasks left
+int search_filter_push(const TaskTable *tasks, char c) {
+    if (filter_length >= MAX_TITLE_LEN - 1) {
+        int count;
+        search_filter_view(&count);
+        return count;
+    }
+    filter_text[filter_length] = c;
+    filter_text[filter_length + 1] = '\0';
+    size_t query_len = filter_length + 1;
+
+    FilterLevel *previous = &filter_levels[filter_length];
+    int candidates = filter_length == 0 ? filter_total : previous->count;
+    uint32_t *positions = malloc((candidates + 1) * sizeof(uint32_t));
+    if (positions == NULL) {
+        handle_error("Error allocating memory for the search filter.");
+        exit(1);
+    }
+
+    // Each category is only checked once, however many tasks share it
+    uint32_t categories = category_count();
+    int8_t *category_matches = malloc(categories + 1);
+    if (category_matches == NULL) {
+        handle_error("Error allocating memory for the search filter.");
+        exit(1);
+    }
+    memset(category_matches, -1, categories + 1);
+
+    int count = 0;
+    for (int i = 0; i < candidates; i++) {
+        uint32_t position = filter_length > 0 ? previous->positions[i] :
+                            filter_order != NULL ? filter_order[i] : (uint32_t)i;
+        const Task *task = TASK_AT(tasks, position);
+        bool match = find_text(task->title, filter_text, query_len) >= 0;
+        if (!match && task->category < categories) {
+            if (category_matches[task->category] < 0) {
+                category_matches[task->category] = find_text(category_name(task->category), filter_text, query_len) >= 0;
+            }
+            match = category_matches[task->category];
+        }
+        if (match) {
+            positions[count++] = position;
+        }
+    }
+    free(category_matches);
+
+    filter_length++;
+    filter_levels[filter_length].positions = positions;
+    filter_levels[filter_length].count = count;
+    return count;
+}
+
+// Drop the last character again; returns the number of tasks left
+int search_filter_pop() {
+    if (filter_length > 0) {
+        free(filter_levels[filter_length].positions);
+        filter_levels[filter_length].positions = NULL;
+        filter_length--;
+        filter_text[filter_length] = '\0';
+    }
+    return filter_length == 0 ? filter_total : filter_levels[filter_length].count;
+}
+
+const char *search_filter_text() {
+    return filter_text;
+}
+
+// Positions of the tasks that pass the filter, or NULL when every task does
+// and they are shown in array order
+const uint32_t *search_filter_view(int *count) {
+    if (filter_length == 0) {
+        if (count != NULL) {
+            *count = filter_total;
+        }
+        return filter_order;
+    }
+    if (count != NULL) {
+        *count = filter_levels[filter_length].count;
+    }
+    return filter_levels[filter_length].positions;
+}
+
+void search_filter_end() {
+    while (filter_length > 0) {
+        search_filter_pop();
+    }
+    free(filter_order);
+    filter_order = NULL;
+}
+
+void search_index_free() {
+    reset_index();
+    free(docs);
+    docs = NULL;
+    doc_capacity = 0;
+    free(doc_of);
+    doc_of = NULL;
+    slot_capacity = 0;
+    free(matches);
+    matches = NULL;
+    index_built = false;
+}
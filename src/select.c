@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Multi-select.
+//
+// The selection is a bitmap over task slots (see slots.c) rather than
+// positions, so it stays put while the task table is compacted or the list
+// is sorted. remove_task clears a task's bit, so a freed slot handed to a new
+// task is never selected by accident.
+//
+// Tasks are selected one at a time, as a visual range of rows from an anchor
+// to the cursor, or by a query over their fields (see query.c). The batch
+// operations then change every selected task in one pass over the bitmap.
+// Their changes make one undo step, and the caller reports them with a
+// single request_save and a single log message, so a batch of any size
+// costs one save. Deleted tasks are left as tombstones, which the next
+// compact_tasks drops in one go.
+
+static uint64_t *bits = NULL;
+static uint32_t bit_words = 0;
+static int selected = 0;
+
+static int visual_anchor = -1;   // First row of the visual range, or -1
+
+static void set_bit(uint32_t slot, bool on) {
+    uint32_t word = slot / 64;
+    if (word >= bit_words) {
+        if (!on) {
+            return;
+        }
+        uint32_t words = bit_words ? bit_words : 64;
+        while (words <= word) {
+            words *= 2;
+        }
+        uint64_t *temp = realloc(bits, words * sizeof(uint64_t));
+        if (temp == NULL) {
+            handle_error("Error allocating memory for the selection.");
+            exit(1);
+        }
+        memset(temp + bit_words, 0, (words - bit_words) * sizeof(uint64_t));
+        bits = temp;
+        bit_words = words;
+    }
+    uint64_t mask = 1ull << (slot % 64);
+    if (on && !(bits[word] & mask)) {
+        bits[word] |= mask;
+        selected++;
+    } else if (!on && (bits[word] & mask)) {
+        bits[word] &= ~mask;
+        selected--;
+    }
+}
+
+bool is_task_selected(const Task *task) {
+    uint32_t slot = task_id_slot(task->id);
+    return slot / 64 < bit_words && (bits[slot / 64] >> (slot % 64) & 1);
+}
+
+void select_task(const Task *task, bool on) {
+    uint32_t slot = task_id_slot(task->id);
+    if (slot != UINT32_MAX) {
+        set_bit(slot, on);
+    }
+}
+
+void select_toggle(const Task *task) {
+    select_task(task, !is_task_selected(task));
+}
+
+int select_count() {
+    return selected;
+}
+
+void select_clear() {
+    if (bits != NULL) {
+        memset(bits, 0, bit_words * sizeof(uint64_t));
+    }
+    selected = 0;
+    visual_anchor = -1;
+}
+
+// Visual ranges, in rows of the sorted list
+void select_visual_start(int row) {
+    visual_anchor = row;
+}
+
+bool select_visual_active() {
+    return visual_anchor >= 0;
+}
+
+// Whether `row` lies in the visual range that ends at the cursor
+bool select_visual_covers(int row, int cursor) {
+    if (visual_anchor < 0) {
+        return false;
+    }
+    int first = visual_anchor < cursor ? visual_anchor : cursor;
+    int last = visual_anchor < cursor ? cursor : visual_anchor;
+    return row >= first && row <= last;
+}
+
+// Add the visual range ending at the cursor to the selection
+void select_visual_end(const TaskTable *tasks, int cursor) {
+    if (visual_anchor < 0) {
+        return;
+    }
+    int count = sort_view_count(tasks);
+    int first = visual_anchor < cursor ? visual_anchor : cursor;
+    int last = visual_anchor < cursor ? cursor : visual_anchor;
+    for (int row = first; row <= last && row < count; row++) {
+        select_task(TASK_AT(tasks, sort_view_position(tasks, row)), true);
+    }
+    visual_anchor = -1;
+}
+
+// Mark every task matching the query `text` (see query.c). Returns the
+// number of tasks it marked, or -1 with a message in `error` if the text is
+// not a valid query.
+int select_where(const TaskTable *tasks, const char *text, char *error, size_t error_size) {
+    uint32_t *positions;
+    int count = tasks_where(tasks, text, &positions, error, error_size);
+    int before = selected;
+    for (int i = 0; i < count; i++) {
+        select_task(TASK_AT(tasks, positions[i]), true);
+    }
+    free(positions);
+    return count < 0 ? -1 : selected - before;
+}
+
+// Positions of the selected tasks, in slot order. The array is the caller's
+// to free.
+static int selected_positions(int **positions) {
+    *positions = malloc((selected > 0 ? selected : 1) * sizeof(int));
+    if (*positions == NULL) {
+        handle_error("Error allocating memory for the selection.");
+        exit(1);
+    }
+    int count = 0;
+    for (uint32_t word = 0; word < bit_words; word++) {
+        for (uint64_t w = bits[word]; w != 0; w &= w - 1) {
+            int position = task_slot_position(word * 64 + __builtin_ctzll(w));
+            if (position >= 0) {
+                (*positions)[count++] = position;
+            }
+        }
+    }
+    return count;
+}
+
+// Mark every selected task done, or not done when all of them already are.
+// Returns the number of tasks changed.
+int batch_complete(TaskTable *tasks) {
+    int *positions;
+    int count = selected_positions(&positions);
+    bool all_done = true;
+    for (int i = 0; i < count; i++) {
+        all_done = all_done && TASK_AT(tasks, positions[i])->completed;
+    }
+
+    int changed = 0;
+    undo_begin_group();
+    for (int i = 0; i < count; i++) {
+        if (TASK_AT(tasks, positions[i])->completed == all_done) {
+            flip_task_completion(task_for_write(tasks, positions[i]));
+            changed++;
+        }
+    }
+    undo_end_group();
+    free(positions);
+    select_clear();
+    return changed;
+}
+
+// Delete every selected task. Returns the number deleted.
+int batch_delete(TaskTable *tasks) {
+    int *positions;
+    int count = selected_positions(&positions);
+    undo_begin_group();
+    for (int i = 0; i < count; i++) {
+        undo_record(ACTION_DELETE, TASK_AT(tasks, positions[i]), NULL);
+        remove_task(tasks, positions[i]);
+    }
+    undo_end_group();
+    free(positions);
+    select_clear();
+    return count;
+}
+
+// Give every selected task a new priority (unless 0) and category (unless
+// NULL). Returns the number of tasks changed.
+int batch_edit(TaskTable *tasks, int priority, const char *category) {
+    int *positions;
+    int count = selected_positions(&positions);
+    uint32_t category_id = category != NULL ? intern_category(category) : 0;
+
+    int changed = 0;
+    undo_begin_group();
+    for (int i = 0; i < count; i++) {
+        Task before = *TASK_AT(tasks, positions[i]);
+        Task *task = task_for_write(tasks, positions[i]);
+        if (priority != 0) {
+            task->priority = priority;
+        }
+        if (category != NULL) {
+            task->category = category_id;
+        }
+        if (task->priority == before.priority && task->category == before.category) {
+            continue;
+        }
+        undo_record(ACTION_EDIT, &before, task);
+        journal_record(ACTION_EDIT, task->id, task);
+        task_changed(positions[i], task);
+        changed++;
+    }
+    undo_end_group();
+    free(positions);
+    select_clear();
+    return changed;
+}
+
+// Footer text for the selection, if there is one
+const char *select_status(int cursor) {
+    static char status[48];
+    if (visual_anchor >= 0) {
+        int rows = cursor > visual_anchor ? cursor - visual_anchor + 1 : visual_anchor - cursor + 1;
+        snprintf(status, sizeof(status), " | Visual: %d rows", rows);
+    } else if (selected > 0) {
+        snprintf(status, sizeof(status), " | %d marked", selected);
+    } else {
+        return "";
+    }
+    return status;
+}
+
+void select_free() {
+    free(bits);
+    bits = NULL;
+    bit_words = 0;
+    selected = 0;
+    visual_anchor = -1;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Stable task IDs.
+//
+// A task's ID names a slot in a generational slot map, which records where
+// in the task table the task currently is. The low bits of the ID are the
+// slot number plus one and the high bits the slot's generation, so a freshly
+// created list is numbered 1, 2, 3, ... and an ID never equals 0. IDs are
+// saved with the tasks and survive sorting, editing and restarts.
+//
+// Deleting a task leaves a tombstone in the table and keeps its slot, so a
+// delete moves nothing and undoing it puts the task back in the same place.
+// compact_tasks drops the tombstones now and then, moving the live tasks
+// down and freeing their slots. A freed slot gets a new generation before it
+// is handed out again, so an old ID for it no longer matches.
+
+#define SLOT_BITS 24
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+#define GENERATION_MASK 0x7f
+#define MAX_SLOTS (SLOT_MASK - 1)
+
+typedef struct {
+    uint32_t position;   // Position in the task table, or the next free slot
+    uint8_t generation;
+    bool used;
+} Slot;
+
+static Slot *slots = NULL;
+static uint32_t slot_count = 0;     // Slots ever handed out
+static uint32_t slot_capacity = 0;
+static uint32_t free_slot = UINT32_MAX;
+static bool free_list_stale = false;  // Claims took slots off the free list
+
+static int make_id(uint32_t slot, uint8_t generation) {
+    return (int)((uint32_t)generation << SLOT_BITS | (slot + 1));
+}
+
+// Slot named by an ID, or UINT32_MAX for a malformed one
+uint32_t task_id_slot(int id) {
+    if (id <= 0 || ((uint32_t)id & SLOT_MASK) == 0) {
+        return UINT32_MAX;
+    }
+    return ((uint32_t)id & SLOT_MASK) - 1;
+}
+
+static void grow_slots(uint32_t needed) {
+    if (needed > MAX_SLOTS) {
+        handle_error("Error: Too many tasks.");
+        exit(1);
+    }
+    if (needed <= slot_capacity) {
+        return;
+    }
+    uint32_t capacity = slot_capacity ? slot_capacity : 64;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    Slot *temp = realloc(slots, capacity * sizeof(Slot));
+    if (temp == NULL) {
+        handle_error("Error allocating memory for task IDs.");
+        exit(1);
+    }
+    slots = temp;
+    slot_capacity = capacity;
+}
+
+// Thread the unused slots below slot_count into the free list, oldest first
+static void rebuild_free_list() {
+    free_slot = UINT32_MAX;
+    for (uint32_t slot = slot_count; slot-- > 0;) {
+        if (!slots[slot].used) {
+            slots[slot].position = free_slot;
+            free_slot = slot;
+        }
+    }
+    free_list_stale = false;
+}
+
+// A new ID for the task at `position`
+int new_task_id(int position) {
+    if (free_list_stale) {
+        rebuild_free_list();
+    }
+    uint32_t slot = free_slot;
+    if (slot != UINT32_MAX) {
+        free_slot = slots[slot].position;
+    } else {
+        grow_slots(slot_count + 1);
+        slot = slot_count++;
+        slots[slot].generation = 0;
+    }
+    slots[slot].position = position;
+    slots[slot].used = true;
+    return make_id(slot, slots[slot].generation);
+}
+
+// Give the task at `position` the ID it had before, e.g. when loading it.
+// Returns 0 if the ID is malformed or its slot is in use.
+int claim_task_id(int id, int position) {
+    uint32_t slot = task_id_slot(id);
+    if (slot == UINT32_MAX || slot >= MAX_SLOTS) {
+        return 0;
+    }
+    if (slot >= slot_count) {
+        grow_slots(slot + 1);
+        for (uint32_t i = slot_count; i <= slot; i++) {
+            slots[i].used = false;
+            slots[i].generation = 0;
+        }
+        slot_count = slot + 1;
+    } else if (slots[slot].used) {
+        return 0;
+    }
+    slots[slot].position = position;
+    slots[slot].generation = ((uint32_t)id >> SLOT_BITS) & GENERATION_MASK;
+    slots[slot].used = true;
+    free_list_stale = true;
+    return 1;
+}
+
+// Position of the task with this ID (which may be a tombstone), or -1
+int task_position(int id) {
+    uint32_t slot = task_id_slot(id);
+    if (slot >= slot_count || !slots[slot].used ||
+        slots[slot].generation != (((uint32_t)id >> SLOT_BITS) & GENERATION_MASK)) {
+        return -1;
+    }
+    return slots[slot].position;
+}
+
+// Position of the task holding `slot`, or -1 if it is free
+int task_slot_position(uint32_t slot) {
+    return slot < slot_count && slots[slot].used ? (int)slots[slot].position : -1;
+}
+
+// One more than the highest slot in use, for indexes kept per slot
+uint32_t task_slot_count() {
+    return slot_count;
+}
+
+void move_task_id(int id, int position) {
+    uint32_t slot = task_id_slot(id);
+    if (slot < slot_count) {
+        slots[slot].position = position;
+    }
+}
+
+// Free the slot of a task that is gone for good
+void release_task_id(int id) {
+    uint32_t slot = task_id_slot(id);
+    if (slot >= slot_count || !slots[slot].used) {
+        return;
+    }
+    slots[slot].used = false;
+    slots[slot].generation = (slots[slot].generation + 1) & GENERATION_MASK;
+    if (!free_list_stale) {
+        slots[slot].position = free_slot;
+        free_slot = slot;
+    }
+}
+
+// Map every loaded task's ID to its position, giving tasks without a
+// usable ID (none, malformed, or a duplicate) a new one
+void assign_task_ids(TaskTable *tasks) {
+    slot_count = 0;
+    free_slot = UINT32_MAX;
+    free_list_stale = false;
+    for (int i = 0; i < tasks->count; i++) {
+        if (!claim_task_id(TASK_AT(tasks, i)->id, i)) {
+            task_for_write(tasks, i)->id = 0;
+        }
+    }
+    for (int i = 0; i < tasks->count; i++) {
+        if (TASK_AT(tasks, i)->id == 0) {
+            task_for_write(tasks, i)->id = new_task_id(i);
+        }
+    }
+}
+
+void free_task_ids() {
+    free(slots);
+    slots = NULL;
+    slot_count = 0;
+    slot_capacity = 0;
+    free_slot = UINT32_MAX;
+    free_list_stale = false;
+}
@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Sort indexes.
+//
+// Sorting does not move any tasks. For each sort key there is an
+// order-statistic tree (a treap whose nodes count the tasks below them) that
+// holds every task ordered by that key, so the task shown on any row of a
+// sorted list, and the row any task is shown on, are both found in O(log n).
+// The trees are updated as tasks are added, edited and removed, which makes
+// switching between orders immediate and puts new tasks straight into their
+// sorted place. Tasks with equal keys stay in the order they entered the
+// index.
+//
+// Entries are numbered by the task's slot (see slots.c), which stays the
+// same while the task lives, so deletes and compaction of the task table
+// move nothing here. Node e of every tree belongs to entry e.
+//
+// The unsorted list skips the tombstones deleted tasks leave in the task
+// table. A Fenwick tree over the table counts the live tasks before each
+// position, so rows and positions convert in O(log n) there too, and
+// directly while there are no tombstones.
+//
+// Compound orders (SORT_CUSTOM) are not maintained incrementally: any change
+// to the tasks marks the sorted order stale, and it is sorted again with the
+// radix sort in keysort.c the next time a row is looked up.
+
+#define NIL UINT32_MAX
+
+enum {
+    TREE_PRIORITY,
+    TREE_DUE_DAY,
+    TREE_COUNT
+};
+
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint32_t size;  // Nodes in this subtree
+    int key;
+} SortNode;
+
+typedef struct {
+    uint32_t seq;   // Order of arrival, breaks ties between equal keys
+    uint32_t heap;  // Random treap priority
+} SortEntry;
+
+static SortNode *trees[TREE_COUNT];
+static uint32_t roots[TREE_COUNT] = {NIL, NIL};
+static SortEntry *entries = NULL;
+static uint32_t entry_capacity = 0;
+static uint32_t next_seq = 0;
+static unsigned int heap_seed = 1;
+
+static bool index_built = false;
+static SortMode sort_mode = SORT_NONE;
+
+// Rows of the unsorted list: a Fenwick tree over task positions counting the
+// live ones, rebuilt from the task table whenever it is not valid
+static uint32_t *row_counts = NULL;
+static uint32_t row_capacity = 0;  // Positions covered, a power of two
+static uint32_t live_rows = 0;
+static bool rows_valid = false;
+
+// Order for SORT_CUSTOM: positions by row, and rows by position
+static SortSpec custom_spec;
+static uint32_t *custom_order = NULL;
+static uint32_t *custom_rows = NULL;
+static int custom_count = 0;
+static int custom_positions = 0;
+static bool custom_stale = true;
+
+static int tree_key(int tree, const Task *task) {
+    // NO_DUE_DAY is larger than any date, so tasks without one sort last
+    return tree == TREE_PRIORITY ? task->priority : task->due_day;
+}
+
+static uint32_t node_size(const SortNode *nodes, uint32_t node) {
+    return node == NIL ? 0 : nodes[node].size;
+}
+
+static void update_size(SortNode *nodes, uint32_t node) {
+    nodes[node].size = 1 + node_size(nodes, nodes[node].left) + node_size(nodes, nodes[node].right);
+}
+
+// Whether node a sorts before a node with this key and sequence number
+static bool sorts_before(const SortNode *nodes, uint32_t a, int key, uint32_t seq) {
+    return nodes[a].key < key || (nodes[a].key == key && entries[a].seq < seq);
+}
+
+// Split the subtree into the nodes before (key, seq) and the rest
+static void split(SortNode *nodes, uint32_t node, int key, uint32_t seq, uint32_t *before, uint32_t *after) {
+    if (node == NIL) {
+        *before = *after = NIL;
+    } else if (sorts_before(nodes, node, key, seq)) {
+        split(nodes, nodes[node].right, key, seq, &nodes[node].right, after);
+        update_size(nodes, node);
+        *before = node;
+    } else {
+        split(nodes, nodes[node].left, key, seq, before, &nodes[node].left);
+        update_size(nodes, node);
+        *after = node;
+    }
+}
+
+// Join two subtrees where every node of the first sorts before the second
+static uint32_t merge(SortNode *nodes, uint32_t first, uint32_t second) {
+    if (first == NIL) {
+        return second;
+    }
+    if (second == NIL) {
+        return first;
+    }
+    if (entries[first].heap > entries[second].heap) {
+        nodes[first].right = merge(nodes, nodes[first].right, second);
+        update_size(nodes, first);
+        return first;
+    }
+    nodes[second].left = merge(nodes, first, nodes[second].left);
+    update_size(nodes, second);
+    return second;
+}
+
+static void tree_insert(int tree, uint32_t entry, int key) {
+    SortNode *nodes = trees[tree];
+    nodes[entry].left = nodes[entry].right = NIL;
+    nodes[entry].size = 1;
+    nodes[entry].key = key;
+
+    uint32_t before, after;
+    split(nodes, roots[tree], key, entries[entry].seq, &before, &after);
+    roots[tree] = merge(nodes, merge(nodes, before, entry), after);
+}
+
+static uint32_t tree_erase(SortNode *nodes, uint32_t node, uint32_t entry) {
+    if (node == entry) {
+        return merge(nodes, nodes[node].left, nodes[node].right);
+    }
+    if (sorts_before(nodes, node, nodes[entry].key, entries[entry].seq)) {
+        nodes[node].right = tree_erase(nodes, nodes[node].right, entry);
+    } else {
+        nodes[node].left = tree_erase(nodes, nodes[node].left, entry);
+    }
+    update_size(nodes, node);
+    return node;
+}
+
+// Entry at `rank` (0-based) in key order
+static uint32_t tree_select(int tree, uint32_t rank) {
+    SortNode *nodes = trees[tree];
+    uint32_t node = roots[tree];
+    while (node != NIL) {
+        uint32_t left_size = node_size(nodes, nodes[node].left);
+        if (rank < left_size) {
+            node = nodes[node].left;
+        } else if (rank == left_size) {
+            return node;
+        } else {
+            rank -= left_size + 1;
+            node = nodes[node].right;
+        }
+    }
+    return NIL;
+}
+
+// Number of entries that sort before (key, seq)
+static uint32_t tree_rank(int tree, int key, uint32_t seq) {
+    SortNode *nodes = trees[tree];
+    uint32_t node = roots[tree];
+    uint32_t rank = 0;
+    while (node != NIL) {
+        if (sorts_before(nodes, node, key, seq)) {
+            rank += node_size(nodes, nodes[node].left) + 1;
+            node = nodes[node].right;
+        } else {
+            node = nodes[node].left;
+        }
+    }
+    return rank;
+}
+
+static void grow_entries(uint32_t needed) {
+    if (needed <= entry_capacity) {
+        return;
+    }
+    uint32_t capacity = entry_capacity ? entry_capacity : 64;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    SortEntry *temp = realloc(entries, capacity * sizeof(SortEntry));
+    if (temp == NULL) {
+        handle_error("Error allocating memory for the sort index.");
+        exit(1);
+    }
+    entries = temp;
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        SortNode *nodes = realloc(trees[tree], capacity * sizeof(SortNode));
+        if (nodes == NULL) {
+            handle_error("Error allocating memory for the sort index.");
+            exit(1);
+        }
+        trees[tree] = nodes;
+    }
+    entry_capacity = capacity;
+}
+
+static void new_entry(uint32_t entry) {
+    grow_entries(entry + 1);
+    entries[entry].seq = next_seq++;
+    entries[entry].heap = rand_r(&heap_seed);
+}
+
+// Position in the task table of the task an entry belongs to
+static int entry_position(uint32_t entry) {
+    return task_slot_position(entry);
+}
+
+static const SortNode *compare_nodes;
+
+static int compare_entries(const void *a, const void *b) {
+    uint32_t entryA = *(const uint32_t *)a;
+    uint32_t entryB = *(const uint32_t *)b;
+    int keyA = compare_nodes[entryA].key;
+    int keyB = compare_nodes[entryB].key;
+    if (keyA != keyB) {
+        return (keyA > keyB) - (keyA < keyB);
+    }
+    return (entries[entryA].seq > entries[entryB].seq) - (entries[entryA].seq < entries[entryB].seq);
+}
+
+static uint32_t compute_sizes(SortNode *nodes, uint32_t node) {
+    if (node == NIL) {
+        return 0;
+    }
+    nodes[node].size = 1 + compute_sizes(nodes, nodes[node].left) + compute_sizes(nodes, nodes[node].right);
+    return nodes[node].size;
+}
+
+// Build a tree from its entries in key order in O(n), as the Cartesian
+// tree of their heap priorities, rather than inserting them one by one
+static void build_tree(int tree, const uint32_t *order, uint32_t count, uint32_t *stack) {
+    SortNode *nodes = trees[tree];
+    uint32_t depth = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t entry = order[i];
+        uint32_t last = NIL;
+        while (depth > 0 && entries[stack[depth - 1]].heap < entries[entry].heap) {
+            last = stack[--depth];
+        }
+        nodes[entry].left = last;
+        nodes[entry].right = NIL;
+        if (depth > 0) {
+            nodes[stack[depth - 1]].right = entry;
+        }
+        stack[depth++] = entry;
+    }
+    roots[tree] = depth > 0 ? stack[0] : NIL;
+    compute_sizes(nodes, roots[tree]);
+}
+
+// Index every task from scratch. Until this is first called the other
+// updates are ignored, so the index costs nothing unless sorting is used.
+void sort_index_build(const TaskTable *tasks) {
+    int count = tasks->count;
+    roots[TREE_PRIORITY] = roots[TREE_DUE_DAY] = NIL;
+    next_seq = 0;
+    grow_entries(task_slot_count());
+
+    uint32_t *live = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t *stack = malloc((count + 1) * sizeof(uint32_t));
+    if (live == NULL || order == NULL || stack == NULL) {
+        handle_error("Error allocating memory for the sort index.");
+        exit(1);
+    }
+    uint32_t indexed = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        uint32_t entry = task_id_slot(task->id);
+        new_entry(entry);
+        for (int tree = 0; tree < TREE_COUNT; tree++) {
+            trees[tree][entry].key = tree_key(tree, task);
+        }
+        live[indexed++] = entry;
+    }
+
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        memcpy(order, live, indexed * sizeof(uint32_t));
+        compare_nodes = trees[tree];
+        qsort(order, indexed, sizeof(uint32_t), compare_entries);
+        build_tree(tree, order, indexed, stack);
+    }
+    free(live);
+    free(order);
+    free(stack);
+    index_built = true;
+}
+
+// Rebuild the row counts from the task table, with room to append to it
+static void build_rows(const TaskTable *tasks) {
+    uint32_t capacity = row_capacity ? row_capacity : 64;
+    while (capacity < (uint32_t)tasks->count + 1) {
+        capacity *= 2;
+    }
+    if (capacity != row_capacity) {
+        uint32_t *temp = realloc(row_counts, (capacity + 1) * sizeof(uint32_t));
+        if (temp == NULL) {
+            handle_error("Error allocating memory for the sort index.");
+            exit(1);
+        }
+        row_counts = temp;
+        row_capacity = capacity;
+    }
+
+    // Entry i (1-based) covers the i & -i positions ending at position i - 1
+    memset(row_counts, 0, (row_capacity + 1) * sizeof(uint32_t));
+    live_rows = 0;
+    for (uint32_t i = 1; i <= row_capacity; i++) {
+        if (i <= (uint32_t)tasks->count && !TASK_IS_DELETED(TASK_AT(tasks, i - 1))) {
+            row_counts[i]++;
+            live_rows++;
+        }
+        uint32_t parent = i + (i & -i);
+        if (parent <= row_capacity) {
+            row_counts[parent] += row_counts[i];
+        }
+    }
+    rows_valid = true;
+}
+
+static void ensure_rows(const TaskTable *tasks) {
+    if (!rows_valid) {
+        build_rows(tasks);
+    }
+}
+
+static void add_row(int position, int delta) {
+    if (!rows_valid) {
+        return;
+    }
+    if ((uint32_t)position >= row_capacity) {
+        rows_valid = false;  // Rebuilt larger on the next lookup
+        return;
+    }
+    for (uint32_t i = position + 1; i <= row_capacity; i += i & -i) {
+        row_counts[i] += delta;
+    }
+    live_rows += delta;
+}
+
+// Position of the live task on `row` of the unsorted list
+static int row_position(int row) {
+    uint32_t position = 0;
+    uint32_t remaining = row + 1;
+    for (uint32_t step = row_capacity; step > 0; step /= 2) {
+        if (position + step <= row_capacity && row_counts[position + step] < remaining) {
+            position += step;
+            remaining -= row_counts[position];
+        }
+    }
+    return position;
+}
+
+// Live tasks before `position`, i.e. its row in the unsorted list
+static int position_row(int position) {
+    uint32_t row = 0;
+    for (uint32_t i = position; i > 0; i -= i & -i) {
+        row += row_counts[i];
+    }
+    return row;
+}
+
+// A task was added at `position`, at the end of the array or in place of
+// its own tombstone
+void sort_index_insert(int position, const Task *task) {
+    custom_stale = true;
+    if (position < 0) {
+        return;
+    }
+    add_row(position, 1);
+    if (!index_built) {
+        return;
+    }
+    uint32_t entry = task_id_slot(task->id);
+    new_entry(entry);
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        tree_insert(tree, entry, tree_key(tree, task));
+    }
+}
+
+// The task at `position` is about to become a tombstone
+void sort_index_remove(int position, const Task *task) {
+    custom_stale = true;
+    if (position < 0) {
+        return;
+    }
+    add_row(position, -1);
+    if (!index_built) {
+        return;
+    }
+    uint32_t entry = task_id_slot(task->id);
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        roots[tree] = tree_erase(trees[tree], roots[tree], entry);
+    }
+}
+
+// The task at `position` may have been edited
+void sort_index_update(int position, const Task *task) {
+    custom_stale = true;
+    if (!index_built || position < 0) {
+        return;
+    }
+    uint32_t entry = task_id_slot(task->id);
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        int key = tree_key(tree, task);
+        if (trees[tree][entry].key != key) {
+            // Same sequence number, so it keeps its place among equal keys
+            roots[tree] = tree_erase(trees[tree], roots[tree], entry);
+            tree_insert(tree, entry, key);
+        }
+    }
+}
+
+// The tombstones were dropped from the task table, moving tasks down
+void sort_index_compacted() {
+    rows_valid = false;
+    custom_stale = true;
+}
+
+// Show the tasks in this order from now on; builds the index on first use
+void set_sort_mode(const TaskTable *tasks, SortMode mode) {
+    if (mode != SORT_NONE && mode != SORT_CUSTOM && !index_built) {
+        sort_index_build(tasks);
+    }
+    sort_mode = mode;
+}
+
+SortMode get_sort_mode() {
+    return sort_mode;
+}
+
+// Show the tasks sorted by a compound spec from now on
+void set_sort_spec(const SortSpec *spec) {
+    custom_spec = *spec;
+    custom_stale = true;
+    sort_mode = SORT_CUSTOM;
+}
+
+// Sort again for SORT_CUSTOM if anything changed since the last time
+static void refresh_custom_order(const TaskTable *tasks) {
+    if (!custom_stale && custom_positions == tasks->count) {
+        return;
+    }
+    uint32_t *order = realloc(custom_order, (tasks->count + 1) * sizeof(uint32_t));
+    uint32_t *rows = realloc(custom_rows, (tasks->count + 1) * sizeof(uint32_t));
+    if (order == NULL || rows == NULL) {
+        handle_error("Error allocating memory for the sort index.");
+        exit(1);
+    }
+    custom_order = order;
+    custom_rows = rows;
+    custom_count = sort_positions(tasks, &custom_spec, custom_order);
+    for (int row = 0; row < custom_count; row++) {
+        custom_rows[custom_order[row]] = row;
+    }
+    custom_positions = tasks->count;
+    custom_stale = false;
+}
+
+// Tasks with a due date, which come before the rest in both due date orders
+static uint32_t dated_tasks() {
+    return tree_rank(TREE_DUE_DAY, NO_DUE_DAY, 0);
+}
+
+// Number of tasks in the list, leaving out tombstones
+int sort_view_count(const TaskTable *tasks) {
+    ensure_rows(tasks);
+    return live_rows;
+}
+
+// Position in the task table of the task shown on `row`
+int sort_view_position(const TaskTable *tasks, int row) {
+    if (sort_mode == SORT_CUSTOM) {
+        refresh_custom_order(tasks);
+        return row >= 0 && row < custom_count ? (int)custom_order[row] : row;
+    }
+    ensure_rows(tasks);
+    if (row < 0 || (uint32_t)row >= live_rows) {
+        return row;
+    }
+    if (sort_mode == SORT_NONE) {
+        return live_rows == (uint32_t)tasks->count ? row : row_position(row);
+    }
+
+    uint32_t entry = NIL;
+    switch (sort_mode) {
+        case SORT_PRIORITY_ASC:
+            entry = tree_select(TREE_PRIORITY, row);
+            break;
+        case SORT_PRIORITY_DESC:
+            entry = tree_select(TREE_PRIORITY, live_rows - 1 - row);
+            break;
+        case SORT_DUE_CLOSEST:
+            entry = tree_select(TREE_DUE_DAY, row);
+            break;
+        case SORT_DUE_LATEST: {
+            uint32_t dated = dated_tasks();
+            entry = tree_select(TREE_DUE_DAY, (uint32_t)row < dated ? dated - 1 - row : (uint32_t)row);
+            break;
+        }
+        default:
+            break;
+    }
+    return entry == NIL ? row : entry_position(entry);
+}
+
+// Row on which the task at `position` is shown
+int sort_view_row(const TaskTable *tasks, int position) {
+    if (sort_mode == SORT_CUSTOM) {
+        refresh_custom_order(tasks);
+        return position >= 0 && position < tasks->count ? (int)custom_rows[position] : position;
+    }
+    ensure_rows(tasks);
+    if (position < 0 || position >= tasks->count) {
+        return position;
+    }
+    if (sort_mode == SORT_NONE) {
+        return live_rows == (uint32_t)tasks->count ? position : position_row(position);
+    }
+
+    uint32_t entry = task_id_slot(TASK_AT(tasks, position)->id);
+    int tree = sort_mode == SORT_PRIORITY_ASC || sort_mode == SORT_PRIORITY_DESC ? TREE_PRIORITY : TREE_DUE_DAY;
+    uint32_t rank = tree_rank(tree, trees[tree][entry].key, entries[entry].seq);
+
+    switch (sort_mode) {
+        case SORT_PRIORITY_DESC:
+            return live_rows - 1 - rank;
+        case SORT_DUE_LATEST: {
+            uint32_t dated = dated_tasks();
+            return rank < dated ? dated - 1 - rank : rank;
+        }
+        default:
+            return rank;
+    }
+}
+
+static void collect(const SortNode *nodes, uint32_t node, uint32_t *order, uint32_t *count) {
+    while (node != NIL) {
+        collect(nodes, nodes[node].left, order, count);
+        order[(*count)++] = entry_position(node);
+        node = nodes[node].right;
+    }
+}
+
+static void reverse(uint32_t *order, uint32_t count) {
+    for (uint32_t i = 0; i < count / 2; i++) {
+        uint32_t temp = order[i];
+        order[i] = order[count - 1 - i];
+        order[count - 1 - i] = temp;
+    }
+}
+
+// Positions of all tasks in the order they are shown, in a new array, or
+// NULL when they are shown unsorted and there are no tombstones to skip.
+// Costs O(n), for walking the whole list.
+uint32_t *sort_view_order(const TaskTable *tasks) {
+    ensure_rows(tasks);
+    if (sort_mode == SORT_NONE && live_rows == (uint32_t)tasks->count) {
+        return NULL;
+    }
+    uint32_t *order = malloc((tasks->count + 1) * sizeof(uint32_t));
+    if (order == NULL) {
+        handle_error("Error allocating memory for the sort index.");
+        exit(1);
+    }
+    if (sort_mode == SORT_NONE) {
+        uint32_t count = 0;
+        for (int i = 0; i < tasks->count; i++) {
+            if (!TASK_IS_DELETED(TASK_AT(tasks, i))) {
+                order[count++] = i;
+            }
+        }
+        return order;
+    }
+    if (sort_mode == SORT_CUSTOM) {
+        refresh_custom_order(tasks);
+        memcpy(order, custom_order, custom_count * sizeof(uint32_t));
+        return order;
+    }
+
+    int tree = sort_mode == SORT_PRIORITY_ASC || sort_mode == SORT_PRIORITY_DESC ? TREE_PRIORITY : TREE_DUE_DAY;
+    uint32_t count = 0;
+    collect(trees[tree], roots[tree], order, &count);
+    if (sort_mode == SORT_PRIORITY_DESC) {
+        reverse(order, count);
+    } else if (sort_mode == SORT_DUE_LATEST) {
+        reverse(order, dated_tasks());
+    }
+    return order;
+}
+
+void sort_index_free() {
+    for (int tree = 0; tree < TREE_COUNT; tree++) {
+        free(trees[tree]);
+        trees[tree] = NULL;
+        roots[tree] = NIL;
+    }
+    free(entries);
+    entries = NULL;
+    entry_capacity = 0;
+    free(row_counts);
+    row_counts = NULL;
+    row_capacity = 0;
+    live_rows = 0;
+    rows_valid = false;
+    index_built = false;
+    sort_mode = SORT_NONE;
+    free(custom_order);
+    custom_order = NULL;
+    free(custom_rows);
+    custom_rows = NULL;
+    custom_count = 0;
+    custom_positions = 0;
+    custom_stale = true;
+}
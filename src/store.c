@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "todo.h"
+
+// Binary task store.
+//
+// The file is a fixed header, then `count` Task rows exactly as they are laid
+// out in memory, then a section of NUL-terminated strings: the names of the
+// `category_count` categories in use, followed by the titles. In the file the
+// title pointer of each row holds an offset into the string section and the
+// category holds an index into the list of names. Loading maps the file,
+// copies the rows into the task table, interns the category names and turns
+// each title offset back into a pointer into the mapping, so there is no
+// per-field parse step and titles are never copied. The row size is
+// stored in the header so that a build with a different Task layout refuses
+// the file instead of misreading it; the format is native endian and not
+// meant to be moved between machines (use the text format for that).
+
+#define STORE_MAGIC "TDOB"
+#define STORE_VERSION 5
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t category_count;
+    uint32_t reserved;
+    uint64_t strings_size;
+    uint64_t checksum;
+} StoreHeader;
+
+// Set once the tasks were loaded from (or converted to) the binary store, so
+// that save_tasks keeps writing the same format back.
+static bool binary_store_active = false;
+
+bool is_binary_store_active() {
+    return binary_store_active;
+}
+
+char *get_binary_path() {
+    static char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/%s", getenv("HOME"), BINARY_FILE_PATH);
+    return file_path;
+}
+
+// FNV-1a style hash folded over 64-bit words; fast enough to verify a few
+// hundred megabytes at startup without showing up next to the copy itself.
+uint64_t checksum64(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t store_checksum(const void *records, size_t records_size, const void *strings, size_t strings_size) {
+    return checksum64(records, records_size) * 31 ^ checksum64(strings, strings_size);
+}
+
+int load_tasks_binary(const char *path, TaskTable *tasks) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(StoreHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        handle_error("Error mapping binary tasks file.");
+        return 0;
+    }
+
+    const StoreHeader *header = map;
+    const unsigned char *records = (const unsigned char *)map + sizeof(StoreHeader);
+    size_t records_size = (size_t)header->count * sizeof(Task);
+    const char *strings = (const char *)records + records_size;
+
+    if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != STORE_VERSION ||
+        header->record_size != sizeof(Task) ||
+        (size_t)st.st_size != sizeof(StoreHeader) + records_size + header->strings_size ||
+        (header->strings_size > 0 && strings[header->strings_size - 1] != '\0')) {
+        handle_error("Warning: Binary tasks file has an unknown layout, ignoring it.");
+        munmap(map, st.st_size);
+        return 0;
+    }
+    if (store_checksum(records, records_size, strings, header->strings_size) != header->checksum) {
+        handle_error("Warning: Binary tasks file failed its checksum, ignoring it.");
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    // Intern the category names, mapping file IDs to the IDs of this session
+    uint32_t *category_ids = malloc((header->category_count + 1) * sizeof(uint32_t));
+    if (category_ids == NULL) {
+        handle_error("Error allocating memory for tasks.");
+        exit(1);
+    }
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header->category_count; i++) {
+        if (offset >= header->strings_size) {
+            handle_error("Warning: Binary tasks file has an unknown layout, ignoring it.");
+            free(category_ids);
+            munmap(map, st.st_size);
+            return 0;
+        }
+        size_t length = strlen(strings + offset);
+        category_ids[i] = intern_category_n(strings + offset, length);
+        offset += length + 1;
+    }
+
+    append_tasks(tasks, (const Task *)records, header->count);
+
+    // Point the titles into the mapping, which stays alive for the session
+    for (int i = 0; i < tasks->count; i++) {
+        Task *task = task_for_write(tasks, i);
+        uintptr_t title = (uintptr_t)task->title;
+        uint32_t category = task->category;
+        if (title >= header->strings_size || category >= header->category_count) {
+            handle_error("Warning: Binary tasks file has an unknown layout, ignoring it.");
+            free(category_ids);
+            release_tasks(tasks);
+            munmap(map, st.st_size);
+            return 0;
+        }
+        task->title = strings + title;
+        task->category = category_ids[category];
+    }
+    free(category_ids);
+    store_text_mapping(map, st.st_size);
+
+    binary_store_active = true;
+    return 1;
+}
+
+int save_tasks_binary(const char *path, const TaskTable *tasks) {
+    int count = tasks->count;
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    // Number the categories these tasks use densely, in order of first use
+    uint32_t max_category = 0;
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        live++;
+        if (task->category > max_category) {
+            max_category = task->category;
+        }
+    }
+    uint32_t *file_ids = malloc((max_category + 1) * sizeof(uint32_t));
+    if (file_ids == NULL) {
+        handle_error("Error allocating memory for saving tasks.");
+        return 0;
+    }
+    memset(file_ids, 0xff, (max_category + 1) * sizeof(uint32_t));
+    uint32_t category_count = 0;
+    size_t strings_size = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        if (file_ids[task->category] == UINT32_MAX) {
+            file_ids[task->category] = category_count++;
+            strings_size += strlen(category_name(task->category)) + 1;
+        }
+        strings_size += strlen(task->title) + 1;
+    }
+
+    // Lay out the rows with string offsets, and the string section, in memory
+    Task *records = malloc(live * sizeof(Task) + 1);
+    char *strings = malloc(strings_size + 1);
+    if (records == NULL || strings == NULL) {
+        handle_error("Error allocating memory for saving tasks.");
+        free(file_ids);
+        free(records);
+        free(strings);
+        return 0;
+    }
+
+    size_t offset = 0;
+    uint32_t written = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (!TASK_IS_DELETED(task) && file_ids[task->category] == written) {
+            const char *name = category_name(task->category);
+            size_t name_len = strlen(name) + 1;
+            memcpy(strings + offset, name, name_len);
+            offset += name_len;
+            written++;
+        }
+    }
+    int row = 0;
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        size_t title_len = strlen(task->title) + 1;
+        records[row] = *task;
+        records[row].title = (const char *)(uintptr_t)offset;
+        records[row].category = file_ids[task->category];
+        memcpy(strings + offset, task->title, title_len);
+        offset += title_len;
+        row++;
+    }
+    free(file_ids);
+
+    StoreHeader header;
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.record_size = sizeof(Task);
+    header.count = live;
+    header.category_count = category_count;
+    header.reserved = 0;
+    header.strings_size = strings_size;
+    header.checksum = store_checksum(records, (size_t)live * sizeof(Task), strings, strings_size);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        handle_error("Error: Could not open binary file for saving tasks.");
+        free(records);
+        free(strings);
+        return 0;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (live == 0 || fwrite(records, sizeof(Task), live, file) == (size_t)live) &&
+             (strings_size == 0 || fwrite(strings, 1, strings_size, file) == strings_size);
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    free(records);
+    free(strings);
+
+    // Replace the old file only once the new one is complete on disk
+    if (!ok || rename(tmp_path, path) != 0) {
+        handle_error("Error: Could not write binary tasks file.");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Convert the task store between the text (TSV) and binary formats.
+// The tasks are loaded from whichever store is currently in use and written
+// out in the requested one; switching back to text removes the binary file
+// so that load_tasks falls back to tasks.txt again.
+int convert_task_store(const char *format) {
+    TaskTable tasks = {0};
+    int ok;
+
+    load_tasks(&tasks);
+
+    if (strcmp(format, "binary") == 0) {
+        ok = save_tasks_binary(get_binary_path(), &tasks);
+        if (ok) {
+            binary_store_active = true;
+            journal_reset();
+        }
+    } else if (strcmp(format, "text") == 0) {
+        binary_store_active = false;
+        ok = save_tasks(&tasks) &&
+             (unlink(get_binary_path()) == 0 || errno == ENOENT);
+        if (ok) {
+            journal_reset();
+        }
+    } else {
+        fprintf(stderr, "Unknown task store format '%s' (expected 'text' or 'binary').\n", format);
+        ok = 0;
+    }
+
+    if (ok) {
+        printf("Converted %d tasks to the %s store.\n", tasks.count, format);
+    }
+    release_tasks(&tasks);
+    free_task_ids();
+    free_text_store();
+    return ok;
+}
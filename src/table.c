@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Task table.
+//
+// Tasks are stored in chunks of TASK_CHUNK_SIZE rows, found through a chunk
+// list. Chunks and chunk lists are both reference counted and shared
+// copy-on-write, so snapshot_tasks copies nothing: the snapshot only takes a
+// reference to the current chunk list. Rows are read in place with TASK_AT.
+// A row that is about to change comes from task_for_write, which first gives
+// the table a list and a chunk of its own when a snapshot still shares them.
+// A snapshot therefore never changes once taken and can be read by another
+// thread without any lock, and an edit made while it is being written costs
+// one copied chunk plus the list of chunk pointers.
+//
+// Only the thread that owns a table takes snapshots of it, so a count of one
+// seen there stays one. Snapshots may be released from any thread, which is
+// why the counts change atomically.
+
+static void *table_alloc(size_t size) {
+    void *memory = malloc(size);
+    if (memory == NULL) {
+        handle_error("Error allocating memory for tasks.");
+        exit(1);
+    }
+    return memory;
+}
+
+static bool is_shared(const int *refs) {
+    return __atomic_load_n(refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+static void release_chunk(TaskChunk *chunk) {
+    if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(chunk);
+    }
+}
+
+static void release_chunk_list(TaskChunkList *list) {
+    if (list == NULL || __atomic_sub_fetch(&list->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (int i = 0; i < list->length; i++) {
+        release_chunk(list->chunks[i]);
+    }
+    free(list);
+}
+
+// Make the table's chunk list its own, with room for at least `needed` chunks
+static void own_chunk_list(TaskTable *table, int needed) {
+    TaskChunkList *list = table->list;
+    if (list != NULL && !is_shared(&list->refs)) {
+        if (needed > list->capacity) {
+            int capacity = list->capacity * 2 > needed ? list->capacity * 2 : needed;
+            TaskChunkList *temp = realloc(list, sizeof(TaskChunkList) + capacity * sizeof(TaskChunk *));
+            if (temp == NULL) {
+                handle_error("Error reallocating memory for tasks.");
+                exit(1);
+            }
+            temp->capacity = capacity;
+            table->list = temp;
+        }
+        return;
+    }
+
+    int length = list != NULL ? list->length : 0;
+    int capacity = list != NULL ? list->capacity : 8;
+    if (capacity < needed) {
+        capacity = needed;
+    }
+    TaskChunkList *copy = table_alloc(sizeof(TaskChunkList) + capacity * sizeof(TaskChunk *));
+    copy->refs = 1;
+    copy->length = length;
+    copy->capacity = capacity;
+    for (int i = 0; i < length; i++) {
+        copy->chunks[i] = list->chunks[i];
+        __atomic_add_fetch(&copy->chunks[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    release_chunk_list(list);
+    table->list = copy;
+}
+
+// The task at `position`, which may now be changed
+Task *task_for_write(TaskTable *table, int position) {
+    own_chunk_list(table, 0);
+    TaskChunk **chunk = &table->list->chunks[position >> TASK_CHUNK_SHIFT];
+    if (is_shared(&(*chunk)->refs)) {
+        TaskChunk *copy = table_alloc(sizeof(TaskChunk));
+        copy->refs = 1;
+        memcpy(copy->tasks, (*chunk)->tasks, sizeof(copy->tasks));
+        release_chunk(*chunk);
+        *chunk = copy;
+    }
+    return &(*chunk)->tasks[position & (TASK_CHUNK_SIZE - 1)];
+}
+
+// Add a zeroed row at the end of the table and return it
+Task *append_task(TaskTable *table) {
+    int position = table->count;
+    int chunk = position >> TASK_CHUNK_SHIFT;
+    if (table->list == NULL || chunk >= table->list->length) {
+        own_chunk_list(table, chunk + 1);
+        TaskChunk *added = table_alloc(sizeof(TaskChunk));
+        added->refs = 1;
+        table->list->chunks[table->list->length++] = added;
+    }
+    table->count++;
+    Task *task = task_for_write(table, position);
+    memset(task, 0, sizeof(Task));
+    return task;
+}
+
+// Make room in the chunk list for `count` more rows, so appending them never
+// grows it
+void reserve_tasks(TaskTable *table, int count) {
+    own_chunk_list(table, (table->count + count + TASK_CHUNK_SIZE - 1) >> TASK_CHUNK_SHIFT);
+}
+
+// Copy `count` rows to the end of the table, a chunk at a time
+void append_tasks(TaskTable *table, const Task *rows, int count) {
+    while (count > 0) {
+        int position = table->count;
+        int room = TASK_CHUNK_SIZE - (position & (TASK_CHUNK_SIZE - 1));
+        int n = count < room ? count : room;
+        Task *first = append_task(table);
+        table->count += n - 1;
+        memcpy(first, rows, n * sizeof(Task));
+        rows += n;
+        count -= n;
+    }
+}
+
+// Drop the rows from `count` on
+void truncate_tasks(TaskTable *table, int count) {
+    if (count >= table->count) {
+        return;
+    }
+    int chunks = (count + TASK_CHUNK_SIZE - 1) >> TASK_CHUNK_SHIFT;
+    if (chunks < table->list->length) {
+        own_chunk_list(table, 0);
+        while (table->list->length > chunks) {
+            release_chunk(table->list->chunks[--table->list->length]);
+        }
+    }
+    table->count = count;
+}
+
+// The table as it is now, unaffected by later changes to it. Release it with
+// release_tasks once done.
+TaskTable snapshot_tasks(const TaskTable *table) {
+    if (table->list != NULL) {
+        __atomic_add_fetch(&table->list->refs, 1, __ATOMIC_RELAXED);
+    }
+    return *table;
+}
+
+void release_tasks(TaskTable *table) {
+    release_chunk_list(table->list);
+    table->list = NULL;
+    table->count = 0;
+}
@@ -1,5 +1,3 @@
-#define _XOPEN_SOURCE 700  // For strptime
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,8 +15,6 @@ const char *recurrence_strings[] = {
     "yearly"
 };
 
-extern Action action_stack[];
-extern int action_count;
 extern pthread_mutex_t task_mutex;
 
 void get_input(char *buffer, int size, const char *prompt) {
@@ -30,78 +26,38 @@ void get_input(char *buffer, int size, const char *prompt) {
     refresh();
 }
 
-void ensure_capacity(Task **tasks, int *capacity, int needed) {
-    if (needed > *capacity) {
-        *capacity = needed * 2;
-        Task *temp = realloc(*tasks, (*capacity) * sizeof(Task));
-        if (temp == NULL) {
-            handle_error("Error reallocating memory for tasks.");
-            free(*tasks);  // Free existing memory before exiting
-            exit(1);
-        }
-        *tasks = temp;
-    }
-}
-
-// Function to update task IDs after sorting or deletion
-void update_task_ids(Task *tasks, int count) {
-    for (int i = 0; i < count; i++) {
-        tasks[i].id = i + 1;
-    }
-}
-
-// Comparator functions for sorting by priority, due date
-int compare_priority_desc(const void *a, const void *b) {
-    Task *taskA = (Task *)a;
-    Task *taskB = (Task *)b;
-    return taskB->priority - taskA->priority;  // Higher priority first
-}
-
-int compare_priority_asc(const void *a, const void *b) {
-    Task *taskA = (Task *)a;
-    Task *taskB = (Task *)b;
-    return taskA->priority - taskB->priority;  // Lower priority first
-}
-
-int compare_due_date_desc(const void *a, const void *b) {
-    Task *taskA = (Task *)a;
-    Task *taskB = (Task *)b;
-
-    if (strcmp(taskA->due_date, "N/A") == 0) return 1;  // Push "N/A" (no due date) to the end
-    if (strcmp(taskB->due_date, "N/A") == 0) return -1;
-
-    return strcmp(taskA->due_date, taskB->due_date);  // Closest date first
-}
-
-int compare_due_date_asc(const void *a, const void *b) {
-    Task *taskA = (Task *)a;
-    Task *taskB = (Task *)b;
-
-    if (strcmp(taskA->due_date, "N/A") == 0) return 1;  // Push "N/A" (no due date) to the end
-    if (strcmp(taskB->due_date, "N/A") == 0) return -1;
-
-    return strcmp(taskB->due_date, taskA->due_date);  // Latest date first
-}
-
-// Function to handle sorting with ascending/descending toggling
-void sort_tasks(Task *tasks, int count, char sort_type, bool ascending) {
+// Show the tasks sorted by priority ('p') or due date ('d'). Sorting only
+// changes the view: the tasks stay where they are in the table and on disk.
+void sort_tasks(const TaskTable *tasks, char sort_type, bool ascending) {
     switch (sort_type) {
         case 'p':  // Sort by priority
-            if (ascending) {
-                qsort(tasks, count, sizeof(Task), compare_priority_asc);
-            } else {
-                qsort(tasks, count, sizeof(Task), compare_priority_desc);
-            }
+            set_sort_mode(tasks, ascending ? SORT_PRIORITY_ASC : SORT_PRIORITY_DESC);
             break;
         case 'd':  // Sort by due date
-            if (ascending) {
-                qsort(tasks, count, sizeof(Task), compare_due_date_desc);
-            } else {
-                qsort(tasks, count, sizeof(Task), compare_due_date_asc);
-            }
+            set_sort_mode(tasks, ascending ? SORT_DUE_CLOSEST : SORT_DUE_LATEST);
             break;
     }
-    update_task_ids(tasks, count);
+}
+
+// Ask for a compound sort such as "-priority,due,title" and show the tasks
+// in that order. A blank answer goes back to the unsorted list.
+void sort_tasks_by_spec(const TaskTable *tasks) {
+    char input[MAX_TITLE_LEN];
+    SortSpec spec;
+
+    get_input_and_clear(input, sizeof(input), "Sort by (priority, due, title, category, completed; '-' for descending): ");
+    if (strlen(input) == 0) {
+        set_sort_mode(tasks, SORT_NONE);
+        return;
+    }
+    if (!parse_sort_spec(input, &spec)) {
+        mvprintw(LINES - 2, 0, "Invalid sort order. Press any key to continue.");
+        clrtoeol();
+        refresh();
+        getch();
+        return;
+    }
+    set_sort_spec(&spec);
 }
 
 void init_ncurses() {
@@ -118,6 +74,7 @@ void init_ncurses() {
     noecho();
     cbreak();
     keypad(stdscr, TRUE);
+    set_escdelay(25);  // Esc leaves the filter without a noticeable pause
     curs_set(0);
     refresh();
     // Initialize color pairs
@@ -132,16 +89,19 @@ void init_ncurses() {
 
 void cleanup_ncurses() {
     endwin();
+    render_cleanup();
 }
 
 void toggle_task_completion(Task *task) {
-    // Push action onto the stack
-    if (action_count < MAX_ACTIONS) {
-        action_stack[action_count].type = ACTION_COMPLETE;
-        action_stack[action_count].task = *task;
-        action_stack[action_count].index = task->id - 1;
-        action_count++;
-    }
+    flip_task_completion(task);
+
+    // Log the action
+    log_message("Task completion status toggled.");
+}
+
+// Toggle completion without logging it, for batches that log once for all
+void flip_task_completion(Task *task) {
+    Task before = *task;
 
     // Toggle the completion status (1 for completed, 0 for not completed)
     task->completed = !task->completed;
@@ -150,97 +110,157 @@ void toggle_task_completion(Task *task) {
     if (task->completed && task->recurrence != RECURRENCE_NONE) {
         update_task_recurrence(task);
     }
-
-    // Log the action
-    log_message("Task completion status toggled.");
+    undo_record(ACTION_COMPLETE, &before, task);
+    journal_record(ACTION_COMPLETE, task->id, task);
+    task_changed(task_position(task->id), task);
 }
 
 void update_task_recurrence(Task *task) {
-    if (task->recurrence == RECURRENCE_NONE) {
-        return;  // No recurrence, nothing to update
+    if (task->recurrence == RECURRENCE_NONE || task->due_day == NO_DUE_DAY) {
+        return;  // No recurrence or no due date, nothing to update
     }
 
-    struct tm due_date = {0};
-
-    if (!parse_date(task->due_date, &due_date)) {
-        // Invalid or uninitialized due date, do nothing
-        return;
-    }
+    int year, month, day;
 
     // Adjust the due date based on recurrence type
     switch (task->recurrence) {
         case RECURRENCE_DAILY:
-            due_date.tm_mday += 1;
+            task->due_day += 1;
             break;
         case RECURRENCE_WEEKLY:
-            due_date.tm_mday += 7;
+            task->due_day += 7;
             break;
         case RECURRENCE_BIWEEKLY:
-            due_date.tm_mday += 14;
+            task->due_day += 14;
             break;
         case RECURRENCE_MONTHLY:
-            due_date.tm_mon += 1;
+            // Days past the end of the next month roll over, e.g. Jan 31 -> Mar 2 or 3
+            civil_from_days(task->due_day, &year, &month, &day);
+            task->due_day = days_from_civil(year + month / 12, month % 12 + 1, day);
             break;
         case RECURRENCE_YEARLY:
-            due_date.tm_year += 1;
+            civil_from_days(task->due_day, &year, &month, &day);
+            task->due_day = days_from_civil(year + 1, month, day);
             break;
         default:
             break;
     }
-
-    // Normalize the date
-    mktime(&due_date);
-
-    // Update the due date field
-    format_date(task->due_date, MAX_DATE_LEN, &due_date);
+    update_due_status(task);
 }
 
-int is_task_overdue(Task task) {
-    if (strcmp(task.due_date, "N/A") == 0) {
-        return 0;  // No due date, so not overdue
+// Day the cached due statuses were computed for, and the first day after it
+// on which any task's status changes. The statuses only need recomputing once
+// the clock reaches that day or a due date changes.
+static int status_today = INT_MIN;
+static int next_status_change = NO_DUE_DAY;
+static bool status_stale = true;
+
+// Status of a task due on `due` as seen on `today`, and the next day it changes
+static int due_status_on(int due, int today, int *changes_on) {
+    if (due == NO_DUE_DAY) {
+        *changes_on = NO_DUE_DAY;
+        return DUE_STATUS_NONE;
     }
+    // Overdue from the first moment of the due date
+    if (today >= due) {
+        *changes_on = NO_DUE_DAY;
+        return DUE_STATUS_OVERDUE;
+    }
+    // Due soon when it falls in the next 24 hours
+    if (today == due - 1) {
+        *changes_on = due;
+        return DUE_STATUS_SOON;
+    }
+    *changes_on = due - 1;
+    return DUE_STATUS_NONE;
+}
 
-    // Get the current time
-    time_t t = time(NULL);
-    struct tm current_time = *localtime(&t);
-    struct tm due_date = {0};
-
-    if (!parse_date(task.due_date, &due_date)) {
-        return 0;  // Invalid due date format
+// Recompute one task's status after its due date changed
+void update_due_status(Task *task) {
+    int changes_on;
+    if (today_day() != status_today) {
+        status_stale = true;  // Everything is recomputed before the next frame
     }
+    task->due_status = due_status_on(task->due_day, status_today, &changes_on);
+    if (changes_on < next_status_change) {
+        next_status_change = changes_on;
+    }
+}
 
-    // Compare the due date with the current date
-    return mktime(&current_time) > mktime(&due_date);
+// Called when the status timer fires
+void invalidate_due_status() {
+    status_stale = true;
 }
 
-int is_task_due_soon(Task task) {
-    if (strcmp(task.due_date, "N/A") == 0) return 0;
+// Bring every cached status up to date if the day moved on; returns true if
+// anything was recomputed. Only rows whose status changed are written, so
+// chunks shared with a snapshot are not copied for nothing.
+bool refresh_due_status(TaskTable *tasks) {
+    if (!status_stale) {
+        return false;
+    }
+    status_today = today_day();
+    next_status_change = NO_DUE_DAY;
+    for (int i = 0; i < tasks->count; i++) {
+        int changes_on;
+        int status = due_status_on(TASK_AT(tasks, i)->due_day, status_today, &changes_on);
+        if (TASK_AT(tasks, i)->due_status != status) {
+            task_for_write(tasks, i)->due_status = status;
+        }
+        if (changes_on < next_status_change) {
+            next_status_change = changes_on;
+        }
+    }
+    status_stale = false;
+    return true;
+}
 
-    time_t t = time(NULL);
-    struct tm current_time = *localtime(&t);
-    struct tm due_date = {0};
+// Milliseconds until the next status change, for getch's timeout, or -1 to
+// wait indefinitely. Capped so a suspended machine catches up soon after
+// it resumes.
+int due_status_timeout() {
+    if (status_stale) {
+        return 0;
+    }
+    if (next_status_change == NO_DUE_DAY) {
+        return -1;
+    }
 
-    if (!parse_date(task.due_date, &due_date)) {
-        return 0;  // Invalid due date format
+    int year, month, day;
+    civil_from_days(next_status_change, &year, &month, &day);
+    struct tm midnight = {0};
+    midnight.tm_year = year - 1900;
+    midnight.tm_mon = month - 1;
+    midnight.tm_mday = day;
+    midnight.tm_isdst = -1;
+
+    double seconds = difftime(mktime(&midnight), time(NULL));
+    if (seconds <= 0) {
+        return 0;
     }
+    if (seconds > DUE_STATUS_MAX_WAIT_MS / 1000) {
+        return DUE_STATUS_MAX_WAIT_MS;
+    }
+    return (int)(seconds * 1000) + 50;
+}
 
-    double seconds_difference = difftime(mktime(&due_date), mktime(&current_time));
-    return (seconds_difference <= 86400 && seconds_difference >= 0);  // Task due in the next 24 hours
+int is_task_overdue(const Task *task) {
+    return task->due_status == DUE_STATUS_OVERDUE;
 }
 
-void add_task(Task **tasks, int *count, int *capacity, const char *title, const char *category, const char *due_date_str, RecurrenceType recurrence, int priority) {
-    ensure_capacity(tasks, capacity, *count + 1);
+int is_task_due_soon(const Task *task) {
+    return task->due_status == DUE_STATUS_SOON;  // Task due in the next 24 hours
+}
 
-    char temp_title[MAX_TITLE_LEN];
-    char temp_category[MAX_CATEGORY_LEN];
+// Ask for the fields of a new task, asking again until each one is valid
+static void ask_task_fields(char *title, char *category, int *due_day, RecurrenceType *recurrence, int *priority) {
     char temp_due_date[MAX_DATE_LEN];
     char temp_recurrence[MAX_RECURRENCE_LEN];
-    int temp_priority;
 
     // Title input with retry if blank
     while (1) {
-        get_input_and_clear(temp_title, MAX_TITLE_LEN, "Enter task title (cannot be empty): ");
-        if (strlen(temp_title) > 0) break;
+        get_input_and_clear(title, MAX_TITLE_LEN, "Enter task title (cannot be empty): ");
+        if (strlen(title) > 0) break;
         mvprintw(LINES - 2, 0, "Task title cannot be empty. Please try again.");
         refresh();
         getch();
@@ -248,8 +268,8 @@ void add_task(Task **tasks, int *count, int *capacity, const char *title, const
 
     // Category input with retry if blank
     while (1) {
-        get_input_and_clear(temp_category, MAX_CATEGORY_LEN, "Enter category (cannot be empty): ");
-        if (strlen(temp_category) > 0) break;
+        get_input_and_clear(category, MAX_CATEGORY_LEN, "Enter category (cannot be empty): ");
+        if (strlen(category) > 0) break;
         mvprintw(LINES - 2, 0, "Category cannot be empty. Please try again.");
         refresh();
         getch();
@@ -259,10 +279,9 @@ void add_task(Task **tasks, int *count, int *capacity, const char *title, const
     while (1) {
         get_input_and_clear(temp_due_date, MAX_DATE_LEN, "Enter due date (YYYY-MM-DD) or leave blank for N/A: ");
         if (strlen(temp_due_date) == 0) {
-            strncpy(temp_due_date, "N/A", MAX_DATE_LEN - 1);
-            temp_due_date[MAX_DATE_LEN - 1] = '\0';
+            *due_day = NO_DUE_DAY;
             break;
-        } else if (parse_date(temp_due_date, &(struct tm){0})) {
+        } else if (parse_date(temp_due_date, due_day)) {
             break;
         } else {
             mvprintw(LINES - 2, 0, "Invalid date format. Please try again.");
@@ -276,7 +295,7 @@ void add_task(Task **tasks, int *count, int *capacity, const char *title, const
         get_input_and_clear(temp_recurrence, MAX_RECURRENCE_LEN, "Enter recurrence (none, daily, weekly, biweekly, monthly, yearly): ");
         RecurrenceType rec = parse_recurrence(temp_recurrence);
         if (rec != -1) {
-            recurrence = rec;
+            *recurrence = rec;
             break;
         } else {
             mvprintw(LINES - 2, 0, "Invalid recurrence. Please try again.");
@@ -293,8 +312,8 @@ void add_task(Task **tasks, int *count, int *capacity, const char *title, const
         char priority_input[3];
         getnstr(priority_input, sizeof(priority_input) - 1);
         noecho();
-        temp_priority = atoi(priority_input);
-        if (temp_priority >= 1 && temp_priority <= 5) {
+        *priority = atoi(priority_input);
+        if (*priority >= 1 && *priority <= 5) {
             break;
         } else {
             mvprintw(LINES - 2, 0, "Invalid priority. Please enter a value between 1 and 5.");
@@ -302,46 +321,163 @@ void add_task(Task **tasks, int *count, int *capacity, const char *title, const
             getch();
         }
     }
+}
+
+// Add a task with the given fields, or with fields asked for one by one when
+// the title is blank. Returns the new task's position.
+int add_task(TaskTable *tasks, const char *title, const char *category, int due_day, RecurrenceType recurrence, int priority) {
+    char temp_title[MAX_TITLE_LEN];
+    char temp_category[MAX_CATEGORY_LEN];
+    bool interactive = title[0] == '\0';
+    if (interactive) {
+        ask_task_fields(temp_title, temp_category, &due_day, &recurrence, &priority);
+        title = temp_title;
+        category = temp_category;
+    }
 
     // Save the task using validated inputs
-    (*tasks)[*count].id = *count + 1;
-    strncpy((*tasks)[*count].title, temp_title, MAX_TITLE_LEN - 1);
-    (*tasks)[*count].title[MAX_TITLE_LEN - 1] = '\0';
-    strncpy((*tasks)[*count].category, temp_category, MAX_CATEGORY_LEN - 1);
-    (*tasks)[*count].category[MAX_CATEGORY_LEN - 1] = '\0';
-    strncpy((*tasks)[*count].due_date, temp_due_date, MAX_DATE_LEN - 1);
-    (*tasks)[*count].due_date[MAX_DATE_LEN - 1] = '\0';
-    (*tasks)[*count].recurrence = recurrence;
-    (*tasks)[*count].priority = temp_priority;
-    (*tasks)[*count].completed = 0;
-
-    // Push action onto the stack
-    if (action_count < MAX_ACTIONS) {
-        action_stack[action_count].type = ACTION_ADD;
-        action_stack[action_count].task = (*tasks)[*count];
-        action_stack[action_count].index = *count;
-        action_count++;
-    }
-
-    (*count)++;
-
-    mvprintw(LINES - 2, 0, "Task added successfully! Press any key...");
-    clrtoeol();
-    refresh();
-    getch();
+    int position = tasks->count;
+    Task *task = append_task(tasks);
+    task->id = new_task_id(position);
+    task->title = store_text(title);
+    task->category = intern_category(category);
+    task->due_day = due_day;
+    update_due_status(task);
+    task->recurrence = recurrence;
+    task->priority = priority;
+    task->completed = 0;
+
+    undo_record(ACTION_ADD, NULL, task);
+    journal_record(ACTION_ADD, task->id, task);
+    task_added(position, task);
+
+    if (interactive) {
+        mvprintw(LINES - 2, 0, "Task added successfully! Press any key...");
+        clrtoeol();
+        refresh();
+        getch();
+    }
     log_message("Task added.");
+    return position;
+}
+
+// Every index follows the task table through these three, so an index is
+// added by updating it here
+
+// A task was added at `position`, or put back there by undo
+void task_added(int position, const Task *task) {
+    search_index_insert(task);
+    bitmap_index_insert(task);
+    due_index_insert(task);
+    sort_index_insert(position, task);
+}
+
+// The task at `position` may have been edited, in any of its fields
+void task_changed(int position, const Task *task) {
+    search_index_update(task);
+    bitmap_index_update(task);
+    due_index_update(task);
+    sort_index_update(position, task);
+}
+
+// The task at `position` is about to become a tombstone
+static void task_removed(int position, const Task *task) {
+    search_index_remove(task);
+    bitmap_index_remove(task);
+    due_index_remove(task);
+    sort_index_remove(position, task);
 }
 
-void remove_task(Task **tasks, int *count, int index) {
-    if (index < 0 || index >= *count) {
-        // Index out of bounds
+// Tombstones in the task table not yet dropped by compact_tasks, and how
+// many of them the last compaction kept for undo
+static int deleted_tasks = 0;
+static int kept_tombstones = 0;
+
+// Delete the task at `position`, leaving a tombstone in its place
+void remove_task(TaskTable *tasks, int position) {
+    if (position < 0 || TASK_IS_DELETED(TASK_AT(tasks, position))) {
         return;
     }
 
-    for (int i = index; i < *count - 1; i++) {
-        (*tasks)[i] = (*tasks)[i + 1];  // Shift tasks down
+    journal_record(ACTION_DELETE, TASK_AT(tasks, position)->id, NULL);
+    select_task(TASK_AT(tasks, position), false);
+    task_removed(position, TASK_AT(tasks, position));
+    task_for_write(tasks, position)->title = NULL;
+    deleted_tasks++;
+}
+
+// Put a task back under its own ID: in its old place while its tombstone is
+// still there, otherwise at the end of the list. Returns its position, or -1
+// if another task has that ID.
+int restore_task(TaskTable *tasks, const Task *task) {
+    int position = task_position(task->id);
+    if (position >= 0) {
+        if (!TASK_IS_DELETED(TASK_AT(tasks, position))) {
+            return -1;
+        }
+        deleted_tasks--;
+        *task_for_write(tasks, position) = *task;
+        return position;
     }
-    (*count)--;
+
+    position = tasks->count;
+    if (!claim_task_id(task->id, position)) {
+        // The slot may still be held by the tombstone of an older task
+        int holder = task_slot_position(task_id_slot(task->id));
+        if (holder < 0 || !TASK_IS_DELETED(TASK_AT(tasks, holder))) {
+            return -1;
+        }
+        release_task_id(TASK_AT(tasks, holder)->id);
+        claim_task_id(task->id, position);
+    }
+    *append_task(tasks) = *task;
+    return position;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int idA = *(const int *)a;
+    int idB = *(const int *)b;
+    return (idA > idB) - (idA < idB);
+}
+
+// Drop the tombstones from the task table, moving the tasks after them down,
+// once enough have built up (or always, when forced). Tombstones of tasks
+// that undo or redo can bring back are kept, so they come back in place; they
+// do not count towards the next compaction.
+void compact_tasks(TaskTable *tasks, bool force) {
+    int droppable = deleted_tasks - kept_tombstones;
+    if (!force && (droppable < COMPACT_MIN_DELETED || droppable * 4 < tasks->count)) {
+        return;
+    }
+
+    int undoable_count;
+    int *undoable = undo_restorable_ids(&undoable_count);
+    qsort(undoable, undoable_count, sizeof(int), compare_ids);
+
+    int kept = 0;
+    deleted_tasks = 0;
+    for (int i = 0; i < tasks->count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            if (task_position(task->id) != i) {
+                continue;  // Its slot was already handed to another task
+            }
+            if (bsearch(&task->id, undoable, undoable_count, sizeof(int), compare_ids) == NULL) {
+                release_task_id(task->id);
+                continue;
+            }
+            deleted_tasks++;
+        }
+        if (kept != i) {
+            *task_for_write(tasks, kept) = *task;
+            move_task_id(task->id, kept);
+        }
+        kept++;
+    }
+    free(undoable);
+    kept_tombstones = deleted_tasks;
+    truncate_tasks(tasks, kept);
+    sort_index_compacted();
 }
 
 void edit_task(Task *task) {
@@ -350,27 +486,18 @@ void edit_task(Task *task) {
     char due_date[MAX_DATE_LEN];
     char recurrence_input[MAX_RECURRENCE_LEN];
     int priority;
-
-    // Push action onto the stack
-    if (action_count < MAX_ACTIONS) {
-        action_stack[action_count].type = ACTION_EDIT;
-        action_stack[action_count].task = *task;
-        action_stack[action_count].index = task->id - 1;
-        action_count++;
-    }
+    Task before = *task;
 
     // Get input for task title
     get_input_and_clear(title, MAX_TITLE_LEN, "Edit task title (leave blank to keep current): ");
     if (strlen(title) > 0) {
-        strncpy(task->title, title, MAX_TITLE_LEN - 1);
-        task->title[MAX_TITLE_LEN - 1] = '\0';  // Ensure null termination
+        task->title = store_text(title);
     }
 
     // Get input for category
     get_input_and_clear(category, MAX_CATEGORY_LEN, "Edit category (leave blank to keep current): ");
     if (strlen(category) > 0) {
-        strncpy(task->category, category, MAX_CATEGORY_LEN - 1);
-        task->category[MAX_CATEGORY_LEN - 1] = '\0';
+        task->category = intern_category(category);
     }
 
     // Get input for due date
@@ -378,9 +505,7 @@ void edit_task(Task *task) {
         get_input_and_clear(due_date, MAX_DATE_LEN, "Edit due date (YYYY-MM-DD, leave blank to keep current): ");
         if (strlen(due_date) == 0) {
             break;
-        } else if (parse_date(due_date, &(struct tm){0})) {
-            strncpy(task->due_date, due_date, MAX_DATE_LEN - 1);
-            task->due_date[MAX_DATE_LEN - 1] = '\0';
+        } else if (parse_date(due_date, &task->due_day)) {
             break;
         } else {
             mvprintw(LINES - 2, 0, "Invalid date format. Please try again.");
@@ -422,6 +547,11 @@ void edit_task(Task *task) {
         }
     }
 
+    update_due_status(task);
+    undo_record(ACTION_EDIT, &before, task);
+    journal_record(ACTION_EDIT, task->id, task);
+    task_changed(task_position(task->id), task);
+
     mvprintw(LINES - 2, 0, "Task edited successfully! Press any key...");
     clrtoeol();
     refresh();
@@ -429,312 +559,606 @@ void edit_task(Task *task) {
     log_message("Task edited.");
 }
 
-void search_task(Task *tasks, int count, int *selected_task) {
+void search_task(const TaskTable *tasks, int *selected_task) {
     char search_query[MAX_TITLE_LEN];
 
-    // Prompt the user to enter the search query (event name)
-    get_input_and_clear(search_query, MAX_TITLE_LEN, "Enter event name to search: ");
-    
-    // Search through tasks
-    for (int i = 0; i < count; i++) {
-        if (strstr(tasks[i].title, search_query) != NULL) {
-            *selected_task = i;  // Set selected task to the found event
-            return;  // Exit once the event is found and selected
-        }
+    // Prompt the user to enter the search query
+    get_input_and_clear(search_query, MAX_TITLE_LEN, "Search titles and categories (blank to clear): ");
+    if (strlen(search_query) == 0) {
+        search_clear();
+        return;
+    }
+
+    // The index is built on first use, so startup does not pay for it
+    if (!search_index_ready()) {
+        search_index_build(tasks);
     }
 
-    // If no event is found
-    mvprintw(LINES - 2, 0, "Event not found. Press any key to continue.");
+    // Select the best match; 'n' and 'N' step through the rest
+    if (search_index_query(search_query) > 0) {
+        *selected_task = sort_view_row(tasks, search_match(0));
+        return;
+    }
+
+    // If no task matches
+    mvprintw(LINES - 2, 0, "No matching tasks. Press any key to continue.");
     clrtoeol();
     refresh();
     getch();  // Wait for user to acknowledge
 }
 
-void load_tasks(Task **tasks, int *count, int *capacity) {
-    char *file_path = get_database_path();
-    FILE *file = fopen(file_path, "r");
-
-    if (file == NULL) {
-        handle_error("Tasks file not found. Starting with an empty task list.");
-        *capacity = 10;
-        *tasks = malloc((*capacity) * sizeof(Task));
-        if (*tasks == NULL) {
-            handle_error("Error allocating memory for tasks.");
-            exit(1);
-        }
-        *count = 0;
+// Move the selection to the next (direction 1) or previous (-1) search match
+void step_search_match(const TaskTable *tasks, int *selected_task, int direction) {
+    int position = search_match(direction);
+    if (position >= 0) {
+        *selected_task = sort_view_row(tasks, position);
         return;
     }
 
-    *capacity = 10;
-    *count = 0;
-    *tasks = malloc((*capacity) * sizeof(Task));
-    if (*tasks == NULL) {
-        handle_error("Error allocating memory for tasks.");
-        exit(1);
-    }
-
-    char line[1024];  // Buffer to hold each line from the file
-
-    while (fgets(line, sizeof(line), file) != NULL) {
-        ensure_capacity(tasks, capacity, *count + 1);
-        Task *task = &(*tasks)[*count];
-
-        // Initialize fields to safe defaults
-        memset(task, 0, sizeof(Task));
-        task->recurrence = RECURRENCE_NONE;
-        strncpy(task->due_date, "N/A", MAX_DATE_LEN - 1);
-        task->due_date[MAX_DATE_LEN - 1] = '\0';
-
-        char recurrence_str[MAX_RECURRENCE_LEN] = "none";
+    mvprintw(LINES - 2, 0, "No search matches. Press 's' to search, then any key to continue.");
+    clrtoeol();
+    refresh();
+    getch();
+    render_invalidate();
+}
 
-        // Parse the line using sscanf
-        int fields_read = sscanf(line, "%d\t%255[^\t]\t%49[^\t]\t%d\t%d\t%11[^\t]\t%9[^\n]",
-                                 &task->id, task->title, task->category,
-                                 &task->priority, &task->completed,
-                                 task->due_date, recurrence_str);
+void load_tasks(TaskTable *tasks) {
+    char *file_path = get_database_path();
+    release_tasks(tasks);
+
+    // Prefer the binary store when one has been created
+    if (access(get_binary_path(), F_OK) == 0 &&
+        load_tasks_binary(get_binary_path(), tasks)) {
+        assign_task_ids(tasks);
+        journal_replay(tasks);
+        compact_tasks(tasks, true);
+        invalidate_due_status();
+        return;
+    }
 
-        if (fields_read >= 6) {
-            // If recurrence was not read, default to "none"
-            if (fields_read == 6) {
-                strncpy(recurrence_str, "none", MAX_RECURRENCE_LEN - 1);
-                recurrence_str[MAX_RECURRENCE_LEN - 1] = '\0';
-            }
-            // Ensure strings are null-terminated
-            task->title[MAX_TITLE_LEN - 1] = '\0';
-            task->category[MAX_CATEGORY_LEN - 1] = '\0';
-            task->due_date[MAX_DATE_LEN - 1] = '\0';
-            recurrence_str[MAX_RECURRENCE_LEN - 1] = '\0';
-
-            // Parse the recurrence string
-            task->recurrence = parse_recurrence(recurrence_str);
-            (*count)++;
-        } else {
-            // Handle malformed lines
-            handle_error("Warning: Skipping malformed line in tasks file.");
-        }
+    if (!load_tasks_text(file_path, tasks)) {
+        handle_error("Tasks file not found. Starting with an empty task list.");
+        return;
     }
 
-    fclose(file);
+    // Bring the base file up to date with changes saved since it was written
+    assign_task_ids(tasks);
+    journal_replay(tasks);
+    compact_tasks(tasks, true);
+    invalidate_due_status();
 }
 
-typedef struct {
-    Task *tasks;
-    int count;
-} SaveArgs;
-
-void *save_tasks_async(void *arg) {
-    SaveArgs *args = (SaveArgs *)arg;
-    pthread_mutex_lock(&task_mutex);
-    save_tasks(args->tasks, args->count);
-    free(args->tasks);
-    free(args);
-    pthread_mutex_unlock(&task_mutex);
-    return NULL;
+// Write a task as one line of the tasks file
+int write_task_line(FILE *file, const Task *task) {
+    char due_date[MAX_DATE_LEN];
+    format_date(due_date, sizeof(due_date), task->due_day);
+    return fprintf(file, "%d\t%s\t%s\t%d\t%d\t%s\t%s\n", task->id, task->title, category_name(task->category),
+                   task->priority, task->completed, due_date, recurrence_strings[task->recurrence]) >= 0;
 }
 
-void trigger_save_tasks(Task *tasks, int count, bool synchronous) {
-    if (synchronous) {
-        // Perform a synchronous save
-        pthread_mutex_lock(&task_mutex);
-        save_tasks(tasks, count);
-        pthread_mutex_unlock(&task_mutex);
-    } else {
-        // Perform an asynchronous save
-        pthread_t save_thread;
-        SaveArgs *args = malloc(sizeof(SaveArgs));
-        if (args == NULL) {
-            handle_error("Error allocating memory for saving tasks.");
-            return;
-        }
-        args->tasks = malloc(count * sizeof(Task));
-        if (args->tasks == NULL) {
-            handle_error("Error allocating memory for saving tasks.");
-            free(args);
-            return;
-        }
-        memcpy(args->tasks, tasks, count * sizeof(Task));
-        args->count = count;
-
-        if (pthread_create(&save_thread, NULL, save_tasks_async, args) != 0) {
-            handle_error("Error creating thread for saving tasks.");
-            free(args->tasks);
-            free(args);
-        } else {
-            pthread_detach(save_thread);
-        }
+int save_tasks(const TaskTable *tasks) {
+    if (is_binary_store_active()) {
+        return save_tasks_binary(get_binary_path(), tasks);
     }
-}
 
-void save_tasks(Task *tasks, int count) {
     char *file_path = get_database_path();
-    FILE *file = fopen(file_path, "w");
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", file_path);
+    FILE *file = fopen(tmp_path, "w");
     if (file == NULL) {
         // Handle file creation failure
         handle_error("Error: Could not open file for saving tasks.");
-        return;
+        return 0;
     }
 
-    for (int i = 0; i < count; i++) {
-        fprintf(file, "%d\t%s\t%s\t%d\t%d\t%s\t%s\n", tasks[i].id, tasks[i].title, tasks[i].category,
-                tasks[i].priority, tasks[i].completed, tasks[i].due_date, recurrence_strings[tasks[i].recurrence]);
+    int ok = 1;
+    for (int i = 0; i < tasks->count; i++) {
+        const Task *task = TASK_AT(tasks, i);
+        if (TASK_IS_DELETED(task)) {
+            continue;
+        }
+        if (!write_task_line(file, task)) {
+            ok = 0;
+            break;
+        }
     }
-
-    fclose(file);
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+
+    // Replace the old file only once the new one is complete on disk
+    if (!ok || rename(tmp_path, file_path) != 0) {
+        handle_error("Error: Could not write tasks file.");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
 }
 
-void display_tasks(Task *tasks, int count, int selected) {
-    clear();  // Clear the screen for updating
+// First task shown at the top of the list; follows the selection around
+static int scroll_offset = 0;
 
-    if (count == 0) {
-        mvprintw(2, 0, "No tasks to display. Press 'a' to add a new task.");
-        mvprintw(LINES - 2, 0, "Press 'h' for help.");
-        refresh();
-        return;
+// Rows available for the task list; the last two lines hold prompts and the footer
+int task_list_height() {
+    return LINES > 3 ? LINES - 2 : 1;
+}
+
+// Draw rows of the task list, keeping row `selected` on screen. `view` lists
+// the positions of the tasks to show, or is NULL to show them all in the
+// current sort order.
+static void display_rows(const TaskTable *tasks, const uint32_t *view, int count, int selected) {
+    // Scroll just far enough to keep the selected task on screen
+    int height = task_list_height();
+    if (selected < scroll_offset) {
+        scroll_offset = selected;
+    } else if (selected >= scroll_offset + height) {
+        scroll_offset = selected - height + 1;
+    }
+    if (scroll_offset > count - height) {
+        scroll_offset = count - height;
+    }
+    if (scroll_offset < 0) {
+        scroll_offset = 0;
     }
 
-    for (int i = 0; i < count; i++) {
-        if (i == selected) {
-            attron(A_REVERSE);
+    int last = scroll_offset + height < count ? scroll_offset + height : count;
+    char due_date[MAX_DATE_LEN];
+    for (int row = scroll_offset; row < last; row++) {
+        const Task *task = TASK_AT(tasks, view != NULL ? (int)view[row] : sort_view_position(tasks, row));
+        attr_t attr = A_NORMAL;
+
+        if (row == selected) {
+            attr |= A_REVERSE;
+        }
+        if (is_task_selected(task) || (view == NULL && select_visual_covers(row, selected))) {
+            attr |= A_BOLD | A_UNDERLINE;  // Part of the multi-selection
         }
 
-        if (is_task_overdue(tasks[i])) {
-            attron(COLOR_PAIR(1));  // Red for overdue tasks
-        } else if (is_task_due_soon(tasks[i])) {
-            attron(COLOR_PAIR(2));  // Yellow for due soon tasks
+        if (is_task_overdue(task)) {
+            attr |= COLOR_PAIR(1);  // Red for overdue tasks
+        } else if (is_task_due_soon(task)) {
+            attr |= COLOR_PAIR(2);  // Yellow for due soon tasks
         }
 
         // Optionally set color based on priority
         // If you prefer not to have the green theme, you can comment out the priority-based coloring
         /*
-        int priority_color = tasks[i].priority + 2;  // Map priority 1-5 to color pairs 3-7
-        attron(COLOR_PAIR(priority_color));
+        attr |= COLOR_PAIR(task->priority + 2);  // Map priority 1-5 to color pairs 3-7
         */
 
         // Display completion status with [ ] or [X]
-        mvprintw(i, 0, "[%c] %s (%s) Priority: %d Due: %s Recurrence: %s", 
-                 tasks[i].completed ? 'X' : ' ', tasks[i].title,
-                 tasks[i].category, tasks[i].priority, tasks[i].due_date, recurrence_strings[tasks[i].recurrence]);
+        format_date(due_date, sizeof(due_date), task->due_day);
+        render_row(row - scroll_offset, attr, "[%c] %s (%s) Priority: %d Due: %s Recurrence: %s",
+                   task->completed ? 'X' : ' ', task->title,
+                   category_name(task->category), task->priority, due_date, recurrence_strings[task->recurrence]);
+    }
+}
 
-        // Turn off priority color if used
-        /*
-        attroff(COLOR_PAIR(priority_color));
-        */
+void display_tasks(TaskTable *tasks, int selected) {
+    refresh_due_status(tasks);  // Only does work once a day or so
+    render_begin();  // Only rows that differ from the last frame are redrawn
 
-        if (is_task_overdue(tasks[i])) {
-            attroff(COLOR_PAIR(1));  // Turn off overdue color
-        } else if (is_task_due_soon(tasks[i])) {
-            attroff(COLOR_PAIR(2));  // Turn off due soon color
+    int count = sort_view_count(tasks);
+    if (count == 0) {
+        scroll_offset = 0;
+        render_row(2, A_NORMAL, "No tasks to display. Press 'a' to add a new task.");
+        render_row(LINES - 1, A_NORMAL, "Press 'h' for help.%s", render_stats());
+        render_end();
+        return;
+    }
+
+    display_rows(tasks, NULL, count, selected);
+    render_row(LINES - 1, A_NORMAL, "Press 'h' for help. Task %d of %d%s%s%s", selected + 1, count,
+               search_status(), select_status(selected), render_stats());
+    render_end();
+}
+
+// Narrow the list down as a filter is typed. Enter selects the highlighted
+// task in the full list, Esc leaves the selection where it was.
+void filter_tasks(TaskTable *tasks, int *selected_task) {
+    int row = 0;
+    int ch;
+    int total = sort_view_count(tasks);
+
+    search_filter_begin(total, sort_view_order(tasks));
+    while (1) {
+        int shown;
+        const uint32_t *view = search_filter_view(&shown);
+        if (row >= shown) {
+            row = shown > 0 ? shown - 1 : 0;
         }
 
-        if (i == selected) {
-            attroff(A_REVERSE);
+        refresh_due_status(tasks);
+        render_begin();
+        display_rows(tasks, view, shown, row);
+        render_row(LINES - 2, A_NORMAL, "/%s", search_filter_text());
+        render_row(LINES - 1, A_NORMAL, "Filter: %d of %d tasks. Enter to select, Esc to cancel.%s",
+                   shown, total, render_stats());
+        render_end();
+
+        ch = getch();
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (shown > 0) {
+                *selected_task = sort_view_row(tasks, view != NULL ? (int)view[row] : sort_view_position(tasks, row));
+            }
+            break;
+        } else if (ch == 27) {  // Esc
+            break;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            search_filter_pop();
+        } else if (ch == KEY_DOWN) {
+            if (row < shown - 1) row++;
+        } else if (ch == KEY_UP) {
+            if (row > 0) row--;
+        } else if (ch == KEY_NPAGE) {
+            row += task_list_height();
+        } else if (ch == KEY_PPAGE) {
+            row = row > task_list_height() ? row - task_list_height() : 0;
+        } else if (ch >= ' ' && ch < 127) {
+            search_filter_push(tasks, ch);
+            row = 0;
         }
     }
+    search_filter_end();
+}
 
-    mvprintw(count + 1, 0, "Press 'h' for help.");
-    refresh();
+// Show only the tasks matching a query such as "priority>=3 and due<today+7"
+// or a saved view as "@NAME" (see query.c). Enter selects the highlighted
+// task in the full list, Space marks it, s saves the query as a view, Esc
+// leaves.
+void view_tasks_where(TaskTable *tasks, int *selected_task) {
+    char query[MAX_TITLE_LEN];
+    char message[160] = "";
+    uint32_t *view;
+
+    get_input_and_clear(query, MAX_TITLE_LEN, "Show tasks where (e.g. priority>=3 and due<today+7, or @VIEW): ");
+    if (strlen(query) == 0) {
+        return;
+    }
+    int shown = tasks_where(tasks, query, &view, message, sizeof(message));
+    if (shown < 0) {
+        mvprintw(LINES - 2, 0, "Invalid query: %s. Press any key...", message);
+        clrtoeol();
+        refresh();
+        getch();
+        return;
+    }
+
+    int row = 0;
+    while (1) {
+        refresh_due_status(tasks);
+        render_begin();
+        if (shown == 0) {
+            render_row(2, A_NORMAL, "No tasks match.");
+        }
+        display_rows(tasks, view, shown, row);
+        if (message[0] != '\0') {
+            render_row(LINES - 2, A_NORMAL, "%s", message);
+        } else {
+            render_row(LINES - 2, A_NORMAL, "Where: %s", query);
+        }
+        render_row(LINES - 1, A_NORMAL, "%d of %d tasks. Enter to select, Space to mark, s to save as a view, Esc to leave.%s%s",
+                   shown, sort_view_count(tasks), select_status(row), render_stats());
+        render_end();
+
+        int ch = getch();
+        message[0] = '\0';
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (shown > 0) {
+                *selected_task = sort_view_row(tasks, view[row]);
+            }
+            break;
+        } else if (ch == 27 || ch == 'q') {
+            break;
+        } else if (ch == 's') {
+            char name[64];
+            char error[128];
+            get_input_and_clear(name, sizeof(name), "Save as view named: ");
+            render_invalidate();
+            if (strlen(name) == 0) {
+                continue;
+            }
+            if (save_view(name, query, error, sizeof(error))) {
+                snprintf(message, sizeof(message), "Saved as @%s.", name);
+            } else {
+                snprintf(message, sizeof(message), "Not saved: %s.", error);
+            }
+        } else if (ch == ' ' && shown > 0) {
+            select_toggle(TASK_AT(tasks, view[row]));
+            if (row < shown - 1) row++;
+        } else if ((ch == 'j' || ch == KEY_DOWN) && row < shown - 1) {
+            row++;
+        } else if ((ch == 'k' || ch == KEY_UP) && row > 0) {
+            row--;
+        } else if (ch == KEY_NPAGE) {
+            row = row + task_list_height() < shown ? row + task_list_height() : (shown > 0 ? shown - 1 : 0);
+        } else if (ch == KEY_PPAGE) {
+            row = row > task_list_height() ? row - task_list_height() : 0;
+        }
+    }
+    free(view);
 }
 
-int parse_date(const char *date_str, struct tm *date) {
-    memset(date, 0, sizeof(struct tm));
-    char *result = strptime(date_str, "%Y-%m-%d", date);
-    return result != NULL;
+// Tasks due today, this week or this month, by day and then priority, looked
+// up in the due-date index (agenda.c). 't', 'w' and 'm' pick the span, '['
+// and ']' move to the previous or next one, Enter selects the highlighted
+// task in the full list, Space marks it, Esc leaves.
+void view_agenda(TaskTable *tasks, int *selected_task) {
+    const char *span = "week";
+    int anchor = today_day();
+    int first_day = 0, last_day = 0;
+    uint32_t *view = NULL;
+    int shown = 0;
+    int row = 0;
+    bool stale = true;
+
+    while (1) {
+        refresh_due_status(tasks);
+        if (stale) {
+            free(view);
+            agenda_span(span, anchor, &first_day, &last_day);
+            shown = agenda_tasks(tasks, first_day, last_day, &view);
+            row = 0;
+            stale = false;
+        }
+
+        char from[MAX_DATE_LEN], to[MAX_DATE_LEN];
+        format_date(from, sizeof(from), first_day);
+        format_date(to, sizeof(to), last_day);
+        render_begin();
+        if (shown == 0) {
+            render_row(2, A_NORMAL, "Nothing is due.");
+        }
+        display_rows(tasks, view, shown, row);
+        if (first_day == last_day) {
+            render_row(LINES - 2, A_NORMAL, "Agenda for %s", from);
+        } else {
+            render_row(LINES - 2, A_NORMAL, "Agenda for %s to %s", from, to);
+        }
+        render_row(LINES - 1, A_NORMAL, "%d tasks due. t/w/m: day/week/month, [/]: previous/next, Enter to select, Esc to leave.%s%s",
+                   shown, select_status(row), render_stats());
+        render_end();
+
+        int ch = getch();
+        if (ch == '\n' || ch == KEY_ENTER) {
+            if (shown > 0) {
+                *selected_task = sort_view_row(tasks, view[row]);
+            }
+            break;
+        } else if (ch == 27 || ch == 'q') {
+            break;
+        } else if (ch == 't' || ch == 'w' || ch == 'm') {
+            span = ch == 't' ? "today" : ch == 'w' ? "week" : "month";
+            anchor = today_day();
+            stale = true;
+        } else if (ch == '[') {
+            anchor = first_day - 1;  // Any day of the previous span
+            stale = true;
+        } else if (ch == ']') {
+            anchor = last_day + 1;
+            stale = true;
+        } else if (ch == ' ' && shown > 0) {
+            select_toggle(TASK_AT(tasks, view[row]));
+            if (row < shown - 1) row++;
+        } else if ((ch == 'j' || ch == KEY_DOWN) && row < shown - 1) {
+            row++;
+        } else if ((ch == 'k' || ch == KEY_UP) && row > 0) {
+            row--;
+        } else if (ch == KEY_NPAGE) {
+            row = row + task_list_height() < shown ? row + task_list_height() : (shown > 0 ? shown - 1 : 0);
+        } else if (ch == KEY_PPAGE) {
+            row = row > task_list_height() ? row - task_list_height() : 0;
+        }
+    }
+    free(view);
 }
 
-void format_date(char *buffer, size_t size, struct tm *date) {
-    strftime(buffer, size, "%Y-%m-%d", date);
+// Days since 1970-01-01 in the proleptic Gregorian calendar. Days past the end
+// of the month carry into the next one, like mktime does.
+int days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
 }
 
-RecurrenceType parse_recurrence(const char *str) {
-    for (int i = 0; i < sizeof(recurrence_strings)/sizeof(recurrence_strings[0]); i++) {
-        if (strcmp(str, recurrence_strings[i]) == 0) {
-            return (RecurrenceType)i;
+void civil_from_days(int days, int *year, int *month, int *day) {
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int day_of_era = days - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int mp = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+// Today's local date as a day number
+int today_day() {
+    time_t t = time(NULL);
+    struct tm now;
+    localtime_r(&t, &now);
+    return days_from_civil(now.tm_year + 1900, now.tm_mon + 1, now.tm_mday);
+}
+
+static int digits(const char *text, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if ((unsigned)(text[i] - '0') > 9) {
+            return -1;
         }
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+// Parse "YYYY-MM-DD" (or the "N/A" marker) into a day number
+int parse_date(const char *date_str, int *day_number) {
+    return parse_date_n(date_str, strlen(date_str), day_number);
+}
+
+// parse_date for text that need not be NUL-terminated, such as a field of the
+// tasks file. Dates as they are saved are converted without a scanf.
+int parse_date_n(const char *text, size_t length, int *day_number) {
+    if (length == strlen(NO_DUE_DATE) && memcmp(text, NO_DUE_DATE, length) == 0) {
+        *day_number = NO_DUE_DAY;
+        return 1;
+    }
+
+    int year, month, day;
+    if (length == 10 && text[4] == '-' && text[7] == '-') {
+        year = digits(text, 4);
+        month = digits(text + 5, 2);
+        day = digits(text + 8, 2);
+        if (year < 0 || month < 0 || day < 0) {
+            return 0;
+        }
+    } else {
+        // Typed dates may leave out leading zeros
+        char date_str[MAX_DATE_LEN];
+        int consumed = 0;
+        if (length >= sizeof(date_str)) {
+            return 0;
+        }
+        memcpy(date_str, text, length);
+        date_str[length] = '\0';
+        if (sscanf(date_str, "%4d-%2d-%2d%n", &year, &month, &day, &consumed) != 3 ||
+            date_str[consumed] != '\0') {
+            return 0;
+        }
+    }
+    // Reject days past the end of the month
+    static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12 || day < 1) {
+        return 0;
+    }
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (day > month_days[month - 1] + (month == 2 && leap)) {
+        return 0;
+    }
+
+    *day_number = days_from_civil(year, month, day);
+    return 1;
+}
+
+void format_date(char *buffer, size_t size, int day_number) {
+    if (day_number == NO_DUE_DAY) {
+        snprintf(buffer, size, "%s", NO_DUE_DATE);
+        return;
+    }
+    int year, month, day;
+    civil_from_days(day_number, &year, &month, &day);
+    snprintf(buffer, size, "%04d-%02d-%02d", year, month, day);
+}
+
+RecurrenceType parse_recurrence(const char *str) {
+    return parse_recurrence_n(str, strlen(str));
+}
+
+// parse_recurrence for text that need not be NUL-terminated. The first letter
+// picks the only name it can be.
+RecurrenceType parse_recurrence_n(const char *text, size_t length) {
+    RecurrenceType candidate;
+    switch (length > 0 ? text[0] : '\0') {
+        case 'd': candidate = RECURRENCE_DAILY; break;
+        case 'w': candidate = RECURRENCE_WEEKLY; break;
+        case 'b': candidate = RECURRENCE_BIWEEKLY; break;
+        case 'm': candidate = RECURRENCE_MONTHLY; break;
+        case 'y': candidate = RECURRENCE_YEARLY; break;
+        default: return RECURRENCE_NONE;  // "none", or not a recurrence at all
+    }
+    const char *name = recurrence_strings[candidate];
+    if (length == strlen(name) && memcmp(text, name, length) == 0) {
+        return candidate;
     }
     // Return RECURRENCE_NONE instead of -1
     return RECURRENCE_NONE;
 }
 
-void undo_last_action(Task **tasks, int *count, int *capacity) {
-    if (action_count == 0) {
+// Recognise only the exact name of a recurrence, "none" included. Unlike
+// parse_recurrence, which reads anything unknown as no recurrence, returns 0
+// for a name that is not one, so callers can reject it.
+int parse_recurrence_name(const char *text, size_t length, RecurrenceType *recurrence) {
+    for (int i = RECURRENCE_NONE; i <= RECURRENCE_YEARLY; i++) {
+        if (length == strlen(recurrence_strings[i]) && memcmp(text, recurrence_strings[i], length) == 0) {
+            *recurrence = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Undo the last action, or the last group of actions done as one
+void undo_last_action(TaskTable *tasks) {
+    int result = undo_step(tasks);
+    if (result == 0) {
         mvprintw(LINES - 2, 0, "Nothing to undo. Press any key...");
-        refresh();
-        getch();
-        return;
+    } else if (result < 0) {
+        mvprintw(LINES - 2, 0, "A task to undo no longer exists. Press any key...");
+    } else {
+        mvprintw(LINES - 2, 0, "Last action undone. Press any key...");
+        log_message("Undo last action.");
     }
-    action_count--;
-    Action last_action = action_stack[action_count];
-    switch (last_action.type) {
-        case ACTION_ADD:
-            // Remove the last added task
-            remove_task(tasks, count, last_action.index);
-            break;
-        case ACTION_DELETE:
-            // Restore the deleted task
-            ensure_capacity(tasks, capacity, *count + 1);
-            for (int i = *count; i > last_action.index; i--) {
-                (*tasks)[i] = (*tasks)[i - 1];
-            }
-            (*tasks)[last_action.index] = last_action.task;
-            (*count)++;
-            break;
-        case ACTION_EDIT:
-            // Restore the previous state of the task
-            (*tasks)[last_action.index] = last_action.task;
-            break;
-        case ACTION_COMPLETE:
-            // Toggle back the completion status
-            (*tasks)[last_action.index] = last_action.task;
-            break;
+    refresh();
+    getch();
+}
+
+void redo_last_action(TaskTable *tasks) {
+    int result = redo_step(tasks);
+    if (result == 0) {
+        mvprintw(LINES - 2, 0, "Nothing to redo. Press any key...");
+    } else if (result < 0) {
+        mvprintw(LINES - 2, 0, "A task to redo no longer exists. Press any key...");
+    } else {
+        mvprintw(LINES - 2, 0, "Last undone action redone. Press any key...");
+        log_message("Redo last undone action.");
     }
-    mvprintw(LINES - 2, 0, "Last action undone. Press any key...");
     refresh();
     getch();
-    log_message("Undo last action.");
 }
 
 void show_help() {
-    clear();
+    erase();
     mvprintw(0, 0, "Help Menu");
     mvhline(1, 0, '-', COLS);
     mvprintw(2, 0, "Navigation:");
-    mvprintw(3, 2, "'j' - Move down");
-    mvprintw(4, 2, "'k' - Move up");
+    mvprintw(3, 2, "'j'/'k' - Move down/up");
+    mvprintw(4, 2, "PgDn/PgUp - Move down/up a page");
     mvprintw(5, 0, "Actions:");
     mvprintw(6, 2, "'a' - Add a new task");
-    mvprintw(7, 2, "'d' - Delete the selected task");
-    mvprintw(8, 2, "'e' - Edit the selected task");
-    mvprintw(9, 2, "'c' - Toggle completion status");
-    mvprintw(10, 2, "'s' - Search for a task");
-    mvprintw(11, 2, "'P' - Sort tasks by priority");
-    mvprintw(12, 2, "'S' - Sort tasks by due date");
-    mvprintw(13, 2, "'u' - Undo last action");
-    mvprintw(14, 2, "'h' - Show this help menu");
-    mvprintw(15, 2, "'q' - Quit the application");
+    mvprintw(7, 2, "'d' - Delete the selected task, or all marked tasks");
+    mvprintw(8, 2, "'e' - Edit the selected task, or set priority and category of all marked tasks");
+    mvprintw(9, 2, "'c' - Toggle completion status of the selected task, or of all marked tasks");
+    mvprintw(10, 2, "Space/'v'/'V' - Mark the task / a range ('v' again ends it) / tasks by query");
+    mvprintw(11, 2, "Esc - Clear the marks");
+    mvprintw(12, 2, "'s' - Search titles and categories");
+    mvprintw(13, 2, "'n'/'N' - Go to the next/previous search match");
+    mvprintw(14, 2, "'/' - Filter the list as you type; 'F' - Show tasks matching a query or @VIEW");
+    mvprintw(15, 2, "'A' - Agenda: tasks due today, this week or this month");
+    mvprintw(16, 2, "'P'/'S' - Sort tasks by priority/due date");
+    mvprintw(17, 2, "'O' - Sort by several fields, e.g. -priority,due,title");
+    mvprintw(18, 2, "'u' - Undo last action");
+    mvprintw(19, 2, "Ctrl-R - Redo the last undone action");
+    mvprintw(20, 2, "'h' - Show this help menu");
+    mvprintw(21, 2, "'q' - Quit the application");
     mvprintw(LINES - 2, 0, "Press any key to return.");
     refresh();
     getch();
 }
 
-void log_message(const char *message) {
-    char log_path[512];
-    snprintf(log_path, sizeof(log_path), "%s/%s", getenv("HOME"), LOG_FILE_PATH);
-    FILE *log_file = fopen(log_path, "a");
-    if (log_file != NULL) {
-        time_t now = time(NULL);
-        char time_str[26];
-        ctime_r(&now, time_str);
-        time_str[strlen(time_str) - 1] = '\0';  // Remove newline character
-        fprintf(log_file, "%s: %s\n", time_str, message);
-        fclose(log_file);
-    }
-}
-
 void handle_error(const char *message) {
+    if (stdscr == NULL) {
+        // Running without a screen (e.g. converting the task store)
+        fprintf(stderr, "%s\n", message);
+        log_at(LOG_ERROR, "%s", message);
+        return;
+    }
     mvprintw(LINES - 2, 0, "%s", message);
     refresh();
-    log_message(message);
+    log_at(LOG_ERROR, "%s", message);
 }
 
 char *get_database_path() {
@@ -742,10 +1166,15 @@ char *get_database_path() {
     char *home = getenv("HOME");
     snprintf(file_path, sizeof(file_path), "%s/%s", home, LOCAL_FILE_PATH);
 
-    // Ensure the directory exists, create it if not
+    // Ensure the directory exists, create it and any missing parents if not
     char dir_path[512];
     snprintf(dir_path, sizeof(dir_path), "%s/.local/share/todo", home);
     if (access(dir_path, F_OK) != 0) {
+        for (char *slash = strchr(dir_path + strlen(home) + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            mkdir(dir_path, 0755);
+            *slash = '/';
+        }
         mkdir(dir_path, 0755);  // Create the directory with appropriate permissions
     }
 
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "todo.h"
+
+// Text store for the cold part of a task.
+//
+// Titles are copied into a bump-allocated arena of large chunks, so a title
+// costs its own length plus a terminator and nothing else, with no length
+// limit. Categories repeat heavily, so each distinct name is interned once
+// and tasks refer to it by a small integer ID; comparing categories is then
+// an integer compare.
+//
+// Stored text is never modified or freed while the program runs: editing a
+// task stores a new string and repoints the task. That keeps a Task a plain
+// value, so the undo history and the snapshots taken for background saves can
+// copy rows without copying or owning any text. Chunks never move and the
+// category directory is fixed, so a save thread can read text while the UI
+// thread adds more. Superseded titles are only reclaimed at exit, which costs
+// memory in proportion to the edits made in one session.
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define CATEGORY_BLOCK_SIZE 1024
+#define CATEGORY_BLOCKS 1024
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    void *addr;
+    size_t size;
+} TextMapping;
+
+static ArenaChunk *chunks = NULL;  // Current chunk first
+static TextMapping *mappings = NULL;
+static int mapping_count = 0;
+
+// Category names by ID, in fixed blocks so that readers never see them move
+static const char **category_blocks[CATEGORY_BLOCKS];
+static uint32_t categories = 0;
+// Open-addressing hash of category IDs + 1 (0 marks an empty slot)
+static uint32_t *category_slots = NULL;
+static uint32_t category_slot_count = 0;
+
+static void *arena_alloc(size_t size) {
+    if (chunks == NULL || chunks->size - chunks->used < size) {
+        // Oversized strings get a chunk of their own behind the current one
+        size_t chunk_size = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+        ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (chunk == NULL) {
+            handle_error("Error allocating memory for task text.");
+            exit(1);
+        }
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        if (chunk_size == size && chunks != NULL) {
+            chunk->next = chunks->next;
+            chunks->next = chunk;
+        } else {
+            chunk->next = chunks;
+            chunks = chunk;
+        }
+        chunk->used = size;
+        return chunk->data;
+    }
+    void *p = chunks->data + chunks->used;
+    chunks->used += size;
+    return p;
+}
+
+const char *store_text_n(const char *text, size_t length) {
+    char *copy = arena_alloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+const char *store_text(const char *text) {
+    return store_text_n(text, strlen(text));
+}
+
+static uint32_t hash_text(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void grow_category_slots() {
+    uint32_t count = category_slot_count ? category_slot_count * 2 : 64;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (slots == NULL) {
+        handle_error("Error allocating memory for categories.");
+        exit(1);
+    }
+    for (uint32_t id = 0; id < categories; id++) {
+        const char *name = category_name(id);
+        uint32_t slot = hash_text(name, strlen(name)) & (count - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (count - 1);
+        }
+        slots[slot] = id + 1;
+    }
+    free(category_slots);
+    category_slots = slots;
+    category_slot_count = count;
+}
+
+// ID of the category with this name, adding it if it is new
+uint32_t intern_category_n(const char *name, size_t length) {
+    if (categories * 2 >= category_slot_count) {
+        grow_category_slots();
+    }
+
+    uint32_t slot = hash_text(name, length) & (category_slot_count - 1);
+    while (category_slots[slot] != 0) {
+        const char *existing = category_name(category_slots[slot] - 1);
+        if (strncmp(existing, name, length) == 0 && existing[length] == '\0') {
+            return category_slots[slot] - 1;
+        }
+        slot = (slot + 1) & (category_slot_count - 1);
+    }
+
+    uint32_t id = categories;
+    uint32_t block = id / CATEGORY_BLOCK_SIZE;
+    if (block >= CATEGORY_BLOCKS) {
+        handle_error("Error: Too many distinct categories.");
+        exit(1);
+    }
+    if (category_blocks[block] == NULL) {
+        category_blocks[block] = malloc(CATEGORY_BLOCK_SIZE * sizeof(const char *));
+        if (category_blocks[block] == NULL) {
+            handle_error("Error allocating memory for categories.");
+            exit(1);
+        }
+    }
+    category_blocks[block][id % CATEGORY_BLOCK_SIZE] = store_text_n(name, length);
+    category_slots[slot] = id + 1;
+    categories++;
+    return id;
+}
+
+uint32_t intern_category(const char *name) {
+    return intern_category_n(name, strlen(name));
+}
+
+const char *category_name(uint32_t id) {
+    if (id >= categories) {
+        return "";
+    }
+    return category_blocks[id / CATEGORY_BLOCK_SIZE][id % CATEGORY_BLOCK_SIZE];
+}
+
+uint32_t category_count() {
+    return categories;
+}
+
+// Take ownership of a mapped file whose strings tasks point into directly
+void store_text_mapping(void *addr, size_t size) {
+    TextMapping *temp = realloc(mappings, (mapping_count + 1) * sizeof(TextMapping));
+    if (temp == NULL) {
+        handle_error("Error allocating memory for task text.");
+        exit(1);
+    }
+    mappings = temp;
+    mappings[mapping_count].addr = addr;
+    mappings[mapping_count].size = size;
+    mapping_count++;
+}
+
+void free_text_store() {
+    while (chunks != NULL) {
+        ArenaChunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+
+    for (uint32_t block = 0; block < CATEGORY_BLOCKS && category_blocks[block] != NULL; block++) {
+        free(category_blocks[block]);
+        category_blocks[block] = NULL;
+    }
+    categories = 0;
+    free(category_slots);
+    category_slots = NULL;
+    category_slot_count = 0;
+
+    for (int i = 0; i < mapping_count; i++) {
+        munmap(mappings[i].addr, mappings[i].size);
+    }
+    free(mappings);
+    mappings = NULL;
+    mapping_count = 0;
+}
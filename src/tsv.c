@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "todo.h"
+
+// Task file parser.
+//
+// tasks.txt has one task per line: ID, title, category, priority, completion,
+// due date and recurrence, separated by tabs; the recurrence may be left
+// out. The file is mapped privately and split with memchr, first into lines
+// and then into fields, and every field is converted where it lies: numbers
+// and dates are read digit by digit and the tab after each title is
+// overwritten with a NUL, so the title can be used in place. The mapping is
+// handed to the text store and lives as long as the titles do, like that of
+// the binary store.
+//
+// Large files are parsed by one thread per core. The file is cut into as
+// many parts, each ending at a line boundary, and every thread parses its
+// part into a buffer of its own, sized from the number of lines in it. The
+// category store is not shared between threads, so each part numbers the
+// categories it meets itself. Once all are done the parts are merged in file
+// order: their categories are interned, their rows are copied into the task
+// table with the categories renumbered, and the table is sized for all of
+// them up front.
+//
+// A line that does not have this shape, or whose priority is not 1 to 5, is
+// skipped with a warning naming its line number. Blank lines are skipped
+// silently.
+
+#define TSV_FIELDS 7
+
+// Parts are at least this large, so small files are read by a single thread
+#define MIN_PART_SIZE (1024 * 1024)
+#define MAX_PARTS 64
+
+// Categories met in one part, numbered in order of first appearance
+typedef struct {
+    const char **names;      // Point into the mapping
+    uint32_t *lengths;
+    uint32_t count;
+    uint32_t *slots;         // Open addressing, IDs + 1 (0 marks an empty slot)
+    uint32_t slot_count;
+} PartCategories;
+
+typedef struct {
+    char *begin;
+    char *end;
+    Task *tasks;             // Rows parsed, with categories from `categories`
+    int count;
+    int lines;
+    int *malformed;          // Line numbers within the part
+    int malformed_count;
+    int malformed_capacity;
+    PartCategories categories;
+} ParsePart;
+
+static void *parse_alloc(void *memory, size_t size) {
+    memory = realloc(memory, size);
+    if (memory == NULL) {
+        handle_error("Error allocating memory for tasks.");
+        exit(1);
+    }
+    return memory;
+}
+
+static uint32_t hash_name(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void grow_part_categories(PartCategories *categories) {
+    uint32_t slot_count = categories->slot_count ? categories->slot_count * 2 : 64;
+    uint32_t *slots = parse_alloc(NULL, slot_count * sizeof(uint32_t));
+    memset(slots, 0, slot_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < categories->count; id++) {
+        uint32_t slot = hash_name(categories->names[id], categories->lengths[id]) & (slot_count - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = id + 1;
+    }
+    free(categories->slots);
+    categories->slots = slots;
+    categories->slot_count = slot_count;
+    categories->names = parse_alloc(categories->names, slot_count / 2 * sizeof(const char *));
+    categories->lengths = parse_alloc(categories->lengths, slot_count / 2 * sizeof(uint32_t));
+}
+
+static uint32_t part_category(PartCategories *categories, const char *name, uint32_t length) {
+    if (categories->count * 2 >= categories->slot_count) {
+        grow_part_categories(categories);
+    }
+    uint32_t slot = hash_name(name, length) & (categories->slot_count - 1);
+    while (categories->slots[slot] != 0) {
+        uint32_t id = categories->slots[slot] - 1;
+        if (categories->lengths[id] == length && memcmp(categories->names[id], name, length) == 0) {
+            return id;
+        }
+        slot = (slot + 1) & (categories->slot_count - 1);
+    }
+    uint32_t id = categories->count++;
+    categories->names[id] = name;
+    categories->lengths[id] = length;
+    categories->slots[slot] = id + 1;
+    return id;
+}
+
+// Parse an integer field, with an optional minus sign and nothing else
+static bool parse_int(const char *p, const char *end, int *value) {
+    bool negative = p < end && *p == '-';
+    p += negative;
+    if (p == end || end - p > 10) {
+        return false;
+    }
+    int64_t n = 0;
+    for (; p < end; p++) {
+        if ((unsigned)(*p - '0') > 9) {
+            return false;
+        }
+        n = n * 10 + (*p - '0');
+    }
+    if (n > INT_MAX) {
+        return false;
+    }
+    *value = negative ? (int)-n : (int)n;
+    return true;
+}
+
+// Convert the line in [line, end), without its newline, into `task`
+static bool parse_line(char *line, char *end, Task *task, PartCategories *categories) {
+    // field[i] starts field i, and field[i + 1] - 1 is where it ends
+    char *field[TSV_FIELDS + 1];
+    int fields = 1;
+    field[0] = line;
+    while (fields < TSV_FIELDS) {
+        char *tab = memchr(field[fields - 1], '\t', end - field[fields - 1]);
+        if (tab == NULL) {
+            break;
+        }
+        field[fields++] = tab + 1;
+    }
+    field[fields] = end + 1;
+    if (fields < TSV_FIELDS - 1 || field[2] - field[1] < 2 || field[3] - field[2] < 2) {
+        return false;  // Missing fields, or a blank title or category
+    }
+
+    int id, priority, completed;
+    if (!parse_int(field[0], field[1] - 1, &id) ||
+        !parse_int(field[3], field[4] - 1, &priority) ||
+        !parse_int(field[4], field[5] - 1, &completed)) {
+        return false;
+    }
+    if (priority < 1 || priority > 5) {
+        return false;  // Would not fit the byte it is kept in, or the colors
+    }
+
+    memset(task, 0, sizeof(Task));
+    task->id = id;
+    field[2][-1] = '\0';
+    task->title = field[1];
+    task->category = part_category(categories, field[2], field[3] - field[2] - 1);
+    task->priority = priority;
+    task->completed = completed;
+    // Dates are kept as day numbers; anything unparsable means no due date
+    if (!parse_date_n(field[5], field[6] - field[5] - 1, &task->due_day)) {
+        task->due_day = NO_DUE_DAY;
+    }
+    task->recurrence = fields == TSV_FIELDS ? parse_recurrence_n(field[6], end - field[6]) : RECURRENCE_NONE;
+    return true;
+}
+
+static void *parse_part(void *arg) {
+    ParsePart *part = arg;
+
+    // Every row needs a line, so counting them sizes the buffer exactly
+    int lines = 0;
+    for (char *p = part->begin; p < part->end; lines++) {
+        char *newline = memchr(p, '\n', part->end - p);
+        p = newline != NULL ? newline + 1 : part->end;
+    }
+    part->tasks = parse_alloc(NULL, (lines + 1) * sizeof(Task));
+
+    char *p = part->begin;
+    while (p < part->end) {
+        char *newline = memchr(p, '\n', part->end - p);
+        char *end = newline != NULL ? newline : part->end;
+        char *next = end + 1;
+        part->lines++;
+        if (end > p && end[-1] == '\r') {
+            end--;
+        }
+
+        if (end > p) {
+            if (parse_line(p, end, &part->tasks[part->count], &part->categories)) {
+                part->count++;
+            } else {
+                if (part->malformed_count == part->malformed_capacity) {
+                    part->malformed_capacity = part->malformed_capacity ? part->malformed_capacity * 2 : 16;
+                    part->malformed = parse_alloc(part->malformed, part->malformed_capacity * sizeof(int));
+                }
+                part->malformed[part->malformed_count++] = part->lines;
+            }
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+// Cut [map, map + size) into up to `count` parts that end at line boundaries
+static int split_parts(char *map, size_t size, ParsePart *parts, int count) {
+    char *file_end = map + size;
+    char *begin = map;
+    int made = 0;
+    for (int i = 0; i < count && begin < file_end; i++) {
+        char *end = i == count - 1 ? file_end : map + size / count * (i + 1);
+        if (end < begin) {
+            end = begin;
+        }
+        char *newline = memchr(end, '\n', file_end - end);
+        end = newline != NULL ? newline + 1 : file_end;
+
+        memset(&parts[made], 0, sizeof(ParsePart));
+        parts[made].begin = begin;
+        parts[made].end = end;
+        made++;
+        begin = end;
+    }
+    return made;
+}
+
+// Append the parts' rows to `tasks` in file order, interning their
+// categories, and report their malformed lines
+static void merge_parts(ParsePart *parts, int count, TaskTable *tasks) {
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        total += parts[i].count;
+    }
+    reserve_tasks(tasks, total);
+
+    int line_base = 0;
+    for (int i = 0; i < count; i++) {
+        ParsePart *part = &parts[i];
+        for (int j = 0; j < part->malformed_count; j++) {
+            char message[96];
+            snprintf(message, sizeof(message), "Warning: Skipping malformed line %d in tasks file.",
+                     line_base + part->malformed[j]);
+            handle_error(message);
+        }
+        line_base += part->lines;
+
+        uint32_t *category_ids = parse_alloc(NULL, (part->categories.count + 1) * sizeof(uint32_t));
+        for (uint32_t id = 0; id < part->categories.count; id++) {
+            category_ids[id] = intern_category_n(part->categories.names[id], part->categories.lengths[id]);
+        }
+        for (int j = 0; j < part->count; j++) {
+            part->tasks[j].category = category_ids[part->tasks[j].category];
+        }
+        append_tasks(tasks, part->tasks, part->count);
+
+        free(category_ids);
+        free(part->tasks);
+        free(part->malformed);
+        free(part->categories.names);
+        free(part->categories.lengths);
+        free(part->categories.slots);
+    }
+}
+
+static int parse_threads(size_t size) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = (long)(size / MIN_PART_SIZE);
+    if (threads > cores) {
+        threads = cores;
+    }
+    if (threads > MAX_PARTS) {
+        threads = MAX_PARTS;
+    }
+    return threads > 1 ? (int)threads : 1;
+}
+
+// Append the tasks in the text file at `path` to `tasks`. Returns 0 if the
+// file cannot be opened.
+int load_tasks_text(const char *path, TaskTable *tasks) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    // Private and writable, so titles can be terminated in place
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        handle_error("Error mapping tasks file.");
+        exit(1);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    ParsePart parts[MAX_PARTS];
+    pthread_t threads[MAX_PARTS];
+    bool started[MAX_PARTS];
+    int count = split_parts(map, st.st_size, parts, parse_threads(st.st_size));
+
+    // The first part is parsed here while the threads take the rest; a part
+    // whose thread cannot be started is parsed here too
+    for (int i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, parse_part, &parts[i]) == 0;
+    }
+    parse_part(&parts[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            parse_part(&parts[i]);
+        }
+    }
+    merge_parts(parts, count, tasks);
+
+    store_text_mapping(map, st.st_size);
+    return 1;
+}
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "todo.h"
+
+// Undo history.
+//
+// Every change to a task is recorded as a delta: the task's ID and, for each
+// field the change touched, its value before and after. An add keeps only the
+// new task and a delete only the old one; an edit that changed the priority
+// costs a dozen bytes. Titles are text store pointers, which stay valid for
+// the whole session (see text.c), so no text is copied.
+//
+// The records are packed back to back in one byte buffer, and an array of
+// offsets marks where each step starts. A step is one record, or every record
+// made between undo_begin_group and undo_end_group, so an operation on many
+// tasks undoes in one go. Steps before done_steps can be undone, the ones
+// after it redone; recording a new change forgets the redoable ones.
+//
+// The history, records and offsets together, is bounded by a number of bytes
+// rather than of steps: UNDO_HISTORY_SIZE, or TODO_UNDO_HISTORY_MB megabytes
+// when that is set, with 0 meaning only by memory. Past the limit, or when
+// the history cannot grow, the oldest steps are dropped from the front, and
+// the buffer is moved down once the dropped part makes up half of it, so the
+// window slides along like a ring without records ever wrapping around.
+
+enum {
+    FIELD_TITLE = 1 << 0,
+    FIELD_CATEGORY = 1 << 1,
+    FIELD_DUE = 1 << 2,
+    FIELD_PRIORITY = 1 << 3,
+    FIELD_COMPLETED = 1 << 4,
+    FIELD_RECURRENCE = 1 << 5,
+    ALL_FIELDS = (1 << 6) - 1
+};
+
+// Largest record: the header and every field twice
+#define MAX_RECORD_SIZE (6 + 2 * (sizeof(const char *) + 4 + 4 + 3))
+
+// A record decoded; only the fields in `fields` of before and after are set
+typedef struct {
+    ActionType type;
+    int id;
+    uint8_t fields;
+    Task before;   // Unset for an add
+    Task after;    // Unset for a delete
+} Change;
+
+static uint8_t *history = NULL;
+static size_t history_length = 0;
+static size_t history_capacity = 0;
+
+static size_t *steps = NULL;     // Offset of each step's first record
+static int first_step = 0;       // Oldest step kept
+static int step_count = 0;
+static int step_capacity = 0;
+static int done_steps = 0;       // Steps that can be undone end here
+
+static size_t history_limit = UNDO_HISTORY_SIZE;  // 0 when only memory bounds it
+static bool limit_read = false;
+
+static int group_depth = 0;
+static bool group_started = false;  // The open group has a step already
+
+static void *undo_realloc(void *memory, size_t size) {
+    void *temp = realloc(memory, size);
+    if (temp == NULL) {
+        handle_error("Error allocating memory for the undo history.");
+        exit(1);
+    }
+    return temp;
+}
+
+static size_t step_end(int step) {
+    return step + 1 < step_count ? steps[step + 1] : history_length;
+}
+
+static uint8_t *put_fields(uint8_t *out, uint8_t fields, const Task *task) {
+    if (fields & FIELD_TITLE) {
+        memcpy(out, &task->title, sizeof(task->title));
+        out += sizeof(task->title);
+    }
+    if (fields & FIELD_CATEGORY) {
+        memcpy(out, &task->category, 4);
+        out += 4;
+    }
+    if (fields & FIELD_DUE) {
+        memcpy(out, &task->due_day, 4);
+        out += 4;
+    }
+    if (fields & FIELD_PRIORITY) {
+        *out++ = task->priority;
+    }
+    if (fields & FIELD_COMPLETED) {
+        *out++ = task->completed;
+    }
+    if (fields & FIELD_RECURRENCE) {
+        *out++ = task->recurrence;
+    }
+    return out;
+}
+
+static const uint8_t *get_fields(const uint8_t *in, uint8_t fields, Task *task) {
+    if (fields & FIELD_TITLE) {
+        memcpy(&task->title, in, sizeof(task->title));
+        in += sizeof(task->title);
+    }
+    if (fields & FIELD_CATEGORY) {
+        memcpy(&task->category, in, 4);
+        in += 4;
+    }
+    if (fields & FIELD_DUE) {
+        memcpy(&task->due_day, in, 4);
+        in += 4;
+    }
+    if (fields & FIELD_PRIORITY) {
+        task->priority = *in++;
+    }
+    if (fields & FIELD_COMPLETED) {
+        task->completed = *in++;
+    }
+    if (fields & FIELD_RECURRENCE) {
+        task->recurrence = *in++;
+    }
+    return in;
+}
+
+// Decode the record at `offset` and return the offset after it
+static size_t get_change(size_t offset, Change *change) {
+    const uint8_t *in = history + offset;
+    memset(change, 0, sizeof(*change));
+    change->type = in[0];
+    change->fields = in[1];
+    memcpy(&change->id, in + 2, 4);
+    in += 6;
+    if (change->type != ACTION_ADD) {
+        in = get_fields(in, change->fields, &change->before);
+    }
+    if (change->type != ACTION_DELETE) {
+        in = get_fields(in, change->fields, &change->after);
+    }
+    change->before.id = change->after.id = change->id;
+    return in - history;
+}
+
+static uint8_t changed_fields(const Task *before, const Task *after) {
+    uint8_t fields = 0;
+    fields |= before->title != after->title ? FIELD_TITLE : 0;
+    fields |= before->category != after->category ? FIELD_CATEGORY : 0;
+    fields |= before->due_day != after->due_day ? FIELD_DUE : 0;
+    fields |= before->priority != after->priority ? FIELD_PRIORITY : 0;
+    fields |= before->completed != after->completed ? FIELD_COMPLETED : 0;
+    fields |= before->recurrence != after->recurrence ? FIELD_RECURRENCE : 0;
+    return fields;
+}
+
+// Memory taken by the steps from `step` on, records and offsets
+static size_t history_size(int step) {
+    return history_length - steps[step] + (step_count - step) * sizeof(size_t);
+}
+
+// Drop the oldest steps while the history takes more than `limit` bytes,
+// keeping the newest one whatever its size. The buffer is moved down once the
+// dropped part makes up half of it, or at once when `compact` is set.
+static void drop_steps(size_t limit, bool compact) {
+    while (first_step < step_count - 1 && history_size(first_step) > limit) {
+        first_step++;
+    }
+    size_t dropped = steps[first_step];
+    if (dropped == 0 || (!compact && dropped < history_length / 2)) {
+        return;
+    }
+    memmove(history, history + dropped, history_length - dropped);
+    history_length -= dropped;
+    for (int i = first_step; i < step_count; i++) {
+        steps[i - first_step] = steps[i] - dropped;
+    }
+    step_count -= first_step;
+    done_steps -= first_step;
+    first_step = 0;
+}
+
+static void read_history_limit() {
+    const char *megabytes = getenv("TODO_UNDO_HISTORY_MB");
+    char *end;
+    if (megabytes != NULL && *megabytes != '\0') {
+        unsigned long long value = strtoull(megabytes, &end, 10);
+        if (*end == '\0' && value <= SIZE_MAX / (1024 * 1024)) {
+            history_limit = value * 1024 * 1024;
+        }
+    }
+    limit_read = true;
+}
+
+// Called when the history cannot grow: forget its older half to make room.
+// Only when nothing is left to forget is running out of memory an error.
+static void forget_older_half() {
+    if (step_count == 0 || (first_step == step_count - 1 && steps[first_step] == 0)) {
+        handle_error("Error allocating memory for the undo history.");
+        exit(1);
+    }
+    drop_steps(history_size(first_step) / 2, true);
+    log_at(LOG_WARNING, "Undo history out of memory; forgot the older half of it.");
+}
+
+// Record a change to a task: `before` is NULL for an add and `after` NULL for
+// a delete. An edit that changed nothing is not recorded.
+void undo_record(ActionType type, const Task *before, const Task *after) {
+    uint8_t fields = ALL_FIELDS;
+    if (before != NULL && after != NULL) {
+        fields = changed_fields(before, after);
+        if (fields == 0) {
+            return;
+        }
+    }
+
+    uint8_t record[MAX_RECORD_SIZE];
+    int id = before != NULL ? before->id : after->id;
+    uint8_t *out = record;
+    *out++ = type;
+    *out++ = fields;
+    memcpy(out, &id, 4);
+    out += 4;
+    if (before != NULL) {
+        out = put_fields(out, fields, before);
+    }
+    if (after != NULL) {
+        out = put_fields(out, fields, after);
+    }
+
+    // A new change forgets whatever could be redone
+    if (done_steps < step_count) {
+        history_length = steps[done_steps];
+        step_count = done_steps;
+        group_started = false;
+    }
+
+    if (group_depth == 0 || !group_started) {
+        while (step_count == step_capacity) {
+            int capacity = step_capacity ? step_capacity * 2 : 256;
+            size_t *temp = realloc(steps, capacity * sizeof(size_t));
+            if (temp == NULL) {
+                forget_older_half();
+                continue;
+            }
+            steps = temp;
+            step_capacity = capacity;
+        }
+        steps[step_count++] = history_length;
+        done_steps = step_count;
+        group_started = group_depth > 0;
+    }
+
+    size_t size = out - record;
+    while (history_length + size > history_capacity) {
+        size_t capacity = history_capacity ? history_capacity * 2 : 4096;
+        uint8_t *temp = realloc(history, capacity);
+        if (temp == NULL) {
+            forget_older_half();
+            continue;
+        }
+        history = temp;
+        history_capacity = capacity;
+    }
+    memcpy(history + history_length, record, size);
+    history_length += size;
+
+    if (!limit_read) {
+        read_history_limit();
+    }
+    if (history_limit > 0) {
+        drop_steps(history_limit, false);
+    }
+}
+
+// Changes recorded until the matching undo_end_group undo as one step.
+// Groups nest; only the outermost one makes a step.
+void undo_begin_group() {
+    if (group_depth++ == 0) {
+        group_started = false;
+    }
+}
+
+void undo_end_group() {
+    if (group_depth > 0) {
+        group_depth--;
+    }
+}
+
+// Apply a change, backwards for undo. Returns 0 if its task is gone.
+static int apply_change(TaskTable *tasks, const Change *change, bool undo) {
+    bool removes = change->type == (undo ? ACTION_ADD : ACTION_DELETE);
+    bool restores = change->type == (undo ? ACTION_DELETE : ACTION_ADD);
+    const Task *target = undo ? &change->before : &change->after;
+    int position = task_position(change->id);
+
+    if (restores) {
+        // Back in its old place while its tombstone is there
+        position = restore_task(tasks, target);
+        if (position < 0) {
+            return 0;
+        }
+        Task *task = task_for_write(tasks, position);
+        update_due_status(task);
+        journal_record(ACTION_ADD, task->id, task);
+        task_added(position, task);
+        return 1;
+    }
+
+    if (position < 0 || TASK_IS_DELETED(TASK_AT(tasks, position))) {
+        return 0;
+    }
+    if (removes) {
+        remove_task(tasks, position);
+        return 1;
+    }
+
+    // Only the fields the change touched, so later edits to others stay
+    Task *task = task_for_write(tasks, position);
+    uint8_t buffer[MAX_RECORD_SIZE];
+    put_fields(buffer, change->fields, target);
+    get_fields(buffer, change->fields, task);
+    update_due_status(task);
+    journal_record(ACTION_EDIT, task->id, task);
+    task_changed(position, task);
+    return 1;
+}
+
+// Offsets of the records of one step, reused between calls
+static size_t *step_records = NULL;
+static int step_records_capacity = 0;
+
+static int collect_records(int step) {
+    int count = 0;
+    for (size_t offset = steps[step]; offset < step_end(step); count++) {
+        if (count == step_records_capacity) {
+            step_records_capacity = step_records_capacity ? step_records_capacity * 2 : 64;
+            step_records = undo_realloc(step_records, step_records_capacity * sizeof(size_t));
+        }
+        step_records[count] = offset;
+        Change change;
+        offset = get_change(offset, &change);
+    }
+    return count;
+}
+
+// Undo the last step, its changes in reverse order. Returns 0 if there is
+// nothing to undo, -1 if some of its tasks no longer exist, 1 otherwise.
+int undo_step(TaskTable *tasks) {
+    if (done_steps == first_step) {
+        return 0;
+    }
+    int step = --done_steps;
+    int count = collect_records(step);
+    int result = 1;
+    for (int i = count - 1; i >= 0; i--) {
+        Change change;
+        get_change(step_records[i], &change);
+        if (!apply_change(tasks, &change, true)) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Redo the last step undone, as undo_step
+int redo_step(TaskTable *tasks) {
+    if (done_steps == step_count) {
+        return 0;
+    }
+    int step = done_steps++;
+    int result = 1;
+    for (size_t offset = steps[step]; offset < step_end(step);) {
+        Change change;
+        offset = get_change(offset, &change);
+        if (!apply_change(tasks, &change, false)) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// IDs of deleted tasks that undo or redo can bring back: deletes that can be
+// undone and adds that can be redone. The array is the caller's to free.
+int *undo_restorable_ids(int *count) {
+    int capacity = 64;
+    int *ids = undo_realloc(NULL, capacity * sizeof(int));
+    *count = 0;
+    for (int step = first_step; step < step_count; step++) {
+        ActionType restorable = step < done_steps ? ACTION_DELETE : ACTION_ADD;
+        for (size_t offset = steps[step]; offset < step_end(step);) {
+            Change change;
+            offset = get_change(offset, &change);
+            if (change.type != restorable) {
+                continue;
+            }
+            if (*count == capacity) {
+                capacity *= 2;
+                ids = undo_realloc(ids, capacity * sizeof(int));
+            }
+            ids[(*count)++] = change.id;
+        }
+    }
+    return ids;
+}
+
+void undo_history_free() {
+    free(history);
+    free(steps);
+    free(step_records);
+    history = NULL;
+    steps = NULL;
+    step_records = NULL;
+    history_length = history_capacity = 0;
+    first_step = step_count = step_capacity = done_steps = 0;
+    step_records_capacity = 0;
+    group_depth = 0;
+    group_started = false;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "todo.h"
+
+// Differential checks for the indexes and the queries built on them.
+//
+// Each index, and each query, is compared against the answer a linear scan
+// of the task table gives, after a long run of random adds, deletes,
+// completions, edits, undos, redos and compactions has been applied to both.
+// Run with `make check` from build/; the tasks live only in memory, and HOME
+// points at a scratch directory for anything written to disk.
+
+// The table the saver and the command line work on, from main.c
+TaskTable tasks = {0};
+pthread_mutex_t task_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// main.c is not linked in; nothing here prompts
+void get_input_and_clear(char *buffer, int size, const char *prompt) {
+    (void)size;
+    (void)prompt;
+    buffer[0] = '\0';
+}
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                         \
+    do {                                              \
+        if (!(condition)) {                           \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);             \
+            fputc('\n', stderr);                      \
+            failures++;                               \
+        }                                             \
+    } while (0)
+
+static const char *categories[] = {"ops", "infra", "home", "work"};
+static int today;
+
+static int random_due() {
+    return rand() % 5 ? today - 30 + rand() % 60 : NO_DUE_DAY;
+}
+
+static void add_random_task() {
+    char title[32];
+    snprintf(title, sizeof(title), "%s %d", rand() % 3 ? "Report" : "fix", rand() % 100);
+    add_task(&tasks, title, categories[rand() % 4], random_due(), rand() % 6, 1 + rand() % 5);
+}
+
+// One random change to the tasks, through the same entry points the
+// interface uses
+static void mutate() {
+    int position = rand() % tasks.count;
+    const Task *task = TASK_AT(&tasks, position);
+    int choice = rand() % 10;
+    if (choice < 2) {
+        add_random_task();
+    } else if (choice < 3 && !TASK_IS_DELETED(task)) {
+        undo_record(ACTION_DELETE, task, NULL);
+        remove_task(&tasks, position);
+    } else if (choice < 5 && !TASK_IS_DELETED(task)) {
+        toggle_task_completion(task_for_write(&tasks, position));
+    } else if (choice < 6) {
+        undo_step(&tasks);
+    } else if (choice < 7) {
+        redo_step(&tasks);
+    } else if (choice < 8) {
+        compact_tasks(&tasks, rand() % 2);
+    } else if (!TASK_IS_DELETED(task)) {
+        // An edit of the indexed fields, as batch_edit makes
+        Task before = *task;
+        Task *edited = task_for_write(&tasks, position);
+        edited->priority = 1 + rand() % 5;
+        edited->category = intern_category(categories[rand() % 4]);
+        undo_record(ACTION_EDIT, &before, edited);
+        journal_record(ACTION_EDIT, edited->id, edited);
+        task_changed(position, edited);
+    }
+}
+
+static int compare_values(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Bitmap operations against sorted arrays, on sets sparse and dense enough
+// to use both kinds of container
+static void check_bitmaps() {
+    enum { RANGE = 1 << 18 };
+    static uint8_t in_a[RANGE], in_b[RANGE];
+    for (int round = 0; round < 6; round++) {
+        Bitmap a = {0}, b = {0}, result = {0};
+        int density = round % 3 == 0 ? 2 : round % 3 == 1 ? 40 : 4000;
+        memset(in_a, 0, sizeof(in_a));
+        memset(in_b, 0, sizeof(in_b));
+        for (int i = 0; i < RANGE / density * 4; i++) {
+            uint32_t value = rand() % RANGE;
+            if (rand() % 4) {
+                bitmap_add(&a, value);
+                in_a[value] = 1;
+            } else {
+                bitmap_remove(&a, value);
+                in_a[value] = 0;
+            }
+            value = rand() % RANGE;
+            bitmap_add(&b, value);
+            in_b[value] = 1;
+        }
+
+        void (*operations[])(Bitmap *, const Bitmap *, const Bitmap *) = {bitmap_and, bitmap_or, bitmap_andnot};
+        for (int op = 0; op < 3; op++) {
+            operations[op](&result, &a, &b);
+            uint32_t expected = 0;
+            bool same = true;
+            for (uint32_t value = 0; value < RANGE; value++) {
+                bool want = op == 0 ? in_a[value] && in_b[value]
+                          : op == 1 ? in_a[value] || in_b[value]
+                          : in_a[value] && !in_b[value];
+                expected += want;
+                same = same && bitmap_contains(&result, value) == want;
+            }
+            CHECK(same && bitmap_count(&result) == expected,
+                  "bitmap operation %d at density %d: %u values, expected %u", op, density,
+                  bitmap_count(&result), expected);
+
+            uint32_t *values = malloc((expected + 1) * sizeof(uint32_t));
+            uint32_t count = bitmap_values(&result, values);
+            bool sorted = true;
+            for (uint32_t i = 1; i < count; i++) {
+                sorted = sorted && values[i - 1] < values[i];
+            }
+            CHECK(count == expected && sorted, "bitmap_values of operation %d is not the sorted set", op);
+            free(values);
+            bitmap_free(&result);
+        }
+        bitmap_free(&a);
+        bitmap_free(&b);
+    }
+}
+
+// Every field bitmap holds exactly the slots of the live tasks with that value
+static void check_bitmap_index() {
+    uint32_t *expected = malloc((tasks.count + 1) * sizeof(uint32_t));
+    uint32_t *actual = malloc((tasks.count + 1) * sizeof(uint32_t));
+    for (int field = BITMAP_ALL; field <= BITMAP_RECURRENCE; field++) {
+        uint32_t values = field == BITMAP_CATEGORY ? category_count() : field == BITMAP_PRIORITY ? 6
+                        : field == BITMAP_COMPLETED ? 2 : field == BITMAP_RECURRENCE ? RECURRENCE_YEARLY + 1 : 1;
+        for (uint32_t value = 0; value < values; value++) {
+            uint32_t count = 0;
+            for (int i = 0; i < tasks.count; i++) {
+                const Task *task = TASK_AT(&tasks, i);
+                uint32_t have = field == BITMAP_CATEGORY ? task->category : field == BITMAP_PRIORITY ? task->priority
+                              : field == BITMAP_COMPLETED ? task->completed != 0
+                              : field == BITMAP_RECURRENCE ? task->recurrence : 0;
+                if (!TASK_IS_DELETED(task) && have == value) {
+                    expected[count++] = task_id_slot(task->id);
+                }
+            }
+            qsort(expected, count, sizeof(uint32_t), compare_values);
+            const Bitmap *bitmap = bitmap_index_lookup(field, value);
+            uint32_t found = bitmap_count(bitmap) <= (uint32_t)tasks.count ? bitmap_values(bitmap, actual) : 0;
+            CHECK(found == count && memcmp(expected, actual, count * sizeof(uint32_t)) == 0,
+                  "bitmap index field %d value %u: %u slots, a scan finds %u", field, value, found, count);
+        }
+    }
+    free(expected);
+    free(actual);
+}
+
+static bool in_category(const Task *task, const char *name) {
+    return strcmp(category_name(task->category), name) == 0;
+}
+
+static bool in_title(const Task *task, const char *word) {
+    for (const char *c = task->title; *c != '\0'; c++) {
+        if (strncasecmp(c, word, strlen(word)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_due(const Task *task) {
+    return task->due_day != NO_DUE_DAY;
+}
+
+// Queries and the same conditions written out in C
+typedef struct {
+    const char *text;
+    bool (*matches)(const Task *task);
+} QueryCase;
+
+static bool query_example(const Task *t) {
+    return has_due(t) && t->due_day < today + 7 && t->priority >= 3 && (in_category(t, "ops") || in_category(t, "infra"));
+}
+static bool query_words(const Task *t) {
+    return t->priority >= 4 && in_category(t, "work") && !t->completed && in_title(t, "rep");
+}
+static bool query_not_or(const Task *t) {
+    return t->priority != 2 || (t->completed && !has_due(t));
+}
+static bool query_status(const Task *t) {
+    return has_due(t) && (t->due_day <= today || t->due_day == today + 1);
+}
+static bool query_sets(const Task *t) {
+    return !in_category(t, "home") && t->recurrence == RECURRENCE_WEEKLY;
+}
+static bool query_title(const Task *t) {
+    return has_due(t) && t->due_day >= today - 3 && !in_title(t, "x1");
+}
+static bool query_range(const Task *t) {
+    return has_due(t) && t->due_day >= today && t->due_day < today + 3 && t->priority >= 2 && t->priority <= 4;
+}
+static bool query_empty_range(const Task *t) {
+    (void)t;
+    return false;
+}
+static bool query_view(const Task *t) {
+    return (in_category(t, "ops") || in_category(t, "infra")) && !t->completed && t->priority >= 4;
+}
+
+static const QueryCase query_cases[] = {
+    {"due < today+7 and priority >= 3 and category in (ops, infra)", query_example},
+    {"priority>=4 category=work open rep", query_words},
+    {"not priority = 2 or (done and due = none)", query_not_or},
+    {"overdue or soon", query_status},
+    {"category != home recurrence=weekly", query_sets},
+    {"due >= today-3 and not title ~ x1", query_title},
+    {"due >= today and due < today+3 and priority >= 2 and priority <= 4", query_range},
+    {"due >= today+5 and due < today", query_empty_range},
+    {"category = nosuch", query_empty_range},
+    {"@active and priority >= 4", query_view},
+};
+
+// tasks_where returns exactly the matching tasks, in the order they are
+// listed in
+static void check_queries() {
+    char error[128];
+    for (size_t q = 0; q < sizeof(query_cases) / sizeof(query_cases[0]); q++) {
+        uint32_t *positions;
+        int count = tasks_where(&tasks, query_cases[q].text, &positions, error, sizeof(error));
+        CHECK(count >= 0, "'%s' did not compile: %s", query_cases[q].text, error);
+        if (count < 0) {
+            continue;
+        }
+        int expected = 0, wrong = 0, out_of_order = 0;
+        for (int i = 0; i < tasks.count; i++) {
+            const Task *task = TASK_AT(&tasks, i);
+            expected += !TASK_IS_DELETED(task) && query_cases[q].matches(task);
+        }
+        bool sorted = get_sort_mode() != SORT_NONE;
+        for (int i = 0; i < count; i++) {
+            const Task *task = TASK_AT(&tasks, positions[i]);
+            wrong += TASK_IS_DELETED(task) || !query_cases[q].matches(task);
+            if (i > 0) {
+                int previous = sorted ? sort_view_row(&tasks, positions[i - 1]) : (int)positions[i - 1];
+                int current = sorted ? sort_view_row(&tasks, positions[i]) : (int)positions[i];
+                out_of_order += previous >= current;
+            }
+        }
+        CHECK(count == expected && wrong == 0 && out_of_order == 0,
+              "'%s': %d tasks (%d wrong, %d out of order), a scan finds %d", query_cases[q].text, count, wrong,
+              out_of_order, expected);
+        free(positions);
+    }
+}
+
+static void check_query_errors() {
+    static const char *invalid[] = {"priority >", "(done", "due < tomorrow", "category ~ x", "@nosuch",
+                                    "priority in 3", "done )", "@loop",
+                                    "recurrence = Daily", "recurrence = NONE"};
+    char error[128];
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        uint32_t *positions;
+        error[0] = '\0';
+        int count = tasks_where(&tasks, invalid[i], &positions, error, sizeof(error));
+        CHECK(count == -1 && error[0] != '\0', "'%s' should be rejected with a message", invalid[i]);
+        free(positions);
+    }
+}
+
+// Views survive being saved, replaced and deleted around one another
+static void check_views() {
+    char error[128], long_query[MAX_TITLE_LEN + 16];
+    CHECK(save_view("active", "category in (ops, infra) open", error, sizeof(error)), "save: %s", error);
+    CHECK(save_view("loop", "@other", error, sizeof(error)) == 0, "a view naming a missing view was saved");
+    CHECK(save_view("other", "done", error, sizeof(error)), "save: %s", error);
+    CHECK(save_view("loop", "@other", error, sizeof(error)), "save: %s", error);
+    CHECK(save_view("other", "@loop", error, sizeof(error)), "save: %s", error);
+
+    memset(long_query, 'x', sizeof(long_query) - 1);
+    long_query[sizeof(long_query) - 1] = '\0';
+    CHECK(save_view("long", long_query, error, sizeof(error)) == 0, "a query too long to read back was saved");
+    CHECK(save_view("bad name", "done", error, sizeof(error)) == 0, "an invalid view name was accepted");
+    CHECK(delete_view("nosuch") == 0, "deleting a missing view succeeded");
+
+    // A line longer than any query, as a hand edit could leave, is kept
+    // whole when other views are rewritten
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", getenv("HOME"), VIEWS_FILE_PATH);
+    FILE *file = fopen(path, "a");
+    fprintf(file, "long\t%s\n", long_query);
+    fclose(file);
+    CHECK(save_view("extra", "open", error, sizeof(error)) && delete_view("extra"), "save and delete: %s", error);
+
+    char *listing = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&listing, &size);
+    list_views(out);
+    fclose(out);
+    int lines = 0;
+    for (const char *c = listing; *c != '\0'; c++) {
+        lines += *c == '\n';
+    }
+    CHECK(lines == 4 && strstr(listing, long_query) != NULL, "views.txt holds %d lines, not the 4 views", lines);
+    free(listing);
+}
+
+// agenda_tasks returns exactly the tasks due in the range, by day, then from
+// priority 5 down, then by ID
+static void check_agenda(int first_day, int last_day) {
+    uint32_t *positions;
+    int count = agenda_tasks(&tasks, first_day, last_day, &positions);
+    int expected = 0, wrong = 0, out_of_order = 0;
+    for (int i = 0; i < tasks.count; i++) {
+        const Task *task = TASK_AT(&tasks, i);
+        expected += !TASK_IS_DELETED(task) && has_due(task) && task->due_day >= first_day && task->due_day <= last_day;
+    }
+    for (int i = 0; i < count; i++) {
+        const Task *task = TASK_AT(&tasks, positions[i]);
+        wrong += TASK_IS_DELETED(task) || task->due_day < first_day || task->due_day > last_day;
+        if (i > 0) {
+            const Task *previous = TASK_AT(&tasks, positions[i - 1]);
+            out_of_order += previous->due_day > task->due_day ||
+                            (previous->due_day == task->due_day && (previous->priority < task->priority ||
+                             (previous->priority == task->priority && previous->id > task->id)));
+        }
+    }
+    CHECK(count == expected && wrong == 0 && out_of_order == 0,
+          "agenda %d to %d: %d tasks (%d wrong, %d out of order), a scan finds %d", first_day, last_day, count,
+          wrong, out_of_order, expected);
+    free(positions);
+}
+
+static void check_agenda_spans() {
+    int first, last, year, month, day;
+    CHECK(agenda_span("today", today, &first, &last) && first == today && last == today, "today's span");
+    // 2026-10-16 is a Friday, in the week of Monday 2026-10-12
+    int friday = days_from_civil(2026, 10, 16);
+    CHECK(agenda_span("week", friday, &first, &last) && first == days_from_civil(2026, 10, 12) && last == first + 6,
+          "week of 2026-10-16");
+    CHECK(agenda_span("month", days_from_civil(2024, 2, 10), &first, &last) &&
+          first == days_from_civil(2024, 2, 1) && last == days_from_civil(2024, 2, 29), "February 2024");
+    CHECK(agenda_span("month", days_from_civil(2026, 12, 31), &first, &last) && last == days_from_civil(2026, 12, 31),
+          "December 2026");
+    civil_from_days(first, &year, &month, &day);
+    CHECK(year == 2026 && month == 12 && day == 1, "December 2026 starts on the 1st");
+    CHECK(agenda_span("fortnight", today, &first, &last) == 0, "an unknown span was accepted");
+}
+
+int main() {
+    srand(1);
+    today = today_day();
+    get_database_path();  // Makes the data directory, as loading the tasks does
+    for (int i = 0; i < 20000; i++) {
+        add_random_task();
+    }
+
+    check_bitmaps();
+
+    bitmap_index_build(&tasks);
+    check_bitmap_index();
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 2000; i++) {
+            mutate();
+        }
+        check_bitmap_index();
+    }
+
+    check_views();
+    check_query_errors();
+    for (int round = 0; round < 10; round++) {
+        if (round == 5) {
+            SortSpec spec;
+            parse_sort_spec("-priority,due", &spec);
+            set_sort_spec(&spec);
+        }
+        for (int i = 0; i < 2000; i++) {
+            mutate();
+        }
+        check_queries();
+    }
+    set_sort_mode(&tasks, SORT_NONE);
+
+    check_agenda_spans();
+    due_index_build(&tasks);
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 2000; i++) {
+            mutate();
+        }
+        int first_day = today - 40 + rand() % 80;
+        check_agenda(first_day, first_day);
+        check_agenda(first_day, first_day + rand() % 10);
+        check_agenda(INT_MIN, INT_MAX);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All index checks passed.\n");
+    return 0;
+}